@@ -0,0 +1,86 @@
+#include "arena.h"
+
+Arena::Arena(Arena&& other)
+  : blocks_(std::move(other.blocks_))
+  , blockSize_(other.blockSize_)
+  , current_(other.current_)
+  , pos_(other.pos_)
+  , end_(other.end_)
+{
+  other.blocks_.clear();
+  other.current_ = 0;
+  other.pos_ = other.end_ = nullptr;
+}
+
+Arena& Arena::operator=(Arena&& other) {
+  if (this != &other) {
+    release();
+    blocks_ = std::move(other.blocks_);
+    blockSize_ = other.blockSize_;
+    current_ = other.current_;
+    pos_ = other.pos_;
+    end_ = other.end_;
+    other.blocks_.clear();
+    other.current_ = 0;
+    other.pos_ = other.end_ = nullptr;
+  }
+  return *this;
+}
+
+Arena::~Arena() {
+  release();
+}
+
+void Arena::release() {
+  for (auto& block : blocks_) {
+    delete[] block.data;
+  }
+  blocks_.clear();
+  current_ = 0;
+  pos_ = end_ = nullptr;
+}
+
+// Moves on to the next kept block that is large enough, or adds a new one.
+void* Arena::grow(size_t size, size_t align) {
+  size_t next = (pos_ ? current_ + 1 : current_);
+  while (next < blocks_.size() && blocks_[next].size < size + align) {
+    ++next;
+  }
+  if (next >= blocks_.size()) {
+    Block block;
+    block.size = std::max(blockSize_, size + align);
+    block.data = new char[block.size];
+    blocks_.push_back(block);
+    next = blocks_.size() - 1;
+  }
+  current_ = next;
+  pos_ = blocks_[next].data;
+  end_ = pos_ + blocks_[next].size;
+  return alloc(size, align);
+}
+
+void Arena::reset() {
+  if (blocks_.size() > 1) {
+    size_t total = capacity();
+    release();
+    Block block;
+    block.size = total;
+    block.data = new char[total];
+    blocks_.push_back(block);
+  }
+  current_ = 0;
+  if (blocks_.empty()) {
+    pos_ = end_ = nullptr;
+  } else {
+    pos_ = blocks_[0].data;
+    end_ = pos_ + blocks_[0].size;
+  }
+}
+
+size_t Arena::capacity() const {
+  size_t total = 0;
+  for (auto& block : blocks_) {
+    total += block.size;
+  }
+  return total;
+}
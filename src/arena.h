@@ -0,0 +1,62 @@
+#pragma once
+
+#include "common.h"
+#include <vector>
+
+// Monotonic allocator: memory is handed out from large blocks and only given
+// back all at once. reset() keeps the memory for the next round, folding the
+// blocks into one when more than one was needed, so an arena that is reused
+// for similar work settles on a single buffer and stops touching the heap.
+class Arena {
+public:
+  enum { DefaultBlock = 4096, DefaultAlign = sizeof(double) };
+
+  explicit Arena(size_t blockSize = DefaultBlock)
+    : blockSize_(blockSize)
+    , current_(0)
+    , pos_(nullptr)
+    , end_(nullptr)
+  {}
+  Arena(Arena&& other);
+  Arena& operator=(Arena&& other);
+  ~Arena();
+
+  Arena(Arena const&) = delete;
+  Arena& operator=(Arena const&) = delete;
+
+  void* alloc(size_t size, size_t align = DefaultAlign) {
+    char* ptr = pos_ + ((0 - reinterpret_cast<size_t>(pos_)) & (align - 1));
+    if (ptr > end_ || size > static_cast<size_t>(end_ - ptr)) return grow(size, align);
+    pos_ = ptr + size;
+    return ptr;
+  }
+  char* allocString(size_t size) {
+    return static_cast<char*>(alloc(size, 1));
+  }
+  // the copy is followed by a null character
+  StringView copy(StringView str) {
+    char* dst = allocString(str.size() + 1);
+    if (str.size()) memcpy(dst, str.data(), str.size());
+    dst[str.size()] = 0;
+    return StringView(dst, str.size());
+  }
+
+  // Invalidates everything allocated so far.
+  void reset();
+  // total size of the blocks held
+  size_t capacity() const;
+
+private:
+  struct Block {
+    char* data;
+    size_t size;
+  };
+  std::vector<Block> blocks_;
+  size_t blockSize_;
+  size_t current_;
+  char* pos_;
+  char* end_;
+
+  void* grow(size_t size, size_t align);
+  void release();
+};
@@ -0,0 +1,239 @@
+#include "tool.h"
+#include "shrines.h"
+#include "queue.h"
+#include "itemreader.h"
+#include "itemcodec.h"
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <thread>
+
+namespace {
+
+enum { BatchSize = 256 };
+
+// Item texts are copied one after another into a single buffer, and batches
+// go back to the reader once they are matched, so neither the buffer nor the
+// lists are allocated again for every batch.
+struct Batch {
+  uint64 first;
+  std::string text;
+  std::vector<size_t> ends;         // of every item in text
+  std::vector<StringView> records;  // encoded items, used instead of the texts
+  std::promise<std::string> result;
+
+  size_t size() const {
+    return records.empty() ? ends.size() : records.size();
+  }
+  StringView item(size_t i) const {
+    size_t start = (i ? ends[i - 1] : 0);
+    return StringView(text.data() + start, ends[i] - start);
+  }
+};
+
+typedef ConcurrentQueue<std::unique_ptr<Batch>> SpareQueue;
+
+struct Stats {
+  std::atomic<uint64> parsed;
+  std::atomic<uint64> matched;
+  Stats()
+    : parsed(0)
+    , matched(0)
+  {}
+};
+
+void writeItem(json::WriterVisitor& writer, uint64 index, ItemTip const* tip, MatchResult const& data) {
+  writer.onOpenMap();
+  writer.onMapKey("item");
+  writer.onInteger64(static_cast<sint64>(index));
+  writeMatch(writer, tip, data);
+  writer.onCloseMap();
+  writer.endLine();
+}
+
+void worker(ShrineData const& shrines, ItemDecoder const* decoder, BlockingQueue<std::unique_ptr<Batch>>& queue,
+            SpareQueue& spare, Stats& stats) {
+  std::unique_ptr<Batch> batch;
+  // one item, result and output buffer per thread, reused for every batch
+  MemoryFile out;
+  json::WriterVisitor writer(out);
+  MatchResult data;
+  ItemTip tip;
+  while (queue.pop(batch)) {
+    out.resize(0);
+    uint64 parsed = 0, matched = 0;
+    size_t count = batch->size();
+    for (size_t i = 0; i < count; ++i) {
+      if (decoder ? decoder->decode(batch->records[i], tip) : tip.parse(batch->item(i))) {
+        shrines.match(tip, data);
+        ++parsed;
+        if (!data.empty()) ++matched;
+        writeItem(writer, batch->first + i, &tip, data);
+      } else {
+        writeItem(writer, batch->first + i, nullptr, MatchResult());
+      }
+    }
+    stats.parsed += parsed;
+    stats.matched += matched;
+    writer.flush();
+    batch->result.set_value(std::string(reinterpret_cast<char const*>(out.data()), out.csize()));
+    // dropped if the reader has enough to go on
+    spare.tryPush(std::move(batch));
+  }
+}
+
+void writeResults(File& out, BlockingQueue<std::future<std::string>>& results) {
+  std::future<std::string> result;
+  while (results.pop(result)) {
+    std::string text = result.get();
+    out.write(text.data(), text.size());
+  }
+}
+
+}
+
+int runBatch(Options const& opts) {
+  ShrineData shrines;
+  File effects(opts.get("effects"));
+  if (!effects || !shrines.load(effects)) {
+    fprintf(stderr, "failed to load effects from '%s'\n", opts.get("effects").c_str());
+    return 1;
+  }
+  if (opts.has("telemetry")) shrines.loadTelemetry(opts.get("telemetry"));
+  // encoded input is mapped and its records are decoded by the workers
+  bool binary = opts.has("binary");
+  std::unique_ptr<FileMapping> mapping;
+  ItemDecoder decoder;
+  File input;
+  if (binary) {
+    mapping.reset(new FileMapping(opts.get("input")));
+    if (!*mapping || !decoder.open(mapping->data(), mapping->size())) {
+      fprintf(stderr, "failed to open encoded input '%s'\n", opts.get("input").c_str());
+      return 1;
+    }
+  } else {
+    input = openInput(opts.get("input", "-"));
+    if (!input) {
+      fprintf(stderr, "failed to open input '%s'\n", opts.get("input").c_str());
+      return 1;
+    }
+  }
+  File output = openOutput(opts.get("output", "-"));
+  if (!output) {
+    fprintf(stderr, "failed to open output '%s'\n", opts.get("output").c_str());
+    return 1;
+  }
+  int numThreads = std::max(opts.getInt("threads", defaultThreads()), 1);
+
+  double start = timeNow();
+  Stats stats;
+  BlockingQueue<std::unique_ptr<Batch>> queue(numThreads * 2);
+  BlockingQueue<std::future<std::string>> results(numThreads * 4);
+  SpareQueue spare(numThreads * 4);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < numThreads; ++i) {
+    threads.emplace_back(worker, std::cref(shrines), binary ? &decoder : nullptr, std::ref(queue), std::ref(spare),
+      std::ref(stats));
+  }
+  std::thread output_thread(writeResults, std::ref(output), std::ref(results));
+
+  uint64 count = 0, bytes = 0;
+  std::unique_ptr<Batch> batch;
+  auto nextItem = [&]() -> Batch& {
+    if (!batch) {
+      if (spare.tryPop(batch)) {
+        batch->text.clear();
+        batch->ends.clear();
+        batch->records.clear();
+        batch->result = std::promise<std::string>();
+      } else {
+        batch.reset(new Batch);
+      }
+      batch->first = count;
+    }
+    ++count;
+    return *batch;
+  };
+  auto submit = [&]() {
+    results.push(batch->result.get_future());
+    queue.push(std::move(batch));
+  };
+  if (binary) {
+    StringView record;
+    while (decoder.nextRecord(record)) {
+      nextItem().records.push_back(record);
+      if (batch->records.size() >= BatchSize) submit();
+    }
+    bytes = mapping->size();
+  } else {
+    // anything before the first "Rarity:" header is ignored
+    ItemReader reader(input);
+    while (reader.next()) {
+      StringView text = reader.text();
+      Batch& next = nextItem();
+      next.text.append(text.data(), text.size());
+      next.ends.push_back(next.text.size());
+      if (next.ends.size() >= BatchSize) submit();
+    }
+    bytes = reader.bytes();
+  }
+  if (batch) submit();
+
+  queue.close();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  results.close();
+  output_thread.join();
+  if (opts.has("telemetry") && !shrines.saveTelemetry()) {
+    fprintf(stderr, "failed to save telemetry to '%s'\n", opts.get("telemetry").c_str());
+  }
+
+  double elapsed = std::max(timeNow() - start, 1e-6);
+  fprintf(stderr, "%llu items (%llu parsed, %llu with effects) in %.3fs on %d threads: %.0f items/s, %.1f MB/s\n",
+    (unsigned long long) count, (unsigned long long) stats.parsed.load(), (unsigned long long) stats.matched.load(),
+    elapsed, numThreads, count / elapsed, bytes / elapsed / 1048576.0);
+  if (decoder.failed()) {
+    fprintf(stderr, "encoded input is broken, stopped after %llu items\n", (unsigned long long) count);
+    return 1;
+  }
+  return 0;
+}
+
+// Parses item texts once and writes them in the binary form of ItemEncoder.
+int runEncode(Options const& opts) {
+  File input = openInput(opts.get("input", "-"));
+  if (!input) {
+    fprintf(stderr, "failed to open input '%s'\n", opts.get("input").c_str());
+    return 1;
+  }
+  File output = openOutput(opts.get("output", "-"));
+  if (!output) {
+    fprintf(stderr, "failed to open output '%s'\n", opts.get("output").c_str());
+    return 1;
+  }
+
+  double start = timeNow();
+  ItemReader reader(input);
+  ItemEncoder encoder(output);
+  ItemTip tip;
+  uint64 parsed = 0;
+  while (reader.next()) {
+    if (tip.parse(reader.text())) {
+      encoder.write(tip);
+      ++parsed;
+    } else {
+      encoder.skip();
+    }
+  }
+  if (!encoder.finish()) {
+    fprintf(stderr, "failed to write output '%s'\n", opts.get("output").c_str());
+    return 1;
+  }
+
+  double elapsed = std::max(timeNow() - start, 1e-6);
+  fprintf(stderr, "%llu items (%llu parsed) in %.3fs: %.0f items/s, %.1f MB/s\n",
+    (unsigned long long) encoder.items(), (unsigned long long) parsed,
+    elapsed, encoder.items() / elapsed, reader.bytes() / elapsed / 1048576.0);
+  return 0;
+}
@@ -0,0 +1,245 @@
+#include "tool.h"
+#include "shrines.h"
+#include "itemreader.h"
+#include "layout.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdlib.h>
+
+// Allocation counting for the whole binary. It is off outside of the benchmark
+// so the other modes only pay for the flag check. Every form of new and delete
+// is replaced, so that memory from malloc is never passed to the library's
+// delete (C++14 compilers call the sized forms).
+static std::atomic<bool> countAllocations(false);
+static std::atomic<uint64> allocations(0);
+
+void* operator new(size_t size, std::nothrow_t const&) throw() {
+  if (countAllocations.load(std::memory_order_relaxed)) allocations.fetch_add(1, std::memory_order_relaxed);
+  return malloc(size ? size : 1);
+}
+void* operator new[](size_t size, std::nothrow_t const&) throw() {
+  return operator new(size, std::nothrow);
+}
+void* operator new(size_t size) {
+  void* ptr = operator new(size, std::nothrow);
+  if (!ptr) throw std::bad_alloc();
+  return ptr;
+}
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+void operator delete(void* ptr) throw() {
+  free(ptr);
+}
+void operator delete[](void* ptr) throw() {
+  free(ptr);
+}
+void operator delete(void* ptr, size_t) throw() {
+  free(ptr);
+}
+void operator delete[](void* ptr, size_t) throw() {
+  free(ptr);
+}
+void operator delete(void* ptr, std::nothrow_t const&) throw() {
+  free(ptr);
+}
+void operator delete[](void* ptr, std::nothrow_t const&) throw() {
+  free(ptr);
+}
+
+namespace {
+
+// Latency histogram in nanoseconds. Each power of two is split into 16
+// buckets, so reported percentiles are within about 6% of the real value
+// over the whole range, at a fixed size.
+class Histogram {
+public:
+  Histogram()
+    : total_(0)
+    , max_(0)
+  {
+    memset(counts_, 0, sizeof counts_);
+  }
+
+  void add(uint64 ns) {
+    ++counts_[bucket(ns)];
+    ++total_;
+    max_ = std::max(max_, ns);
+  }
+
+  uint64 count() const {
+    return total_;
+  }
+  uint64 max() const {
+    return max_;
+  }
+  // upper bound of the bucket holding the given fraction of samples
+  uint64 percentile(double p) const {
+    uint64 target = static_cast<uint64>(p * total_ + 0.5);
+    if (target < 1) target = 1;
+    uint64 seen = 0;
+    for (int i = 0; i < NumBuckets; ++i) {
+      seen += counts_[i];
+      if (seen >= target) return std::min(lower(i + 1) - 1, max_);
+    }
+    return max_;
+  }
+
+private:
+  enum { SubBits = 4, SubBuckets = 1 << SubBits, NumBuckets = 61 * SubBuckets };
+  uint64 counts_[NumBuckets];
+  uint64 total_;
+  uint64 max_;
+
+  static int bucket(uint64 ns) {
+    if (ns < SubBuckets) return static_cast<int>(ns);
+    int shift = -SubBits;
+    for (uint64 v = ns; v > 1; v >>= 1) ++shift;
+    return (shift + 1) * SubBuckets + static_cast<int>((ns >> shift) & (SubBuckets - 1));
+  }
+  static uint64 lower(int index) {
+    if (index < SubBuckets) return index;
+    int shift = index / SubBuckets - 1;
+    return uint64(SubBuckets + index % SubBuckets) << shift;
+  }
+};
+
+enum { StageConvert, StageParse, StageMatch, StageLayout, NumStages };
+char const* StageNames[NumStages] = {"utf16_to_utf8", "parse", "match", "layout"};
+
+struct Stage {
+  Histogram latency;
+  uint64 allocations;
+  Stage()
+    : allocations(0)
+  {}
+};
+
+class StageTimer {
+public:
+  explicit StageTimer(Stage& stage)
+    : stage_(stage)
+    , allocs_(allocations.load(std::memory_order_relaxed))
+    , start_(std::chrono::steady_clock::now())
+  {}
+  ~StageTimer() {
+    auto elapsed = std::chrono::steady_clock::now() - start_;
+    stage_.latency.add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    stage_.allocations += allocations.load(std::memory_order_relaxed) - allocs_;
+  }
+
+private:
+  Stage& stage_;
+  uint64 allocs_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+std::string formatTime(uint64 ns) {
+  if (ns < 10000) return fmtstring("%lluns", (unsigned long long) ns);
+  if (ns < 10000000) return fmtstring("%.1fus", ns / 1e3);
+  return fmtstring("%.1fms", ns / 1e6);
+}
+
+void printStage(char const* name, Histogram const& latency, uint64 allocs) {
+  printf("%-14s %9s %9s %9s %9s %9.1f\n", name,
+    formatTime(latency.percentile(0.5)).c_str(), formatTime(latency.percentile(0.99)).c_str(),
+    formatTime(latency.percentile(0.999)).c_str(), formatTime(latency.max()).c_str(),
+    latency.count() ? double(allocs) / latency.count() : 0.0);
+}
+
+// Splits a corpus of concatenated clipboard texts with the ItemReader batch
+// mode uses, and stores them as UTF-16 like the clipboard.
+std::vector<std::wstring> loadCorpus(File& input) {
+  std::vector<std::wstring> items;
+  ItemReader reader(input);
+  std::string item;
+  while (reader.next()) {
+    // the clipboard has windows line breaks
+    item.clear();
+    StringView text = reader.text();
+    for (size_t i = 0; i < text.size(); ++i) {
+      char chr = text[i];
+      if (chr == '\r' || chr == '\n') {
+        if (chr == '\r' && i + 1 < text.size() && text[i + 1] == '\n') ++i;
+        item.append("\r\n");
+      } else {
+        item.push_back(chr);
+      }
+    }
+    if (item.size() < 2 || item.compare(item.size() - 2, 2, "\r\n")) item.append("\r\n");
+    items.push_back(utf8_to_utf16(item));
+  }
+  return items;
+}
+
+}
+
+int runBench(Options const& opts) {
+  ShrineData shrines;
+  File effects(opts.get("effects"));
+  if (!effects || !shrines.load(effects)) {
+    fprintf(stderr, "failed to load effects from '%s'\n", opts.get("effects").c_str());
+    return 1;
+  }
+  File input = openInput(opts.get("input", "-"));
+  if (!input) {
+    fprintf(stderr, "failed to open input '%s'\n", opts.get("input").c_str());
+    return 1;
+  }
+  std::vector<std::wstring> corpus = loadCorpus(input);
+  if (corpus.empty()) {
+    fprintf(stderr, "no items in input\n");
+    return 1;
+  }
+  int iterations = std::max(opts.getInt("iterations", 1), 1);
+
+  // one untimed pass to warm up caches and lazily built state
+  ItemTip tip;
+  for (auto& clip : corpus) {
+    if (tip.parse(utf16_to_utf8(clip))) shrines.match(tip);
+  }
+
+  Stage stages[NumStages];
+  Stage total;
+  uint64 parsed = 0;
+  MatchResult data;
+  TooltipLayout layout;
+  countAllocations = true;
+  for (int iter = 0; iter < iterations; ++iter) {
+    for (auto& clip : corpus) {
+      StageTimer timer(total);
+      std::string text;
+      {
+        StageTimer timer(stages[StageConvert]);
+        text = utf16_to_utf8(clip);
+      }
+      bool ok;
+      {
+        StageTimer timer(stages[StageParse]);
+        ok = tip.parse(text);
+      }
+      if (!ok) continue;
+      ++parsed;
+      {
+        StageTimer timer(stages[StageMatch]);
+        shrines.match(tip, data);
+      }
+      {
+        StageTimer timer(stages[StageLayout]);
+        layoutTooltip(data, layout);
+      }
+    }
+  }
+  countAllocations = false;
+
+  printf("%llu items x %d iterations, %llu parsed\n",
+    (unsigned long long) corpus.size(), iterations, (unsigned long long) parsed);
+  printf("%-14s %9s %9s %9s %9s %9s\n", "stage", "p50", "p99", "p999", "max", "allocs");
+  for (int i = 0; i < NumStages; ++i) {
+    printStage(StageNames[i], stages[i].latency, stages[i].allocations);
+  }
+  printStage("total", total.latency, total.allocations);
+  return 0;
+}
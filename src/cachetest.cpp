@@ -0,0 +1,340 @@
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+#include "tool.h"
+#include "shrines.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#ifndef _WIN32
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace {
+
+char const* const Version7 = "[7, [\"Effect 0\", \"$1Shrine effect number 0\", \"+# to maximum Life\"]]";
+char const* const Version8 = "[8, [\"Effect 0\", \"$1Shrine effect number 0\", \"+# to maximum Life\"],"
+                             " [\"Effect 1\", \"$2Shrine effect number 1\", \"+#% to Fire Resistance\"]]";
+
+bool sendAll(SOCKET sock, std::string const& text) {
+  size_t pos = 0;
+  while (pos < text.size()) {
+    int count = send(sock, text.data() + pos, static_cast<int>(text.size() - pos), MSG_NOSIGNAL);
+    if (count <= 0) return false;
+    pos += count;
+  }
+  return true;
+}
+
+// Reads until the end of the headers, or until the peer closes the connection
+// if all is set.
+std::string recvText(SOCKET sock, bool all) {
+  std::string text;
+  char buf[4096];
+  while (all || text.find("\r\n\r\n") == std::string::npos) {
+    int count = recv(sock, buf, sizeof buf, 0);
+    if (count <= 0) break;
+    text.append(buf, count);
+  }
+  return text;
+}
+
+// Value of a header in the head of a request or response, or "" if it has none.
+std::string findHeader(std::string const& head, std::string const& name) {
+  std::string lower = strlower(head.substr(0, head.find("\r\n\r\n")));
+  std::string key = "\r\n" + strlower(name) + ":";
+  size_t pos = lower.find(key);
+  if (pos == std::string::npos) return "";
+  pos += key.size();
+  size_t end = head.find("\r\n", pos);
+  std::string value = head.substr(pos, end - pos);
+  value.erase(0, value.find_first_not_of(' '));
+  return value;
+}
+
+// A stand-in for the shrines.js server on a loopback port. It answers every
+// GET with its current body, or with 304 if the request has its ETag, and
+// keeps the validators each request came with.
+class StandIn {
+public:
+  StandIn()
+    : sock_(INVALID_SOCKET)
+    , port_(0)
+    , stop_(false)
+  {}
+  ~StandIn() {
+    stop_ = true;
+    if (thread_.joinable()) thread_.join();
+    if (sock_ != INVALID_SOCKET) closesocket(sock_);
+  }
+
+  bool start() {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sock_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock_ == INVALID_SOCKET) return false;
+    socklen_t size = sizeof addr;
+    if (bind(sock_, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0 || listen(sock_, SOMAXCONN) != 0 ||
+        getsockname(sock_, reinterpret_cast<sockaddr*>(&addr), &size) != 0) {
+      return false;
+    }
+    port_ = ntohs(addr.sin_port);
+    thread_ = std::thread([this]() { run(); });
+    return true;
+  }
+
+  int port() const {
+    return port_;
+  }
+
+  void serve(std::string const& body, std::string const& etag, std::string const& modified) {
+    std::lock_guard<std::mutex> lock(lock_);
+    body_ = body;
+    etag_ = etag;
+    modified_ = modified;
+  }
+
+  struct Request {
+    std::string etag;
+    std::string modified;
+    int status;
+  };
+  std::vector<Request> requests() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return requests_;
+  }
+
+private:
+  SOCKET sock_;
+  int port_;
+  std::atomic<bool> stop_;
+  std::thread thread_;
+  std::mutex lock_;
+  std::string body_;
+  std::string etag_;
+  std::string modified_;
+  std::vector<Request> requests_;
+
+  void run() {
+    while (!stop_) {
+      fd_set fds;
+      FD_ZERO(&fds);
+      FD_SET(sock_, &fds);
+      timeval timeout;
+      timeout.tv_sec = 0;
+      timeout.tv_usec = 50000;
+      if (select(static_cast<int>(sock_ + 1), &fds, nullptr, nullptr, &timeout) <= 0) continue;
+      SOCKET client = accept(sock_, nullptr, nullptr);
+      if (client == INVALID_SOCKET) continue;
+      answer(client, recvText(client, false));
+      closesocket(client);
+    }
+  }
+
+  void answer(SOCKET client, std::string const& head) {
+    std::lock_guard<std::mutex> lock(lock_);
+    Request request;
+    request.etag = findHeader(head, "If-None-Match");
+    request.modified = findHeader(head, "If-Modified-Since");
+    request.status = (!request.etag.empty() && request.etag == etag_ ? 304 : 200);
+    requests_.push_back(request);
+    std::string response;
+    if (request.status == 304) {
+      response = "HTTP/1.1 304 Not Modified\r\nConnection: close\r\n\r\n";
+    } else {
+      response = fmtstring("HTTP/1.1 200 OK\r\nContent-Length: %u\r\nETag: %s\r\nLast-Modified: %s\r\nConnection: close\r\n\r\n",
+        static_cast<uint32>(body_.size()), etag_.c_str(), modified_.c_str()) + body_;
+    }
+    sendAll(client, response);
+  }
+};
+
+// Plain HTTP/1.1 over a socket, enough to talk to the stand-in on any system.
+class LoopbackSource : public ShrineSource {
+public:
+  explicit LoopbackSource(int port)
+    : port_(port)
+  {}
+
+  Response fetch(std::string const& etag, std::string const& modified) {
+    Response response;
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<uint16>(port_));
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock == INVALID_SOCKET) return response;
+    std::string request = "GET /shrines.js HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n";
+    if (!etag.empty()) request += "If-None-Match: " + etag + "\r\n";
+    if (!modified.empty()) request += "If-Modified-Since: " + modified + "\r\n";
+    request += "\r\n";
+    std::string text;
+    if (connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == 0 && sendAll(sock, request)) {
+      text = recvText(sock, true);
+    }
+    closesocket(sock);
+
+    size_t body = text.find("\r\n\r\n");
+    if (text.compare(0, 5, "HTTP/") || body == std::string::npos) return response;
+    response.status = atoi(text.c_str() + text.find(' '));
+    if (response.status == 200) {
+      response.etag = findHeader(text, "ETag");
+      response.modified = findHeader(text, "Last-Modified");
+      response.body = File::memfile(text.data() + body + 4, text.size() - body - 4, true);
+    }
+    return response;
+  }
+
+private:
+  int port_;
+};
+
+class Checks {
+public:
+  Checks()
+    : count_(0)
+    , failed_(0)
+  {}
+
+  void operator()(bool ok, char const* what) {
+    ++count_;
+    if (!ok) {
+      ++failed_;
+      fprintf(stderr, "  FAILED: %s\n", what);
+    }
+  }
+  int count() const {
+    return count_;
+  }
+  int failed() const {
+    return failed_;
+  }
+
+private:
+  int count_;
+  int failed_;
+};
+
+bool writeText(std::string const& path, std::string const& text) {
+  File file(path, "wb");
+  return file && file.write(text.data(), text.size()) == text.size();
+}
+
+// Runs through a fresh cache, a revalidation, a changed file and two broken
+// caches, using sources made by makeSource.
+void checkCache(StandIn& server, std::string const& cache, std::function<std::unique_ptr<ShrineSource>()> const& makeSource,
+                Checks& check) {
+  remove(cache.c_str());
+  server.serve(Version7, "\"v7\"", "Mon, 19 Oct 2026 10:00:00 GMT");
+  size_t requests = server.requests().size();
+
+  // 200: loaded, published and written to the cache
+  {
+    ShrineData shrines(cache, makeSource());
+    check(!shrines.effects(), "no data without a cache");
+    check(shrines.update(), "update downloads the data");
+    check(shrines.version() == 7, "the downloaded data is published");
+    auto sent = server.requests();
+    check(sent.size() == requests + 1 && sent.back().etag.empty() && sent.back().modified.empty(),
+      "nothing to revalidate on the first download");
+    check(File(cache), "the download is cached");
+  }
+
+  // 304: the cached data stays as it is
+  {
+    requests = server.requests().size();
+    ShrineData shrines(cache, makeSource());
+    check(shrines.version() == 7, "the cache is loaded on construction");
+    check(server.requests().size() == requests, "loading the cache does not fetch");
+    auto before = shrines.effects();
+    check(shrines.update(), "update succeeds on 304");
+    auto sent = server.requests();
+    check(sent.size() == requests + 1 && sent.back().status == 304, "the server answers 304");
+    check(sent.back().etag == "\"v7\"" && sent.back().modified == "Mon, 19 Oct 2026 10:00:00 GMT",
+      "the cached validators are sent");
+    check(shrines.effects() == before, "nothing is parsed or compiled on 304");
+
+    // a new version replaces both the data and the cache
+    server.serve(Version8, "\"v8\"", "Mon, 19 Oct 2026 11:00:00 GMT");
+    check(shrines.update() && shrines.version() == 8, "a changed file is downloaded");
+    check(shrines.effects() != before, "a changed file is published");
+  }
+  check(ShrineData(cache).version() == 8, "the cache holds the changed file");
+
+  // a cache that does not load is treated as no cache at all
+  File saved(cache);
+  std::string valid = (saved ? saved.all() : "");
+  saved.release();
+  std::string broken[] = {"not a cache", valid.substr(0, valid.size() / 2)};
+  for (auto& text : broken) {
+    check(writeText(cache, text), "the cache can be overwritten");
+    requests = server.requests().size();
+    ShrineData shrines(cache, makeSource());
+    check(!shrines.effects(), "a broken cache is not loaded");
+    check(shrines.update() && shrines.version() == 8, "a broken cache is downloaded again");
+    auto sent = server.requests();
+    check(sent.size() == requests + 1 && sent.back().etag.empty() && sent.back().status == 200,
+      "a broken cache is not revalidated");
+    check(ShrineData(cache).version() == 8, "a broken cache is replaced");
+  }
+  remove(cache.c_str());
+}
+
+}
+
+int runCacheTest(Options const& opts) {
+  std::string cache = opts.get("cache", "cachetest.cache");
+#ifdef _WIN32
+  WSADATA wsa;
+  if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+    fprintf(stderr, "failed to initialize winsock\n");
+    return 1;
+  }
+#endif
+  Checks check;
+  {
+    StandIn server;
+    if (!server.start()) {
+      fprintf(stderr, "failed to start the stand-in server\n");
+      return 1;
+    }
+    int port = server.port();
+    fprintf(stderr, "stand-in server on 127.0.0.1:%d\n", port);
+    checkCache(server, cache, [port]() {
+      return std::unique_ptr<ShrineSource>(new LoopbackSource(port));
+    }, check);
+#ifdef _WIN32
+    // the same through WinHTTP, which update() uses by default
+    std::string url = fmtstring("http://127.0.0.1:%d/shrines.js", port);
+    checkCache(server, cache, [url]() {
+      return ShrineSource::http(url);
+    }, check);
+#endif
+  }
+#ifdef _WIN32
+  WSACleanup();
+#endif
+  fprintf(stderr, "%d checks, %d failed\n", check.count(), check.failed());
+  return check.failed() ? 1 : 0;
+}
@@ -1,7 +1,9 @@
 #include <stdarg.h>
+#include <stdio.h>
 #include <clocale>
 #include <algorithm>
 #include "common.h"
+#include "trace.h"
 
 std::string fmtstring(char const* fmt, ...) {
   va_list ap;
@@ -32,14 +34,21 @@ Exception::Exception(char const* fmt, ...) {
   buf_.str(dst);
 }
 
+#ifndef _WIN32
+int _vscprintf(char const* fmt, va_list list) {
+  va_list copy;
+  va_copy(copy, list);
+  int len = vsnprintf(nullptr, 0, fmt, copy);
+  va_end(copy);
+  return len;
+}
+#endif
+
 uint32 RefCounted::addref() {
-  return InterlockedIncrement(&ref_);
+  return ++ref_;
 }
 uint32 RefCounted::release() {
-  if (!this) {
-    return 0;
-  }
-  uint32 result = InterlockedDecrement(&ref_);
+  uint32 result = --ref_;
   if (!result) {
     delete this;
   }
@@ -54,7 +63,9 @@ void _qmemset(uint32* mem, uint32 fill, uint32 count) {
 
 std::string strlower(std::string const& str) {
   std::string dest(str.size(), ' ');
-  std::transform(str.begin(), str.end(), dest.begin(), std::tolower);
+  std::transform(str.begin(), str.end(), dest.begin(), [](char c) {
+    return (char) std::tolower((unsigned char) c);
+  });
   return dest;
 }
 
@@ -89,7 +100,7 @@ std::string join(std::vector<std::string> const& list, std::string const& sep) {
   return res;
 }
 
-std::wstring utf8_to_utf16(std::string const& str) {
+std::wstring utf8_to_utf16(StringView str) {
   std::wstring dst;
   for (size_t i = 0; i < str.size();) {
     uint32 cp = (unsigned char) str[i++];
@@ -111,7 +122,7 @@ std::wstring utf8_to_utf16(std::string const& str) {
       throw Exception("not a valid utf-8 string");
     }
     while (next--) {
-      if (i >= str.size() || str[i] < 0x80 || str[i] > 0xBF) {
+      if (i >= str.size() || (str[i] & 0xC0) != 0x80) {
         throw Exception("not a valid utf-8 string");
       }
       cp = (cp << 6) | (str[i++] & 0x3F);
@@ -132,6 +143,7 @@ std::wstring utf8_to_utf16(std::string const& str) {
 }
 
 std::string utf16_to_utf8(std::wstring const& str) {
+  TRACE_SPAN("utf16_to_utf8");
   std::string dst;
   for (size_t i = 0; i < str.size();) {
     uint32 cp = str[i++];
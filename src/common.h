@@ -4,10 +4,18 @@
 #include <string>
 #include <sstream>
 #include <cctype>
+#include <cstring>
+#include <algorithm>
 #include <vector>
 #include <map>
+#include <atomic>
+#include <stdarg.h>
+#ifdef _WIN32
 #define NOMINMAX
 #include <windows.h>
+#else
+int _vscprintf(char const* fmt, va_list list);
+#endif
 
 class Exception {
 public:
@@ -40,7 +48,7 @@ std::string fmtstring(char const* fmt, ...);
 std::string varfmtstring(char const* fmt, va_list list);
 
 class RefCounted {
-  uint32 ref_;
+  std::atomic<uint32> ref_;
 public:
   RefCounted() : ref_(1) {}
   virtual ~RefCounted() {}
@@ -178,6 +186,80 @@ template<class To>
 using Map = std::map<istring, To>;
 typedef Map<std::string> Dictionary;
 
+// Non-owning reference to a range of characters; the owner must outlive it.
+class StringView {
+public:
+  StringView()
+    : data_(nullptr)
+    , size_(0)
+  {}
+  StringView(char const* data, size_t size)
+    : data_(data)
+    , size_(size)
+  {}
+  StringView(char const* str)
+    : data_(str)
+    , size_(strlen(str))
+  {}
+  StringView(std::string const& str)
+    : data_(str.data())
+    , size_(str.size())
+  {}
+
+  char const* data() const {
+    return data_;
+  }
+  size_t size() const {
+    return size_;
+  }
+  bool empty() const {
+    return size_ == 0;
+  }
+  char operator[](size_t pos) const {
+    return data_[pos];
+  }
+  char const* begin() const {
+    return data_;
+  }
+  char const* end() const {
+    return data_ + size_;
+  }
+  std::string str() const {
+    return std::string(data_, size_);
+  }
+
+  StringView substr(size_t pos, size_t count = std::string::npos) const {
+    if (pos > size_) pos = size_;
+    return StringView(data_ + pos, std::min(count, size_ - pos));
+  }
+  size_t find(char chr, size_t pos = 0) const {
+    for (; pos < size_; ++pos) {
+      if (data_[pos] == chr) return pos;
+    }
+    return std::string::npos;
+  }
+  bool startsWith(StringView prefix) const {
+    return size_ >= prefix.size_ && !memcmp(data_, prefix.data_, prefix.size_);
+  }
+  StringView trim() const {
+    size_t left = 0, right = size_;
+    while (left < right && isspace((unsigned char) data_[left])) ++left;
+    while (right > left && isspace((unsigned char) data_[right - 1])) --right;
+    return StringView(data_ + left, right - left);
+  }
+
+  bool operator==(StringView const& rhs) const {
+    return size_ == rhs.size_ && !memcmp(data_, rhs.data_, size_);
+  }
+  bool operator!=(StringView const& rhs) const {
+    return !(*this == rhs);
+  }
+
+private:
+  char const* data_;
+  size_t size_;
+};
+
 std::string strlower(std::string const& src);
 
 template<class T>
@@ -200,6 +282,6 @@ inline std::string join(Iter left, Iter right) {
   return res;
 }
 
-std::wstring utf8_to_utf16(std::string const& str);
+std::wstring utf8_to_utf16(StringView str);
 std::string utf16_to_utf8(std::wstring const& str);
 std::string trim(std::string const& str);
\ No newline at end of file
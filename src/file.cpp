@@ -1,15 +1,28 @@
 #include "file.h"
-#include <windows.h>
+#include <string.h>
 #include <set>
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define _ftelli64 ftello
+#define _fseeki64 fseeko
+#endif
 
 class StdFileBuffer : public FileBuffer {
   FILE* file_;
+  bool close_;
 public:
-  StdFileBuffer(FILE* file)
+  StdFileBuffer(FILE* file, bool close = true)
     : file_(file)
+    , close_(close)
   {}
   ~StdFileBuffer() {
-    fclose(file_);
+    if (close_) fclose(file_);
   }
 
   int getc() {
@@ -32,6 +45,14 @@ public:
   size_t write(void const* ptr, size_t size) {
     return fwrite(ptr, 1, size, file_);
   }
+  bool sync() {
+    if (fflush(file_)) return false;
+#ifdef _WIN32
+    return _commit(_fileno(file_)) == 0;
+#else
+    return fsync(fileno(file_)) == 0;
+#endif
+  }
 };
 
 File::File(char const* name, char const* mode)
@@ -54,8 +75,12 @@ File::File(char const* name, char const* mode)
   }
 }
 
+File File::stdfile(FILE* file) {
+  return File(new StdFileBuffer(file, false));
+}
+
 void File::printf(char const* fmt, ...) {
-  static char buf[1024];
+  char buf[1024];
 
   va_list ap;
   va_start(ap, fmt);
@@ -68,6 +93,7 @@ void File::printf(char const* fmt, ...) {
     dst = new char[len + 1];
   }
   vsprintf(dst, fmt, ap);
+  va_end(ap);
   file_->write(dst, len);
   if (dst != buf) {
     delete[] dst;
@@ -158,6 +184,11 @@ public:
   size_t write(void const* ptr, size_t size) {
     return 0;
   }
+
+  uint8 const* contiguous(size_t& size) {
+    size = size_ - pos_;
+    return ptr_ + pos_;
+  }
 };
 
 File File::memfile(void const* ptr, size_t size, bool clone) {
@@ -223,12 +254,79 @@ public:
   size_t write(void const* ptr, size_t size) {
     return 0;
   }
+
+  uint8 const* contiguous(size_t& size) {
+    file_.seek(pos_);
+    uint8 const* data = file_.contiguous(size);
+    if (data && size > end_ - pos_) size = end_ - pos_;
+    return data;
+  }
 };
 
 File File::subfile(uint64 offset, uint64 size) {
   return File(new SubFileBuffer(*this, offset, size));
 }
 
+bool replaceFile(std::string const& src, std::string const& dst) {
+#ifdef _WIN32
+  return MoveFileExA(src.c_str(), dst.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+  if (rename(src.c_str(), dst.c_str())) return false;
+  // the rename itself is only durable once the directory is synced
+  size_t slash = dst.rfind('/');
+  std::string dir = (slash == std::string::npos ? "." : slash ? dst.substr(0, slash) : "/");
+  int fd = open(dir.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+  return true;
+#endif
+}
+
+#ifdef _WIN32
+FileMapping::FileMapping(std::string const& path)
+  : data_(nullptr)
+  , size_(0)
+  , file_(INVALID_HANDLE_VALUE)
+  , mapping_(nullptr)
+{
+  file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file_ == INVALID_HANDLE_VALUE) return;
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file_, &size) || !size.QuadPart) return;
+  mapping_ = CreateFileMapping(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!mapping_) return;
+  data_ = static_cast<uint8 const*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+  if (data_) size_ = static_cast<size_t>(size.QuadPart);
+}
+FileMapping::~FileMapping() {
+  if (data_) UnmapViewOfFile(data_);
+  if (mapping_) CloseHandle(mapping_);
+  if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+}
+#else
+FileMapping::FileMapping(std::string const& path)
+  : data_(nullptr)
+  , size_(0)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr != MAP_FAILED) {
+      data_ = static_cast<uint8 const*>(ptr);
+      size_ = st.st_size;
+    }
+  }
+  close(fd);
+}
+FileMapping::~FileMapping() {
+  if (data_) munmap(const_cast<uint8*>(data_), size_);
+}
+#endif
+
 class MemoryBuffer : public FileBuffer {
   size_t pos_;
   uint8* data_;
@@ -289,6 +387,11 @@ public:
     return size;
   }
 
+  uint8 const* contiguous(size_t& size) {
+    size = size_ - pos_;
+    return data_ + pos_;
+  }
+
   uint8 const* data() const {
     return data_;
   }
@@ -335,13 +438,13 @@ size_t MemoryFile::csize() const {
 }
 
 void File::copy(File& src) {
-  static uint8 buf[65536];
+  uint8 buf[65536];
   while (size_t count = src.read(buf, sizeof buf)) {
     write(buf, count);
   }
 }
 std::string File::all() {
-  static char buf[65536];
+  char buf[65536];
   std::string str;
   while (size_t count = read(buf, sizeof buf)) {
     str.append(buf, count);
@@ -31,6 +31,16 @@ public:
 
   virtual size_t read(void* ptr, size_t size) = 0;
   virtual size_t write(void const* ptr, size_t size) = 0;
+  // Pushes everything written so far to the disk.
+  virtual bool sync() {
+    return true;
+  }
+
+  // The rest of the file from the current position, for files that are in
+  // memory; readers can scan it in place instead of copying it out.
+  virtual uint8 const* contiguous(size_t& size) {
+    return nullptr;
+  }
 };
 
 class File {
@@ -58,10 +68,10 @@ public:
     : File(name.c_str(), mode)
   {}
   ~File() {
-    file_->release();
+    if (file_) file_->release();
   }
   void release() {
-    file_->release();
+    if (file_) file_->release();
     file_ = nullptr;
   }
 
@@ -69,7 +79,7 @@ public:
     if (file_ == file.file_) {
       return *this;
     }
-    file_->release();
+    if (file_) file_->release();
     file_ = file.file_;
     if (file_) file_->addref();
     return *this;
@@ -78,7 +88,7 @@ public:
     if (file_ == file.file_) {
       return *this;
     }
-    file_->release();
+    if (file_) file_->release();
     file_ = file.file_;
     file.file_ = nullptr;
     return *this;
@@ -138,6 +148,13 @@ public:
   size_t write(void const* ptr, size_t size) {
     return file_->write(ptr, size);
   }
+  bool sync() {
+    return file_->sync();
+  }
+  // nullptr unless the file is in memory; does not move the file position
+  uint8 const* contiguous(size_t& size) {
+    return file_->contiguous(size);
+  }
   template<class T>
   bool write(T const& x) {
     return file_->write(&x, sizeof(T)) == sizeof(T);
@@ -167,9 +184,43 @@ public:
   void copy(File& src);
 
   static File memfile(void const* ptr, size_t size, bool clone = false);
+  // wraps stdin/stdout/stderr; the stream is not closed with the File
+  static File stdfile(FILE* file);
   File subfile(uint64 offset, uint64 size);
 };
 
+// Read-only view of a whole file in memory.
+class FileMapping {
+public:
+  explicit FileMapping(std::string const& path);
+  ~FileMapping();
+
+  FileMapping(FileMapping const&) = delete;
+  FileMapping& operator=(FileMapping const&) = delete;
+
+  operator bool() const {
+    return data_ != nullptr;
+  }
+  uint8 const* data() const {
+    return data_;
+  }
+  size_t size() const {
+    return size_;
+  }
+
+private:
+  uint8 const* data_;
+  size_t size_;
+#ifdef _WIN32
+  void* file_;
+  void* mapping_;
+#endif
+};
+
+// Atomically replaces dst with src (used for write-and-rename saves). src
+// should be synced first, or a power loss can leave dst empty.
+bool replaceFile(std::string const& src, std::string const& dst);
+
 class MemoryFile : public File {
 public:
   MemoryFile(size_t initial = 16384, size_t grow = (1 << 20));
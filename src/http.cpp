@@ -1,5 +1,6 @@
 #include "http.h"
 #include "common.h"
+#include "trace.h"
 #pragma comment(lib, "winhttp.lib")
 
 HttpRequest::HttpRequest(std::string const& url, RequestType type)
@@ -73,16 +74,47 @@ void HttpRequest::addData(std::string const& key, std::string const& value) {
 
 bool HttpRequest::send() {
   if (!request_) return false;
-  if (!WinHttpSendRequest(request_,
-    headers.empty() ? nullptr : headers.c_str(), headers.size(),
-    post.empty() ? nullptr : &post[0], post.size(), post.size(), 0)) {
-    return false;
+  {
+    TRACE_SPAN("http::send");
+    if (!WinHttpSendRequest(request_,
+      headers.empty() ? nullptr : headers.c_str(), headers.size(),
+      post.empty() ? nullptr : &post[0], post.size(), post.size(), 0)) {
+      return false;
+    }
   }
+  TRACE_SPAN("http::receive");
   return WinHttpReceiveResponse(request_, NULL);
 }
 
+int HttpRequest::status() {
+  if (!request_) return 0;
+  DWORD code = 0, size = sizeof code;
+  if (!WinHttpQueryHeaders(request_, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+      WINHTTP_HEADER_NAME_BY_INDEX, &code, &size, WINHTTP_NO_HEADER_INDEX)) {
+    return 0;
+  }
+  return code;
+}
+
+std::string HttpRequest::header(std::string const& name) {
+  if (!request_) return "";
+  std::wstring name16 = utf8_to_utf16(name);
+  DWORD size = 0;
+  WinHttpQueryHeaders(request_, WINHTTP_QUERY_CUSTOM, name16.c_str(),
+    WINHTTP_NO_OUTPUT_BUFFER, &size, WINHTTP_NO_HEADER_INDEX);
+  if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) return "";
+  std::wstring value(size / sizeof(wchar_t), 0);
+  if (!WinHttpQueryHeaders(request_, WINHTTP_QUERY_CUSTOM, name16.c_str(),
+      &value[0], &size, WINHTTP_NO_HEADER_INDEX)) {
+    return "";
+  }
+  value.resize(size / sizeof(wchar_t));
+  return utf16_to_utf8(value);
+}
+
 File HttpRequest::response() {
   if (!request_) return File();
+  TRACE_SPAN("http::read");
 
   DWORD size = 0, read;
   std::string buffer;
@@ -17,6 +17,8 @@ public:
   void addData(std::string const& key, std::string const& value);
 
   bool send();
+  int status();
+  std::string header(std::string const& name);
   File response();
 
 private:
@@ -0,0 +1,327 @@
+#include "item.h"
+#include "json.h"
+#include "jsondoc.h"
+#include "trace.h"
+
+// The tooltip text is only read through views into it; strings are built
+// just for the fields that end up in the item.
+
+static bool isWordChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Splits the next line off the front of text and trims it.
+static bool nextLine(StringView& text, StringView& line) {
+  if (text.empty()) return false;
+  size_t end = text.find('\n');
+  if (end == std::string::npos) end = text.size();
+  line = text.substr(0, end).trim();
+  text = text.substr(end + 1);
+  return true;
+}
+
+// "key: value", with no colon in the key and a non-empty value
+static bool splitKeyValue(StringView str, StringView& key, StringView& value) {
+  size_t colon = str.find(':');
+  if (colon == 0 || colon == std::string::npos || colon + 2 >= str.size() || str[colon + 1] != ' ') {
+    return false;
+  }
+  key = str.substr(0, colon);
+  value = str.substr(colon + 2);
+  return true;
+}
+
+// Returns the rest of str after prefix if it is followed by at least one
+// character accepted by pred and nothing else.
+template<class Pred>
+static bool matchTail(StringView str, StringView prefix, Pred pred, StringView& tail) {
+  if (!str.startsWith(prefix) || str.size() == prefix.size()) return false;
+  tail = str.substr(prefix.size());
+  for (char c : tail) {
+    if (!pred(c)) return false;
+  }
+  return true;
+}
+
+ItemTip::ItemTip(ItemTip&& other)
+  : rarity(other.rarity)
+  , name(other.name)
+  , base(other.base)
+  , baseStats(std::move(other.baseStats))
+  , requirements(std::move(other.requirements))
+  , sockets(other.sockets)
+  , ilvl(other.ilvl)
+  , lines(std::move(other.lines))
+  , sections(std::move(other.sections))
+  , mods(std::move(other.mods))
+  , arena_(std::move(other.arena_))
+{
+  other.clear();
+}
+
+ItemTip& ItemTip::operator=(ItemTip&& other) {
+  if (this != &other) {
+    rarity = other.rarity;
+    name = other.name;
+    base = other.base;
+    baseStats = std::move(other.baseStats);
+    requirements = std::move(other.requirements);
+    sockets = other.sockets;
+    ilvl = other.ilvl;
+    lines = std::move(other.lines);
+    sections = std::move(other.sections);
+    mods = std::move(other.mods);
+    arena_ = std::move(other.arena_);
+    other.clear();
+  }
+  return *this;
+}
+
+void ItemTip::clear() {
+  rarity = name = base = sockets = StringView();
+  ilvl = 0;
+  baseStats.clear();
+  requirements.clear();
+  lines.clear();
+  sections.clear();
+  mods.clear();
+  arena_.reset();
+}
+
+StringView ItemTip::lowercase(StringView str) {
+  char* dst = arena_.allocString(str.size());
+  for (size_t i = 0; i < str.size(); ++i) {
+    dst[i] = static_cast<char>(tolower((unsigned char) str[i]));
+  }
+  return StringView(dst, str.size());
+}
+
+// Removes "<<set:XX>>" markup from item names.
+StringView ItemTip::stripMarkup(StringView str) {
+  char* dst = arena_.allocString(str.size());
+  size_t size = 0, pos = 0;
+  while (pos < str.size()) {
+    if (str.substr(pos).startsWith("<<set:")) {
+      size_t end = pos + 6;
+      while (end < str.size() && isWordChar(str[end])) ++end;
+      if (end > pos + 6 && str.substr(end).startsWith(">>")) {
+        pos = end + 2;
+        continue;
+      }
+    }
+    dst[size++] = str[pos++];
+  }
+  return StringView(dst, size);
+}
+
+// Sections are added in order; ones left empty between two separators are
+// kept so that section indices match the tooltip.
+void ItemTip::addLine(size_t section, StringView line) {
+  while (sections.size() <= section) {
+    ItemSection range = {static_cast<uint32>(lines.size()), 0};
+    sections.push_back(range);
+  }
+  lines.push_back(line);
+  ++sections[section].count;
+  addMod(line);
+}
+
+void ItemTip::addMod(StringView line) {
+  ItemMod mod;
+  mod.numValues = 0;
+  mod.ascii = true;
+  // the template is never longer than the line
+  char* templ = arena_.allocString(line.size());
+  size_t length = 0, pos = 0;
+  while (pos < line.size()) {
+    char c = line[pos];
+    if ((c >= '0' && c <= '9') || c == '.') {
+      // digits before the first dot are the integer part, the ones after it
+      // the fraction; any further dots are skipped
+      float value = 0, scale = 0;
+      for (; pos < line.size() && ((line[pos] >= '0' && line[pos] <= '9') || line[pos] == '.'); ++pos) {
+        if (line[pos] == '.') {
+          if (!scale) scale = 1;
+        } else if (scale) {
+          value += (line[pos] - '0') * (scale *= 0.1f);
+        } else {
+          value = value * 10 + (line[pos] - '0');
+        }
+      }
+      if (mod.numValues < ItemMod::MaxValues) mod.values[mod.numValues] = value;
+      ++mod.numValues;
+      templ[length++] = '#';
+    } else {
+      if (c & 0x80) mod.ascii = false;
+      templ[length++] = (c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+      ++pos;
+    }
+  }
+  mod.templ = StringView(templ, length);
+  mods.push_back(mod);
+}
+
+static bool isSocketChar(char c) {
+  return c == 'R' || c == 'G' || c == 'B' || c == ' ' || c == '-';
+}
+static bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+bool ItemTip::parse(StringView data) {
+  TRACE_SPAN("ItemTip::parse");
+  clear();
+  // everything the item refers to is copied once, up front
+  char* buffer = arena_.allocString(data.size() + 1);
+  if (data.size()) memcpy(buffer, data.data(), data.size());
+  buffer[data.size()] = 0;
+  StringView text(buffer, data.size()), str, key, value;
+  int section = 0, line = 0, baseSection = -1;
+  while (nextLine(text, str)) {
+    if (str.empty()) continue;
+    if (str == "--------") {
+      ++section;
+      line = 0;
+    } else {
+      switch (section) {
+      case 0:
+        switch (line) {
+        case 0:
+          if (!matchTail(str, "Rarity: ", isWordChar, value)) return false;
+          rarity = lowercase(value);
+          break;
+        case 1:
+          name = stripMarkup(str);
+          break;
+        case 2:
+          base = str;
+          break;
+        }
+        break;
+      case 1:
+        if (splitKeyValue(str, key, value)) {
+          baseStats.emplace_back(key, value);
+        } else {
+          baseStats.emplace_back(str, StringView());
+        }
+        break;
+      case 2:
+        if (str == "Requirements:" || line > 0) {
+          if (line > 0) {
+            if (!splitKeyValue(str, key, value)) return false;
+            requirements.emplace_back(key, value);
+          } else if (str != "Requirements:") {
+            return false;
+          }
+          break;
+        } else {
+          ++section;
+          // fall through
+        }
+      case 3:
+        if (matchTail(str, "Sockets: ", isSocketChar, value)) {
+          sockets = value;
+          break;
+        } else {
+          ++section;
+          // fall through
+        }
+      case 4:
+        if (matchTail(str, "Item Level: ", isDigit, value) || matchTail(str, "Itemlevel: ", isDigit, value)) {
+          ilvl = 0;
+          for (char c : value) {
+            ilvl = ilvl * 10 + (c - '0');
+          }
+          break;
+        } else {
+          ++section;
+          // fall through
+        }
+      default:
+        if (baseSection < 0) baseSection = section;
+        // the line break or trailing space after the line is not needed
+        buffer[str.end() - buffer] = 0;
+        addLine(section - baseSection, str);
+      }
+      ++line;
+    }
+  }
+  return !(rarity.empty() || name.empty());
+}
+
+static char const* FrameTypes[] = {"normal", "magic", "rare", "unique", "gem", "currency"};
+
+// first value of a property or requirement: {"name":"Level","values":[["64",0]]}
+template<class Json>
+static void addProperties(Arena& arena, std::vector<KeyValue>& list, Json const& props) {
+  for (size_t i = 0; i < props.length(); ++i) {
+    Json const& prop = props[i];
+    list.emplace_back(arena.copy(prop["name"].getString()), arena.copy(prop["values"][0][0].getString()));
+  }
+}
+
+bool ItemTip::parseStash(json::Value const& item) {
+  return fromStash(item);
+}
+bool ItemTip::parseStash(json::Node const& item) {
+  return fromStash(item);
+}
+
+template<class Json>
+bool ItemTip::fromStash(Json const& item) {
+  TRACE_SPAN("ItemTip::parseStash");
+  clear();
+  if (item.type() != json::Value::tObject) return false;
+  int frame = item["frameType"].getInteger();
+  if (frame < 0 || frame >= static_cast<int>(sizeof FrameTypes / sizeof FrameTypes[0])) return false;
+  rarity = FrameTypes[frame];
+
+  // names come with the same markup as in the clipboard; magic and normal
+  // items only have a type line
+  name = stripMarkup(item["name"].getString());
+  StringView typeLine = stripMarkup(item["typeLine"].getString());
+  if (name.empty()) {
+    name = typeLine;
+    base = arena_.copy(item["baseType"].getString());
+    if (base.empty()) base = typeLine;
+  } else {
+    base = typeLine;
+  }
+  if (name.empty()) return false;
+
+  addProperties(arena_, baseStats, item["properties"]);
+  addProperties(arena_, requirements, item["requirements"]);
+  Json const& socketList = item["sockets"];
+  size_t socketSize = 0;
+  for (size_t i = 0; i < socketList.length(); ++i) {
+    socketSize += socketList[i]["sColour"].getString().size() + 1;
+  }
+  char* socketText = arena_.allocString(socketSize);
+  size_t socketPos = 0;
+  int group = -1;
+  for (size_t i = 0; i < socketList.length(); ++i) {
+    if (socketPos) socketText[socketPos++] = (socketList[i]["group"].getInteger() == group ? '-' : ' ');
+    group = socketList[i]["group"].getInteger();
+    StringView colour = socketList[i]["sColour"].getString();
+    memcpy(socketText + socketPos, colour.data(), colour.size());
+    socketPos += colour.size();
+  }
+  sockets = StringView(socketText, socketPos);
+  ilvl = item["ilvl"].getInteger();
+
+  // implicits go in their own section, like the "--------" blocks of a tooltip
+  size_t section = 0;
+  Json const& implicits = item["implicitMods"];
+  for (size_t i = 0; i < implicits.length(); ++i) {
+    addLine(section, arena_.copy(implicits[i].getString()));
+  }
+  if (!sections.empty()) ++section;
+  char const* explicitKeys[] = {"explicitMods", "craftedMods"};
+  for (char const* key : explicitKeys) {
+    Json const& list = item[key];
+    for (size_t i = 0; i < list.length(); ++i) {
+      addLine(section, arena_.copy(list[i].getString()));
+    }
+  }
+  return true;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "common.h"
+#include "arena.h"
+#include <string>
+#include <vector>
+
+namespace json {
+  class Value;
+  class Node;
+}
+
+struct KeyValue {
+  StringView key;
+  StringView value;
+  KeyValue() {}
+  KeyValue(StringView k, StringView v)
+    : key(k)
+    , value(v)
+  {}
+};
+
+// A mod line split into a template, with every run of digits and dots
+// replaced by '#' (the same rule as the '#' in shrines.js patterns) and
+// letters in lowercase, and the numbers that were taken out:
+//   "+25% to Fire Resistance" -> "+#% to fire resistance", {25}
+struct ItemMod {
+  enum { MaxValues = 4 };
+  StringView templ;
+  uint16 numValues;   // can be more than MaxValues, only the first ones are kept
+  bool ascii;         // the line has no multibyte characters
+  float values[MaxValues];
+
+  float value(size_t index, float def = 0) const {
+    return index < numValues && index < MaxValues ? values[index] : def;
+  }
+};
+
+// range of ItemTip::lines between two "--------" separators
+struct ItemSection {
+  uint32 first;
+  uint32 count;
+};
+
+// All strings of an item are views into an arena that the item owns. The
+// arena and lists are kept when the item is cleared or parsed again, so one
+// ItemTip reused for many items stops allocating once it has grown to fit
+// them. Items can be moved but not copied. Items filled in by ItemDecoder
+// refer to the encoded data instead.
+struct ItemTip {
+  StringView rarity;
+  StringView name;
+  StringView base;
+
+  std::vector<KeyValue> baseStats;
+  std::vector<KeyValue> requirements;
+  StringView sockets;
+  int ilvl;
+
+  // mod lines of every section, each followed by a null character, and the
+  // sections they are split into
+  std::vector<StringView> lines;
+  std::vector<ItemSection> sections;
+  // one per line, in the same order
+  std::vector<ItemMod> mods;
+
+  ItemTip()
+    : ilvl(0)
+  {}
+  ItemTip(ItemTip&& other);
+  ItemTip& operator=(ItemTip&& other);
+
+  void clear();
+  // Both parsers clear the item first.
+  bool parse(StringView data);
+  // Fills the item from an entry in the "items" array of the public stash API.
+  bool parseStash(json::Value const& item);
+  bool parseStash(json::Node const& item);
+
+private:
+  Arena arena_;
+
+  template<class Json>
+  bool fromStash(Json const& item);
+
+  ItemTip(ItemTip const&) = delete;
+  ItemTip& operator=(ItemTip const&) = delete;
+
+  StringView lowercase(StringView str);
+  StringView stripMarkup(StringView str);
+  void addLine(size_t section, StringView line);
+  void addMod(StringView line);
+};
@@ -0,0 +1,228 @@
+#include "itemcodec.h"
+
+static char const Magic[4] = {'S', 'T', 'I', 'P'};
+enum { TrailerSize = 12 };
+
+static void putVarint(std::string& out, uint64 value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+ItemEncoder::ItemEncoder(File const& file)
+  : file_(file)
+  , ok_(true)
+  , written_(0)
+  , items_(0)
+{
+  std::string header(Magic, 4);
+  putVarint(header, Version);
+  put(header, nullptr, 0);
+}
+
+void ItemEncoder::put(std::string& out, void const* data, size_t size) {
+  if (size) out.append(static_cast<char const*>(data), size);
+  size_t count = file_.write(out.data(), out.size());
+  if (count != out.size()) ok_ = false;
+  written_ += count;
+  out.clear();
+}
+
+void ItemEncoder::putString(StringView str, bool shared) {
+  if (shared) {
+    key_.assign(str.data(), str.size());
+    auto it = ids_.find(key_);
+    if (it == ids_.end()) {
+      it = ids_.emplace(key_, static_cast<uint32>(table_.size())).first;
+      table_.push_back(&it->first);
+    }
+    putVarint(record_, (uint64(it->second) << 1) | 1);
+    return;
+  }
+  putVarint(record_, uint64(str.size()) << 1);
+  record_.append(str.data(), str.size());
+  record_.push_back(0);
+}
+
+void ItemEncoder::write(ItemTip const& tip) {
+  record_.clear();
+  putString(tip.rarity, true);
+  putString(tip.name, false);
+  putString(tip.base, true);
+  putString(tip.sockets, true);
+  putVarint(record_, tip.ilvl < 0 ? 0 : tip.ilvl);
+  for (auto const* list : {&tip.baseStats, &tip.requirements}) {
+    putVarint(record_, list->size());
+    for (auto& kv : *list) {
+      putString(kv.key, true);
+      putString(kv.value, false);
+    }
+  }
+  putVarint(record_, tip.sections.size());
+  for (auto& section : tip.sections) {
+    putVarint(record_, section.count);
+  }
+  for (size_t i = 0; i < tip.lines.size() && i < tip.mods.size(); ++i) {
+    ItemMod const& mod = tip.mods[i];
+    putString(tip.lines[i], false);
+    putString(mod.templ, true);
+    putVarint(record_, (uint64(mod.numValues) << 1) | (mod.ascii ? 1 : 0));
+    size_t count = std::min<size_t>(mod.numValues, ItemMod::MaxValues);
+    record_.append(reinterpret_cast<char const*>(mod.values), count * sizeof(float));
+  }
+  putVarint(size_, record_.size());
+  put(size_, nullptr, 0);
+  put(record_, nullptr, 0);
+  ++items_;
+}
+
+void ItemEncoder::skip() {
+  size_.assign(1, 0);
+  put(size_, nullptr, 0);
+  ++items_;
+}
+
+bool ItemEncoder::finish() {
+  uint64 offset = written_;
+  std::string out;
+  putVarint(out, table_.size());
+  for (auto str : table_) {
+    putVarint(out, str->size());
+    out.append(*str);
+    out.push_back(0);
+    if (out.size() >= (1 << 16)) put(out, nullptr, 0);
+  }
+  for (int i = 0; i < 8; ++i) {
+    out.push_back(static_cast<char>(offset >> (i * 8)));
+  }
+  put(out, Magic, 4);
+  return ok_;
+}
+
+// Bounds-checked cursor over a record or the string table.
+namespace {
+struct Cursor {
+  char const* pos;
+  char const* end;
+
+  bool varint(uint64& value) {
+    value = 0;
+    for (int shift = 0; pos < end && shift < 64; shift += 7) {
+      uint8 byte = static_cast<uint8>(*pos++);
+      value |= uint64(byte & 0x7F) << shift;
+      if (!(byte & 0x80)) return true;
+    }
+    return false;
+  }
+  bool varint(uint32& value) {
+    uint64 value64;
+    if (!varint(value64) || value64 > 0xFFFFFFFF) return false;
+    value = static_cast<uint32>(value64);
+    return true;
+  }
+  // length bytes followed by a zero
+  bool text(uint64 length, StringView& str) {
+    if (length >= static_cast<uint64>(end - pos) || pos[length]) return false;
+    str = StringView(pos, static_cast<size_t>(length));
+    pos += length + 1;
+    return true;
+  }
+  bool string(std::vector<StringView> const& table, StringView& str) {
+    uint64 value;
+    if (!varint(value)) return false;
+    if (value & 1) {
+      if ((value >> 1) >= table.size()) return false;
+      str = table[static_cast<size_t>(value >> 1)];
+      return true;
+    }
+    return text(value >> 1, str);
+  }
+};
+}
+
+bool ItemDecoder::open(uint8 const* data, size_t size) {
+  table_.clear();
+  failed_ = false;
+  pos_ = end_ = nullptr;
+  char const* begin = reinterpret_cast<char const*>(data);
+  if (size < 5 + TrailerSize || memcmp(begin, Magic, 4) || memcmp(begin + size - 4, Magic, 4)) return false;
+  Cursor header = {begin + 4, begin + size};
+  if (!header.varint(version_) || version_ != ItemEncoder::Version) return false;
+
+  uint64 offset = 0;
+  for (int i = 0; i < 8; ++i) {
+    offset |= uint64(data[size - TrailerSize + i]) << (i * 8);
+  }
+  if (offset < static_cast<uint64>(header.pos - begin) || offset > size - TrailerSize) return false;
+  Cursor table = {begin + offset, begin + size - TrailerSize};
+  uint64 count;
+  if (!table.varint(count) || count > size) return false;
+  table_.resize(static_cast<size_t>(count));
+  for (auto& str : table_) {
+    uint64 length;
+    if (!table.varint(length) || !table.text(length, str)) return false;
+  }
+  pos_ = header.pos;
+  end_ = begin + offset;
+  return true;
+}
+
+bool ItemDecoder::nextRecord(StringView& record) {
+  if (pos_ == end_) return false;
+  Cursor cursor = {pos_, end_};
+  uint64 size;
+  if (!cursor.varint(size) || size > static_cast<uint64>(end_ - cursor.pos)) {
+    pos_ = end_;
+    failed_ = true;
+    return false;
+  }
+  record = StringView(cursor.pos, static_cast<size_t>(size));
+  pos_ = cursor.pos + size;
+  return true;
+}
+
+bool ItemDecoder::decode(StringView record, ItemTip& tip) const {
+  tip.clear();
+  Cursor in = {record.data(), record.data() + record.size()};
+  uint32 ilvl;
+  if (!in.string(table_, tip.rarity) || !in.string(table_, tip.name) || !in.string(table_, tip.base) ||
+      !in.string(table_, tip.sockets) || !in.varint(ilvl)) {
+    return false;
+  }
+  tip.ilvl = static_cast<int>(ilvl);
+  for (auto* list : {&tip.baseStats, &tip.requirements}) {
+    uint32 count;
+    if (!in.varint(count)) return false;
+    for (uint32 i = 0; i < count; ++i) {
+      KeyValue kv;
+      if (!in.string(table_, kv.key) || !in.string(table_, kv.value)) return false;
+      list->push_back(kv);
+    }
+  }
+
+  uint32 numSections, numLines = 0;
+  if (!in.varint(numSections)) return false;
+  for (uint32 i = 0; i < numSections; ++i) {
+    ItemSection section = {numLines, 0};
+    if (!in.varint(section.count) || section.count > record.size()) return false;
+    numLines += section.count;
+    tip.sections.push_back(section);
+  }
+  for (uint32 i = 0; i < numLines; ++i) {
+    StringView line;
+    ItemMod mod;
+    uint32 flags;
+    if (!in.string(table_, line) || !in.string(table_, mod.templ) || !in.varint(flags)) return false;
+    mod.numValues = static_cast<uint16>(flags >> 1);
+    mod.ascii = (flags & 1) != 0;
+    size_t count = std::min<size_t>(mod.numValues, ItemMod::MaxValues);
+    if (count * sizeof(float) > static_cast<size_t>(in.end - in.pos)) return false;
+    memcpy(mod.values, in.pos, count * sizeof(float));
+    in.pos += count * sizeof(float);
+    tip.lines.push_back(line);
+    tip.mods.push_back(mod);
+  }
+  return in.pos == in.end && !tip.rarity.empty() && !tip.name.empty();
+}
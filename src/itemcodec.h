@@ -0,0 +1,96 @@
+#pragma once
+
+#include "file.h"
+#include "item.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Binary form of parsed items, so that later stages do not parse tooltips
+// again. A file is
+//   "STIP" varint(version)
+//   records, each varint(size) followed by size bytes
+//   string table: varint(count), then varint(length), bytes and a 0 for each
+//   the offset of the string table as 8 little-endian bytes, and "STIP"
+//
+// A string in a record is either varint(length << 1) followed by its bytes
+// and a 0, or varint(index << 1 | 1) for an entry of the string table. The
+// zeros let decoded lines be used as C strings like parsed ones. Strings that
+// repeat across items (rarities, bases, stat names, mod templates) go in the
+// table; names, values and mod lines are written in place.
+//
+// A record holds, in this order:
+//   rarity, name, base and sockets as strings, varint(ilvl)
+//   base stats and requirements: varint(count), then a key and value string each
+//   sections: varint(count), then varint(number of lines) each
+//   mod lines: the line and its template as strings, varint(numValues << 1 | ascii)
+//     and the first values as 4-byte little-endian floats
+// An empty record stands for text that was not an item.
+class ItemEncoder {
+public:
+  enum { Version = 1 };
+
+  // Writes the header right away; records are written as they come.
+  explicit ItemEncoder(File const& file);
+
+  void write(ItemTip const& tip);
+  // Keeps the item numbering of the input when something does not parse.
+  void skip();
+  // Writes the string table. The file is not readable until this is called.
+  bool finish();
+
+  uint64 items() const {
+    return items_;
+  }
+
+private:
+  File file_;
+  bool ok_;
+  uint64 written_;
+  uint64 items_;
+  std::string record_;
+  std::string size_;
+  std::unordered_map<std::string, uint32> ids_;
+  std::vector<std::string const*> table_;
+  std::string key_;
+
+  void put(std::string& out, void const* data, size_t size);
+  void putString(StringView str, bool shared);
+};
+
+class ItemDecoder {
+public:
+  ItemDecoder()
+    : version_(0)
+    , failed_(false)
+    , pos_(nullptr)
+    , end_(nullptr)
+  {}
+
+  // Checks the header and reads the string table. Nothing is copied: the data
+  // must outlive the decoder and every item decoded from it.
+  bool open(uint8 const* data, size_t size);
+  uint32 version() const {
+    return version_;
+  }
+
+  // Splits off the next record, so that records can be decoded on any thread.
+  bool nextRecord(StringView& record);
+  // set when nextRecord() stopped at a broken record instead of the end
+  bool failed() const {
+    return failed_;
+  }
+  // The item refers to the data instead of its own arena.
+  bool decode(StringView record, ItemTip& tip) const;
+  bool next(ItemTip& tip) {
+    StringView record;
+    return nextRecord(record) && decode(record, tip);
+  }
+
+private:
+  uint32 version_;
+  bool failed_;
+  char const* pos_;
+  char const* end_;
+  std::vector<StringView> table_;
+};
@@ -0,0 +1,143 @@
+#include "itemreader.h"
+#include "trace.h"
+
+static bool isItemStart(StringView line) {
+  return line.startsWith("Rarity:");
+}
+
+ItemReader::ItemReader(File const& file)
+  : file_(file)
+  , buffer_(ChunkSize)
+  , pos_(0)
+  , size_(0)
+  , skipNewline_(false)
+  , loneCR_(false)
+  , itemStart_(nullptr)
+  , itemEnd_(nullptr)
+  , haveHeader_(false)
+  , items_(0)
+  , bytes_(0)
+{}
+
+// Moves the item out of the chunk, before it is replaced or when its text
+// can not be used as is.
+void ItemReader::detach() {
+  if (itemStart_) {
+    item_.assign(itemStart_, itemEnd_);
+    itemStart_ = itemEnd_ = nullptr;
+  }
+}
+
+bool ItemReader::refill() {
+  detach();
+  size_ = file_.read(buffer_.data(), buffer_.size());
+  pos_ = 0;
+  bytes_ += size_;
+  return size_ != 0;
+}
+
+// Same line breaks as File::getline: "\n", "\r\n" or a lone "\r".
+bool ItemReader::getline(StringView& line, bool& partial) {
+  line_.clear();
+  partial = false;
+  loneCR_ = false;
+  while (true) {
+    if (pos_ >= size_ && !refill()) {
+      line = line_;
+      return partial;
+    }
+    char const* start = buffer_.data() + pos_;
+    char const* end = buffer_.data() + size_;
+    if (skipNewline_) {
+      skipNewline_ = false;
+      if (*start == '\n') {
+        ++pos_;
+        continue;
+      }
+    }
+    char const* eol = start;
+    while (eol < end && *eol != '\n' && *eol != '\r') ++eol;
+    if (eol == end) {
+      line_.append(start, end);
+      partial = true;
+      pos_ = size_;
+      continue;
+    }
+    pos_ = eol + 1 - buffer_.data();
+    if (*eol == '\r') {
+      if (eol + 1 < end) {
+        if (eol[1] == '\n') {
+          ++pos_;
+        } else {
+          loneCR_ = true;
+        }
+      } else {
+        skipNewline_ = true;
+        loneCR_ = true;
+      }
+    }
+    if (partial) {
+      line_.append(start, eol);
+      line = line_;
+    } else {
+      line = StringView(start, eol - start);
+    }
+    return true;
+  }
+}
+
+// ItemTip::parse only splits on '\n', so an item with lone '\r' line breaks
+// is copied with its lines joined again.
+void ItemReader::addLine(StringView line, bool partial) {
+  if (itemStart_ && !partial) {
+    itemEnd_ = line.end();
+  } else {
+    if (!item_.empty()) item_.push_back('\n');
+    item_.append(line.data(), line.size());
+  }
+  if (loneCR_) detach();
+}
+
+bool ItemReader::next() {
+  TRACE_SPAN("ItemReader::next");
+  item_.clear();
+  itemStart_ = itemEnd_ = nullptr;
+  StringView line;
+  bool partial = false;
+  if (haveHeader_) {
+    item_.swap(header_);
+    haveHeader_ = false;
+  } else {
+    do {
+      if (!getline(line, partial)) return false;
+    } while (!isItemStart(line));
+    if (!partial) itemStart_ = itemEnd_ = line.data();
+    addLine(line, partial);
+  }
+  ++items_;
+
+  bool ended = false;
+  while (getline(line, partial)) {
+    if (isItemStart(line)) {
+      if (partial) {
+        header_.assign(line.data(), line.size());
+        haveHeader_ = true;
+      } else {
+        // read it again for the next item
+        pos_ = line.data() - buffer_.data();
+        skipNewline_ = false;
+      }
+      break;
+    }
+    if (line.trim().empty()) ended = true;
+    if (!ended) addLine(line, partial);
+  }
+  return true;
+}
+
+bool ItemReader::next(ItemTip& tip) {
+  while (next()) {
+    if (tip.parse(text())) return true;
+  }
+  return false;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "file.h"
+#include "item.h"
+#include <string>
+#include <vector>
+
+// Reads a dump of concatenated clipboard texts one item at a time. An item
+// starts at a "Rarity:" line and ends at the next one or at a blank line;
+// anything between a blank line and the next header is skipped.
+// The file is read in fixed-size chunks and every buffer is reused, so memory
+// does not depend on the size of the input, only on the longest item. Items
+// that fit in one chunk are not copied at all.
+class ItemReader {
+public:
+  enum { ChunkSize = 1 << 16 };
+
+  explicit ItemReader(File const& file);
+
+  // Moves to the next item. Its text stays valid until the next call; lines
+  // may keep their original line breaks.
+  bool next();
+  StringView text() const {
+    return itemStart_ ? StringView(itemStart_, itemEnd_ - itemStart_) : StringView(item_);
+  }
+  // Reads the next item that parses.
+  bool next(ItemTip& tip);
+
+  // items and input bytes read so far
+  uint64 items() const {
+    return items_;
+  }
+  uint64 bytes() const {
+    return bytes_;
+  }
+
+private:
+  File file_;
+  std::vector<char> buffer_;
+  size_t pos_;
+  size_t size_;
+  bool skipNewline_;  // the last chunk ended with '\r'
+  bool loneCR_;       // the last line ended with '\r' alone, or maybe so
+  std::string line_;  // a line that crosses chunks
+  // the item is the range in the chunk while it has not crossed chunks, and
+  // is copied to item_ when it does
+  char const* itemStart_;
+  char const* itemEnd_;
+  std::string item_;
+  std::string header_;  // next header, if it crossed chunks
+  bool haveHeader_;
+  uint64 items_;
+  uint64 bytes_;
+
+  // the line points into the chunk unless partial is set
+  bool getline(StringView& line, bool& partial);
+  bool refill();
+  void detach();
+  void addLine(StringView line, bool partial);
+};
@@ -1,6 +1,17 @@
 #include "json.h"
+#include "jsonindex.h"
+#include "jsonnumber.h"
+#include "trace.h"
 #include <algorithm>
 
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define JSON_WRITER_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace json {
 
 template<class T>
@@ -10,97 +21,89 @@ struct Defaults {
 template<class T>
 T Defaults<T>::value_;
 
-Value::Value(Type type)
-  : type_(tUndefined)
-{
+static_assert(sizeof(Value) == 16, "json::Value should be 16 bytes");
+
+namespace {
+
+// the order of std::string
+int compareKeys(StringView lhs, StringView rhs) {
+  int res = memcmp(lhs.data(), rhs.data(), std::min(lhs.size(), rhs.size()));
+  if (res) return res;
+  return basic_compare(lhs.size(), rhs.size());
+}
+bool memberLess(Value::Member const& lhs, Value::Member const& rhs) {
+  return compareKeys(lhs.first.getString(), rhs.first.getString()) < 0;
+}
+bool keyLess(Value::Member const& lhs, StringView rhs) {
+  return compareKeys(lhs.first.getString(), rhs) < 0;
+}
+
+}
+
+Value::Value(Type type) {
+  setTag(tUndefined);
   setType(type);
 }
-Value::Value(bool val)
-  : type_(tUndefined)
-{
-  setType(tBoolean);
+Value::Value(bool val) {
+  setTag(tBoolean);
   bool_ = val;
 }
-Value::Value(int val)
-  : type_(tUndefined)
-{
-  setType(tInteger);
+Value::Value(int val) {
+  setTag(tInteger);
   int_ = val;
 }
-Value::Value(unsigned int val)
-  : type_(tUndefined)
-{
-  if (val > 0x7FFFFFFF) {
-    setType(tNumber);
-    number_ = static_cast<double>(val);
-  } else {
-    setType(tInteger);
-    int_ = static_cast<int>(val);
-  }
+Value::Value(unsigned int val) {
+  setTag(tInteger);
+  int_ = val;
 }
-Value::Value(sint32 val)
-  : type_(tUndefined)
-{
-  setType(tInteger);
-  int_ = static_cast<int>(val);
+#ifdef _MSC_VER
+Value::Value(sint32 val) {
+  setTag(tInteger);
+  int_ = val;
 }
-Value::Value(uint32 val)
-  : type_(tUndefined)
-{
-  if (val > 0x7FFFFFFF) {
-    setType(tNumber);
-    number_ = static_cast<double>(val);
-  } else {
-    setType(tInteger);
-    int_ = static_cast<int>(val);
-  }
+Value::Value(uint32 val) {
+  setTag(tInteger);
+  int_ = val;
 }
-Value::Value(sint64 val)
-  : type_(tUndefined)
-{
-  if (val > 0x7FFFFFFFLL || val < -0x80000000LL) {
-    setType(tNumber);
-    number_ = static_cast<double>(val);
-  } else {
-    setType(tInteger);
-    int_ = static_cast<int>(val);
-  }
+#endif
+Value::Value(sint64 val) {
+  setTag(tInteger);
+  int_ = val;
 }
-Value::Value(uint64 val)
-  : type_(tUndefined)
-{
-  if (val > 0x7FFFFFFFULL) {
-    setType(tNumber);
+Value::Value(uint64 val) {
+  if (val > 0x7FFFFFFFFFFFFFFFULL) {
+    setTag(tNumber);
     number_ = static_cast<double>(val);
   } else {
-    setType(tInteger);
-    int_ = static_cast<int>(val);
+    setTag(tInteger);
+    int_ = static_cast<sint64>(val);
   }
 }
-Value::Value(double val)
-  : type_(tUndefined)
-{
-  setType(tNumber);
+Value::Value(double val) {
+  setTag(tNumber);
   number_ = val;
 }
-Value::Value(std::string const& val)
-  : type_(tUndefined)
-{
-  setType(tString);
-  *string_ = val;
+Value::Value(std::string const& val) {
+  setTag(tUndefined);
+  setString(val);
 }
-Value::Value(char const* val)
-  : type_(tUndefined)
-{
-  setType(tString);
-  *string_ = val;
+Value::Value(std::string&& val) {
+  setTag(tUndefined);
+  setString(std::move(val));
 }
-Value::Value(Value const& rhs)
-: type_(rhs.type_)
-{
-  switch (type_) {
+Value::Value(char const* val) {
+  setTag(tUndefined);
+  setString(val);
+}
+Value::Value(StringView val) {
+  setTag(tUndefined);
+  setString(val);
+}
+Value::Value(Value const& rhs) {
+  memcpy(bytes_, rhs.bytes_, sizeof bytes_);
+  switch (rhs.type()) {
   case tString:
-    string_ = new std::string(*rhs.string_);
+    if (rhs.isLarge()) string_ = new std::string(*rhs.string_);
     break;
   case tObject:
     map_ = new Map(*rhs.map_);
@@ -108,48 +111,40 @@ Value::Value(Value const& rhs)
   case tArray:
     array_ = new Array(*rhs.array_);
     break;
-  case tInteger:
-    int_ = rhs.int_;
-    break;
-  case tNumber:
-    number_ = rhs.number_;
-    break;
-  case tBoolean:
-    bool_ = rhs.bool_;
+  default:
     break;
   }
 }
 
 Value& Value::operator=(Value const& rhs) {
+  // copy first, rhs may be part of this value
+  Value tmp(rhs);
   clear();
-  type_ = rhs.type_;
-  switch (type_) {
-  case tString:
-    string_ = new std::string(*rhs.string_);
-    break;
-  case tObject:
-    map_ = new Map(*rhs.map_);
-    break;
-  case tArray:
-    array_ = new Array(*rhs.array_);
-    break;
-  case tInteger:
-    int_ = rhs.int_;
-    break;
-  case tNumber:
-    number_ = rhs.number_;
-    break;
-  case tBoolean:
-    bool_ = rhs.bool_;
-    break;
+  take(tmp);
+  return *this;
+}
+
+Value::Value(Value&& rhs) JSON_NOEXCEPT {
+  take(rhs);
+}
+Value& Value::operator=(Value&& rhs) JSON_NOEXCEPT {
+  if (this != &rhs) {
+    // rhs may be part of this value
+    Value tmp(std::move(rhs));
+    clear();
+    take(tmp);
   }
   return *this;
 }
+void Value::take(Value& rhs) {
+  memcpy(bytes_, rhs.bytes_, sizeof bytes_);
+  rhs.setTag(tUndefined);
+}
 
 void Value::clear() {
-  switch (type_) {
+  switch (type()) {
   case tString:
-    delete string_;
+    if (isLarge()) delete string_;
     break;
   case tObject:
     delete map_;
@@ -157,16 +152,18 @@ void Value::clear() {
   case tArray:
     delete array_;
     break;
+  default:
+    break;
   }
-  type_ = tUndefined;
+  setTag(tUndefined);
 }
 Value& Value::setType(Type type) {
-  if (type == type_) return *this;
+  if (type == this->type()) return *this;
   clear();
-  type_ = type;
-  switch (type_) {
+  switch (type) {
   case tString:
-    string_ = new std::string();
+    bytes_[0] = 0;
+    bytes_[14] = 0;
     break;
   case tObject:
     map_ = new Map();
@@ -174,13 +171,16 @@ Value& Value::setType(Type type) {
   case tArray:
     array_ = new Array();
     break;
+  default:
+    int_ = 0;
   }
+  setTag(type);
   return *this;
 }
 
 // tBoolean
 bool Value::getBoolean() const {
-  return (type_ == tBoolean ? bool_ : false);
+  return (type() == tBoolean ? bool_ : false);
 }
 Value& Value::setBoolean(bool data) {
   setType(tBoolean);
@@ -188,38 +188,78 @@ Value& Value::setBoolean(bool data) {
   return *this;
 }
 
-std::string const& Value::getString() const {
-  return (type_ == tString ? *string_ : Defaults<std::string>::value_);
-}
-Value& Value::setString(char const* data) {
-  setType(tString);
-  *string_ = data;
+// tString
+StringView Value::getString() const {
+  if (type() != tString) return StringView("", 0);
+  if (isLarge()) return StringView(*string_);
+  return StringView(bytes_, static_cast<uint8>(bytes_[14]));
+}
+// data may point into this value, so it is copied before anything is freed
+Value& Value::setString(StringView data) {
+  if (data.size() <= SmallSize) {
+    char small[SmallSize];
+    memcpy(small, data.data(), data.size());
+    clear();
+    memcpy(bytes_, small, data.size());
+    bytes_[data.size()] = 0;
+    bytes_[14] = static_cast<char>(data.size());
+  } else if (type() == tString && isLarge()) {
+    string_->assign(data.data(), data.size());
+  } else {
+    std::string* large = new std::string(data.data(), data.size());
+    clear();
+    string_ = large;
+    bytes_[14] = static_cast<char>(LargeString);
+  }
+  setTag(tString);
   return *this;
 }
-Value& Value::setString(std::string const& data) {
-  setType(tString);
-  *string_ = data;
+Value& Value::setString(std::string&& data) {
+  if (data.size() <= SmallSize) {
+    return setString(StringView(data));
+  }
+  if (type() == tString && isLarge()) {
+    *string_ = std::move(data);
+  } else {
+    std::string* large = new std::string(std::move(data));
+    clear();
+    string_ = large;
+    bytes_[14] = static_cast<char>(LargeString);
+    setTag(tString);
+  }
   return *this;
 }
 
 // tNumber
 bool Value::isInteger() const {
-  switch (type_) {
-  case tInteger: return true;
+  switch (type()) {
+  case tInteger: return int_ >= -0x80000000LL && int_ <= 0x7FFFFFFFLL;
   case tNumber: return (int)number_ == number_;
   default: return false;
   }
 }
 int Value::getInteger() const {
   if (!isInteger()) return 0;
-  switch (type_) {
-  case tInteger: return int_;
+  switch (type()) {
+  case tInteger: return static_cast<int>(int_);
   case tNumber: return static_cast<int>(number_);
   default: return 0;
   }
 }
+sint64 Value::getInteger64() const {
+  switch (type()) {
+  case tInteger: return int_;
+  case tNumber:
+    // 2^63 itself does not fit
+    if (number_ >= -9223372036854775808.0 && number_ < 9223372036854775808.0 && (sint64)number_ == number_) {
+      return static_cast<sint64>(number_);
+    }
+    return 0;
+  default: return 0;
+  }
+}
 double Value::getNumber() const {
-  switch (type_) {
+  switch (type()) {
   case tInteger: return static_cast<double>(int_);
   case tNumber: return number_;
   default: return 0;
@@ -230,6 +270,11 @@ Value& Value::setInteger(int data) {
   int_ = data;
   return *this;
 }
+Value& Value::setInteger64(sint64 data) {
+  setType(tInteger);
+  int_ = data;
+  return *this;
+}
 Value& Value::setNumber(double data) {
   setType(tNumber);
   number_ = data;
@@ -238,97 +283,103 @@ Value& Value::setNumber(double data) {
 
 // tObject
 Value::Map const& Value::getMap() const {
-  return (type_ == tObject ? *map_ : Defaults<Map>::value_);
-}
-bool Value::has(std::string const& name) const {
-  if (type_ != tObject) return false;
-  return map_->find(name) != map_->end();
+  return (type() == tObject ? *map_ : Defaults<Map>::value_);
 }
-bool Value::has(char const* name) const {
-  if (type_ != tObject) return false;
-  return map_->find(name) != map_->end();
+Value::Member* Value::find(StringView name) const {
+  if (type() != tObject) return nullptr;
+  auto it = std::lower_bound(map_->begin(), map_->end(), name, keyLess);
+  return (it != map_->end() && it->first.getString() == name ? &*it : nullptr);
 }
-Value const* Value::get(std::string const& name) const {
-  if (type_ != tObject) return nullptr;
-  auto it = map_->find(name);
-  return (it != map_->end() ? &it->second : nullptr);
+bool Value::has(StringView name) const {
+  return find(name) != nullptr;
 }
-Value* Value::get(std::string const& name) {
-  if (type_ != tObject) return nullptr;
-  auto it = map_->find(name);
-  return (it != map_->end() ? &it->second : nullptr);
+Value const* Value::get(StringView name) const {
+  Member* member = find(name);
+  return (member ? &member->second : nullptr);
 }
-Value const* Value::get(char const* name) const {
-  if (type_ != tObject) return nullptr;
-  auto it = map_->find(name);
-  return (it != map_->end() ? &it->second : nullptr);
+Value* Value::get(StringView name) {
+  Member* member = find(name);
+  return (member ? &member->second : nullptr);
 }
-Value* Value::get(char const* name) {
-  if (type_ != tObject) return nullptr;
-  auto it = map_->find(name);
-  return (it != map_->end() ? &it->second : nullptr);
+Value& Value::insert(StringView name, Value const& data) {
+  return insert(name, Value(data));
 }
-Value& Value::insert(std::string const& name, Value const& data) {
+Value& Value::insert(StringView name, Value&& data) {
+  // both may be part of this value
+  Value key(name);
+  Value tmp(std::move(data));
   setType(tObject);
-  return (*map_)[name] = data;
-}
-Value& Value::insert(char const* name, Value const& data) {
-  setType(tObject);
-  return (*map_)[name] = data;
-}
-void Value::remove(std::string const& name) {
-  if (type_ == tObject) map_->erase(name);
-}
-void Value::remove(char const* name) {
-  if (type_ == tObject) map_->erase(name);
+  auto it = std::lower_bound(map_->begin(), map_->end(), key.getString(), keyLess);
+  if (it != map_->end() && it->first.getString() == key.getString()) {
+    return it->second = std::move(tmp);
+  }
+  return map_->insert(it, Member(std::move(key), std::move(tmp)))->second;
 }
-Value const& Value::operator[](std::string const& name) const {
-  Value const* ptr = get(name);
-  return (ptr ? *ptr : Defaults<Value>::value_);
+void Value::remove(StringView name) {
+  Member* member = find(name);
+  if (member) map_->erase(map_->begin() + (member - map_->data()));
 }
-Value const& Value::operator[](char const* name) const {
+Value const& Value::operator[](StringView name) const {
   Value const* ptr = get(name);
   return (ptr ? *ptr : Defaults<Value>::value_);
 }
-Value& Value::operator[](std::string const& name) {
-  setType(tObject);
-  return (*map_)[name];
-}
-Value& Value::operator[](char const* name) {
+Value& Value::operator[](StringView name) {
   setType(tObject);
-  return (*map_)[name];
+  Value* ptr = get(name);
+  return (ptr ? *ptr : insert(name, Value()));
+}
+// sorted by key; of equal keys the last one stays
+void Value::sortMembers() {
+  if (type() != tObject) return;
+  Map& map = *map_;
+  std::stable_sort(map.begin(), map.end(), memberLess);
+  size_t kept = 0;
+  for (size_t i = 0; i < map.size(); ++i) {
+    if (i + 1 < map.size() && map[i].first.getString() == map[i + 1].first.getString()) continue;
+    if (kept != i) map[kept] = std::move(map[i]);
+    ++kept;
+  }
+  map.erase(map.begin() + kept, map.end());
 }
 
 // tArray
 Value::Array const& Value::getArray() const {
-  return (type_ == tArray ? *array_ : Defaults<Array>::value_);
+  return (type() == tArray ? *array_ : Defaults<Array>::value_);
 }
 uint32 Value::length() const {
-  return (type_ == tArray ? array_->size() : 0);
+  return (type() == tArray ? array_->size() : 0);
 }
 Value const* Value::at(uint32 i) const {
-  if (type_ != tArray || i >= array_->size()) return nullptr;
+  if (type() != tArray || i >= array_->size()) return nullptr;
   return &(*array_)[i];
 }
 Value* Value::at(uint32 i) {
-  if (type_ != tArray || i >= array_->size()) return nullptr;
+  if (type() != tArray || i >= array_->size()) return nullptr;
   return &(*array_)[i];
 }
 Value& Value::insert(uint32 i, Value const& data) {
+  return insert(i, Value(data));
+}
+Value& Value::insert(uint32 i, Value&& data) {
+  Value tmp(std::move(data));
   setType(tArray);
-  return *array_->insert(array_->begin() + std::min<uint32>(i, array_->size()), data);
+  return *array_->insert(array_->begin() + std::min<uint32>(i, array_->size()), std::move(tmp));
 }
 Value& Value::append(Value const& data) {
+  return append(Value(data));
+}
+Value& Value::append(Value&& data) {
+  Value tmp(std::move(data));
   setType(tArray);
-  array_->push_back(data);
+  array_->push_back(std::move(tmp));
   return array_->back();
 }
 void Value::remove(uint32 i) {
-  if (type_ != tArray || i >= array_->size()) return;
+  if (type() != tArray || i >= array_->size()) return;
   array_->erase(array_->begin() + i);
 }
 Value const& Value::operator[](int i) const {
-  if (type_ != tArray || i < 0 || i >= array_->size()) return Defaults<Value>::value_;
+  if (type() != tArray || i < 0 || i >= array_->size()) return Defaults<Value>::value_;
   return (*array_)[i];
 }
 Value& Value::operator[](int i) {
@@ -341,83 +392,228 @@ Value& Value::operator[](int i) {
 }
 
 Value::Iterator Value::begin() {
-  switch (type_) {
+  switch (type()) {
   case tObject:
-    return Iterator(map_->begin());
+    return Iterator(map_->data());
   case tArray:
-    return Iterator(array_->begin());
+    return Iterator(array_->data());
   default:
     return Iterator();
   }
 }
 Value::Iterator Value::end() {
-  switch (type_) {
+  switch (type()) {
   case tObject:
-    return Iterator(map_->end());
+    return Iterator(map_->data() + map_->size());
   case tArray:
-    return Iterator(array_->end());
+    return Iterator(array_->data() + array_->size());
   default:
     return Iterator();
   }
 }
 Value::ConstIterator Value::begin() const {
-  switch (type_) {
+  switch (type()) {
   case tObject:
-    return ConstIterator(map_->begin());
+    return ConstIterator(map_->data());
   case tArray:
-    return ConstIterator(array_->begin());
+    return ConstIterator(array_->data());
   default:
     return ConstIterator();
   }
 }
 Value::ConstIterator Value::end() const {
-  switch (type_) {
+  switch (type()) {
   case tObject:
-    return ConstIterator(map_->end());
+    return ConstIterator(map_->data() + map_->size());
   case tArray:
-    return ConstIterator(array_->end());
+    return ConstIterator(array_->data() + array_->size());
   default:
     return ConstIterator();
   }
 }
 
+static inline bool isSpace(int chr) {
+  return chr == ' ' || (chr >= '\t' && chr <= '\r');
+}
+
+// Scans a file that is in memory in place, and any other file in chunks.
+// Whitespace and string bodies are skipped along a StructuralIndex of the
+// text ahead. Line and column are only worked out when an error is reported.
 class Tokenizer {
+  enum { ChunkSize = 1 << 16 };
+public:
+  enum State {tEnd, tSymbol, tInteger, tNumber, tString, tIdentifier, tError = -1};
+private:
   File* file;
   bool strict;
+  bool inMemory;
+  uint64 start;           // file position before parsing
+  std::vector<uint8> buffer;
+  uint8 const* begin;     // start of the current chunk
+  uint8 const* pos;
+  uint8 const* end;
+  uint64 offset;          // input bytes before the current chunk
+  uint32 lines;           // line breaks before the current chunk
+  int64 lastBreak;        // offset of the last '\r' or '\n' before it, or -1
+  // a string ran into the end of the input; reading its closing quote counted
+  // as one more column when characters were read one at a time
+  bool pastEnd;
+  StructuralIndex index;
+
+  // Moves on to the next chunk, keeping the input from keep onwards.
+  bool fill(uint8 const* keep);
+  void sync() {
+    chr = (pos < end || fill(end) ? *pos : EOF);
+  }
+  State number();
 public:
-  uint32 line;
-  uint32 col;
   int chr;
   int move() {
     int old = chr;
-    chr = file->getc();
-    if (chr == '\n') ++line;
-    if (chr == '\r' || chr == '\n') col = 0;
-    else ++col;
+    if (pos < end) ++pos;
+    sync();
     return old;
   }
 
-  enum State {tEnd, tSymbol, tInteger, tNumber, tString, tIdentifier, tError = -1};
   State state;
+  // strings and numbers are only checked, not decoded
+  bool discard;
 
-  int valInteger;
+  int symbol;
+  sint64 valInteger;
   double valNumber;
   std::string value;
 
-  Tokenizer(File* file, bool strict)
-    : file(file)
-    , chr(file->getc())
-    , strict(strict)
-    , line(0)
-    , col(0)
-  {}
+  Tokenizer(File* file, bool strict);
 
   State next();
+  // Gives unread input back to the file, so that it ends up right after the
+  // last character used.
+  void finish();
+  void error(Visitor* visitor, std::string const& reason) const;
 };
 
+Tokenizer::Tokenizer(File* file, bool strict)
+  : file(file)
+  , strict(strict)
+  , start(file->tell())
+  , offset(0)
+  , lines(0)
+  , lastBreak(-1)
+  , pastEnd(false)
+  , discard(false)
+  , symbol(0)
+{
+  size_t size;
+  begin = file->contiguous(size);
+  inMemory = (begin != nullptr);
+  if (!inMemory) {
+    buffer.resize(ChunkSize);
+    begin = buffer.data();
+    size = 0;
+  }
+  pos = begin;
+  end = begin + size;
+  sync();
+}
+
+bool Tokenizer::fill(uint8 const* keep) {
+  if (inMemory) return false;
+  uint8 const* last = nullptr;
+  for (uint8 const* p = begin; (p = (uint8 const*) memchr(p, '\n', keep - p)); ++p) {
+    ++lines;
+    last = p;
+  }
+  for (uint8 const* p = (last ? last + 1 : begin); (p = (uint8 const*) memchr(p, '\r', keep - p)); ++p) {
+    last = p;
+  }
+  if (last) lastBreak = offset + (last - begin);
+  offset += keep - begin;
+  index.clear();
+  size_t kept = end - keep;
+  size_t at = pos - keep;
+  memmove(buffer.data(), keep, kept);
+  if (buffer.size() < kept + ChunkSize) {
+    buffer.resize(kept + ChunkSize);
+  }
+  begin = buffer.data();
+  pos = begin + at;
+  end = begin + kept + file->read(buffer.data() + kept, buffer.size() - kept);
+  return pos < end;
+}
+
+void Tokenizer::finish() {
+  if (inMemory) {
+    file->seek(start + (pos - begin));
+  } else if (pos < end) {
+    file->seek(pos - end, SEEK_CUR);
+  }
+}
+
+// Same numbers as counting characters as they are read: the line is the
+// number of '\n' up to the current character, and the column restarts at
+// every '\r' or '\n'.
+void Tokenizer::error(Visitor* visitor, std::string const& reason) const {
+  uint32 line = lines;
+  int64 lineStart = lastBreak;
+  uint8 const* stop = (pos < end ? pos + 1 : end);
+  for (uint8 const* p = begin; p < stop; ++p) {
+    if (*p == '\n') ++line;
+    if (*p == '\r' || *p == '\n') lineStart = offset + (p - begin);
+  }
+  int64 at = offset + (pos - begin) + (pastEnd ? 1 : 0);
+  visitor->onError(line, uint32(lineStart >= 0 ? at - lineStart : at), reason);
+}
+
+// Scans the number at pos in place, see scanNumber(); the text is kept in
+// value for strtod and for callers that want it.
+Tokenizer::State Tokenizer::number() {
+  bool more = !inMemory;
+  while (true) {
+    DecimalNumber number;
+    uint8 const* p = scanNumber(pos, end, strict, number);
+    if (p == end && more) {
+      // the number might go on in the next chunk
+      size_t size = end - pos;
+      fill(pos);
+      more = (size_t(end - pos) > size);
+      continue;
+    }
+    if (number.invalid) {
+      pos = p;
+      sync();
+      value = "invalid number";
+      return state = tError;
+    }
+    if (discard) {
+      pos = p;
+      sync();
+      return state = tNumber;
+    }
+    value.assign((char const*) pos, p - pos);
+    pos = p;
+    sync();
+
+    if (number.toInteger(valInteger)) {
+      return state = tInteger;
+    }
+    valNumber = number.toDouble(value.c_str());
+    return state = tNumber;
+  }
+}
+
 Tokenizer::State Tokenizer::next() {
-  while (chr != EOF && isspace(chr)) {
-    move();
+  if (!index.covers(pos) && pos < end) {
+    index.build(pos, std::min<size_t>(end - pos, ChunkSize), strict);
+  }
+  while (chr != EOF && isSpace(chr)) {
+    if (index.covers(pos)) {
+      // the first character after whitespace is always listed
+      pos = index.next(pos);
+    } else {
+      while (pos < end && isSpace(*pos)) ++pos;
+    }
+    sync();
   }
   if (chr == EOF) {
     return state = tEnd;
@@ -489,59 +685,24 @@ Tokenizer::State Tokenizer::next() {
           return state = tError;
         }
       } else {
-        value.push_back(move());
+        uint8 const* run = pos;
+        if (init == '"' && index.covers(pos)) {
+          // only the closing quote and escapes are listed inside a string
+          pos = index.next(pos);
+        } else {
+          while (pos < end && *pos != init && *pos != '\\') ++pos;
+        }
+        if (!discard) value.append((char const*) run, pos - run);
+        sync();
       }
     }
+    if (chr == EOF) pastEnd = true;
     move();
   } else if (chr == '-' || (chr >= '0' && chr <= '9') || (!strict && (chr == '.' || chr == '+'))) {
-    state = tInteger;
-    if (chr == '-' || (!strict && chr == '+')) {
-      value.push_back(move());
-    }
-    if (chr == '0') {
-      value.push_back(move());
-    } else if (chr >= '1' && chr <= '9') {
-      while (chr >= '0' && chr <= '9') {
-        value.push_back(move());
-      }
-    } else if (strict || chr != '.') {
-      value = "invalid number";
-      return state = tError;
-    }
-    if (chr == '.') {
-      state = tNumber;
-      value.push_back(move());
-      if ((chr < '0' || chr > '9') && strict) {
-        value = "invalid number";
-        return state = tError;
-      }
-      while (chr >= '0' && chr <= '9') {
-        value.push_back(move());
-      }
-    }
-    if (chr == 'e' || chr == 'E') {
-      state = tNumber;
-      value.push_back(move());
-      if (chr == '-' || chr == '+') {
-        value.push_back(move());
-      }
-      if (chr < '0' || chr > '9') {
-        value = "invalid number";
-        return state = tError;
-      }
-      while (chr >= '0' && chr <= '9') {
-        value.push_back(move());
-      }
-    }
-    valNumber = atof(value.c_str());
-    if (state == tInteger) {
-      valInteger = int(valNumber);
-      if (double(valInteger) != valNumber) {
-        state = tNumber;
-      }
-    }
+    return number();
   } else if (chr == '{' || chr == '}' || chr == '[' || chr == ']' || chr == ':' || chr == ',' || chr == '(' || chr == ')') {
     state = tSymbol;
+    symbol = chr;
     value.push_back(move());
   } else if ((chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z') || chr == '_') {
     state = tIdentifier;
@@ -552,7 +713,8 @@ Tokenizer::State Tokenizer::next() {
     move();
     if (chr == '/') {
       while (chr != '\n' && chr != EOF) {
-        move();
+        while (pos < end && *pos != '\n') ++pos;
+        sync();
       }
       return next();
     } else if (chr == '*') {
@@ -581,11 +743,25 @@ Tokenizer::State Tokenizer::next() {
   return state;
 }
 
-bool parse(File& file, Visitor* visitor, int mode, std::string* func) {
+// With items set, the input is the inside of an array without its brackets,
+// which are made up at the start and at the end of the input.
+static bool parseText(File& file, Visitor* visitor, int mode, std::string* func, bool items) {
   enum State{sValue, sKey, sColon, sNext, sEnd} state = sValue;
   std::vector<Value::Type> objStack;
   bool topEmpty = true;
+  // a value the visitor asked to skip goes to ignore, down to skipDepth
+  Visitor ignore;
+  Visitor* handler = visitor;
+  size_t skipDepth = 0;
   Tokenizer tok(&file, mode == mJSON);
+  auto advance = [&]() {
+    if (state == sValue && handler == visitor && !objStack.empty() && visitor->skipValue()) {
+      handler = &ignore;
+      skipDepth = objStack.size();
+      tok.discard = true;
+    }
+    tok.next();
+  };
   if (mode == mJSCall) {
     if (func) func->clear();
     while (tok.chr != EOF && tok.chr != '(') {
@@ -593,60 +769,73 @@ bool parse(File& file, Visitor* visitor, int mode, std::string* func) {
       tok.move();
     }
     if (tok.chr != '(') {
-      visitor->onError(tok.line, tok.col, "expected '('");
+      tok.error(visitor, "expected '('");
       return false;
     }
     tok.move();
   }
-  tok.next();
+  if (items) {
+    if (!visitor->onOpenArray()) return false;
+    objStack.push_back(Value::tArray);
+  }
+  advance();
   while (state != sEnd) {
     if (tok.state == Tokenizer::tError) {
-      visitor->onError(tok.line, tok.col, tok.value);
+      tok.error(visitor, tok.value);
       return false;
     }
-    bool advance = true;
+    if (items && tok.state == Tokenizer::tEnd && objStack.size() == 1 && (state == sNext || (state == sValue && topEmpty))) {
+      if (!visitor->onCloseArray()) return false;
+      objStack.pop_back();
+      break;
+    }
+    bool next = true;
     switch (state) {
     case sValue:
       if (tok.state == Tokenizer::tInteger) {
-        if (!visitor->onInteger(tok.valInteger)) return false;
+        if (tok.valInteger >= -0x80000000LL && tok.valInteger <= 0x7FFFFFFFLL) {
+          if (!handler->onInteger(static_cast<int>(tok.valInteger))) return false;
+        } else {
+          if (!handler->onInteger64(tok.valInteger)) return false;
+        }
       } else if (tok.state == Tokenizer::tNumber) {
-        if (!visitor->onNumber(tok.valNumber)) return false;
+        if (!handler->onNumber(tok.valNumber)) return false;
       } else if (tok.state == Tokenizer::tString) {
-        if (!visitor->onString(tok.value)) return false;
+        if (!handler->onString(tok.value)) return false;
       } else if (tok.state == Tokenizer::tIdentifier) {
         if (tok.value == "null") {
-          if (!visitor->onNull()) return false;
+          if (!handler->onNull()) return false;
         } else if (tok.value == "true") {
-          if (!visitor->onBoolean(true)) return false;
+          if (!handler->onBoolean(true)) return false;
         } else if (tok.value == "false") {
-          if (!visitor->onBoolean(false)) return false;
+          if (!handler->onBoolean(false)) return false;
         } else {
-          visitor->onError(tok.line, tok.col, "unexpected identifier " + tok.value);
+          tok.error(visitor, "unexpected identifier " + tok.value);
           return false;
         }
       } else if (tok.state == Tokenizer::tSymbol) {
-        if (tok.value == "{") {
-          if (!visitor->onOpenMap()) return false;
+        if (tok.symbol == '{') {
+          if (!handler->onOpenMap()) return false;
           objStack.push_back(Value::tObject);
           topEmpty = true;
           state = sKey;
           break;
-        } else if (tok.value == "[") {
-          if (!visitor->onOpenArray()) return false;
+        } else if (tok.symbol == '[') {
+          if (!handler->onOpenArray()) return false;
           objStack.push_back(Value::tArray);
           topEmpty = true;
           state = sValue;
           break;
-        } else if ((mode != mJSON || topEmpty) && tok.value == "]" && !objStack.empty() && objStack.back() == Value::tArray) {
+        } else if ((mode != mJSON || topEmpty) && tok.symbol == ']' && !objStack.empty() && objStack.back() == Value::tArray) {
           state = sNext;
-          advance = false;
+          next = false;
           break;
         } else {
-          visitor->onError(tok.line, tok.col, "unexpected symbol '" + tok.value + "'");
+          tok.error(visitor, "unexpected symbol '" + tok.value + "'");
           return false;
         }
       } else {
-        visitor->onError(tok.line, tok.col, "value expected");
+        tok.error(visitor, "value expected");
         return false;
       }
       topEmpty = false;
@@ -658,59 +847,59 @@ bool parse(File& file, Visitor* visitor, int mode, std::string* func) {
       break;
     case sKey:
       if (tok.state == Tokenizer::tString) {
-        if (!visitor->onMapKey(tok.value)) return false;
+        if (!handler->onMapKey(tok.value)) return false;
         state = sColon;
       } else if (mode != mJSON && tok.state == Tokenizer::tIdentifier) {
-        if (!visitor->onMapKey(tok.value)) return false;
+        if (!handler->onMapKey(tok.value)) return false;
         state = sColon;
       } else if (mode != mJSON && (tok.state == Tokenizer::tNumber || tok.state == Tokenizer::tInteger)) {
-        if (!visitor->onMapKey(tok.value)) return false;
+        if (!handler->onMapKey(tok.value)) return false;
         state = sColon;
-      } else if ((mode != mJSON || topEmpty) && tok.state == Tokenizer::tSymbol && tok.value == "}") {
+      } else if ((mode != mJSON || topEmpty) && tok.state == Tokenizer::tSymbol && tok.symbol == '}') {
         state = sNext;
-        advance = false;
+        next = false;
       } else {
-        visitor->onError(tok.line, tok.col, "object key expected");
+        tok.error(visitor, "object key expected");
         return false;
       }
       break;
     case sColon:
-      if (tok.state == Tokenizer::tSymbol && tok.value == ":") {
+      if (tok.state == Tokenizer::tSymbol && tok.symbol == ':') {
         state = sValue;
       } else {
-        visitor->onError(tok.line, tok.col, "':' expected");
+        tok.error(visitor, "':' expected");
         return false;
       }
       break;
     case sNext:
       if (tok.state == Tokenizer::tSymbol) {
-        if (tok.value == ",") {
+        if (tok.symbol == ',') {
           if (objStack.back() == Value::tObject) {
             state = sKey;
           } else {
             state = sValue;
           }
-        } else if (tok.value == "}") {
+        } else if (tok.symbol == '}') {
           if (objStack.back() != Value::tObject) {
-            visitor->onError(tok.line, tok.col, "mismatched '}'");
+            tok.error(visitor, "mismatched '}'");
             return false;
           }
-          if (!visitor->onCloseMap()) return false;
-        } else if (tok.value == "]") {
-          if (objStack.back() != Value::tArray) {
-            visitor->onError(tok.line, tok.col, "mismatched ']'");
+          if (!handler->onCloseMap()) return false;
+        } else if (tok.symbol == ']') {
+          if (objStack.back() != Value::tArray || (items && objStack.size() == 1)) {
+            tok.error(visitor, "mismatched ']'");
             return false;
           }
-          if (!visitor->onCloseArray()) return false;
+          if (!handler->onCloseArray()) return false;
         } else {
-          visitor->onError(tok.line, tok.col, "unexpected symbol '" + tok.value + "'");
+          tok.error(visitor, "unexpected symbol '" + tok.value + "'");
           return false;
         }
         if (state == sNext) {
           objStack.pop_back();
           topEmpty = false;
           if (objStack.empty()) {
-            advance = false;
+            next = false;
             state = sEnd;
           } else {
             state = sNext;
@@ -718,43 +907,55 @@ bool parse(File& file, Visitor* visitor, int mode, std::string* func) {
         }
       } else {
         if (objStack.back() == Value::tObject) {
-          visitor->onError(tok.line, tok.col, "'}' or ',' expected");
+          tok.error(visitor, "'}' or ',' expected");
         } else {
-          visitor->onError(tok.line, tok.col, "']' or ',' expected");
+          tok.error(visitor, "']' or ',' expected");
         }
         return false;
       }
       break;
     default:
-      visitor->onError(tok.line, tok.col, "internal error");
+      tok.error(visitor, "internal error");
       return false;
     }
-    if (advance) {
-      tok.next();
+    if (handler != visitor && objStack.size() == skipDepth && (state == sNext || state == sEnd)) {
+      handler = visitor;
+      tok.discard = false;
     }
+    if (next) advance();
   }
   if (mode == mJSCall) {
-    if (tok.next() != Tokenizer::tSymbol || tok.value != ")") {
-      visitor->onError(tok.line, tok.col, "expected ')'");
+    if (tok.next() != Tokenizer::tSymbol || tok.symbol != ')') {
+      tok.error(visitor, "expected ')'");
       return false;
     }
     tok.move();
     if (tok.chr == ';') tok.move();
     //while (tok.chr != EOF && isspace(tok.chr)) tok.move();
     //if (tok.chr != EOF) {
-    //  visitor->onError(tok.line, tok.col, fmtstring("unexpected symbol '%c'", (char)tok.chr));
+    //  tok.error(visitor, fmtstring("unexpected symbol '%c'", (char)tok.chr));
     //  return false;
     //}
   } else {
     //if (tok.next() != Tokenizer::tEnd) {
-    //  visitor->onError(tok.line, tok.col, fmtstring("unexpected symbol '%c'", (char)tok.chr));
+    //  tok.error(visitor, fmtstring("unexpected symbol '%c'", (char)tok.chr));
     //  return false;
     //}
   }
-  file.seek(-1, SEEK_CUR);
+  tok.finish();
   return visitor->onEnd();
 }
 
+bool parse(File& file, Visitor* visitor, int mode, std::string* func) {
+  TRACE_SPAN("json::parse");
+  return parseText(file, visitor, mode, func, false);
+}
+
+bool parseItems(File& file, Visitor* visitor) {
+  TRACE_SPAN("json::parseItems");
+  return parseText(file, visitor, mJSON, nullptr, true);
+}
+
 BuilderVisitor::BuilderVisitor(Value& value, bool throwExceptions)
   : Visitor(throwExceptions)
   , value_(value)
@@ -770,7 +971,8 @@ bool BuilderVisitor::openComplexValue(Value::Type type) {
     stack_.push_back(&stack_.back()->append(type));
     break;
   case sMapValue:
-    stack_.push_back(&stack_.back()->insert(key_, type));
+    stack_.back()->map_->emplace_back(Value(key_), Value(type));
+    stack_.push_back(&stack_.back()->map_->back().second);
     state_ = sMapKey;
     break;
   default:
@@ -780,6 +982,7 @@ bool BuilderVisitor::openComplexValue(Value::Type type) {
 }
 
 bool BuilderVisitor::closeComplexValue() {
+  stack_.back()->sortMembers();
   stack_.pop_back();
   if (!stack_.empty()) {
     switch (stack_.back()->type()) {
@@ -805,29 +1008,44 @@ bool parse(File& file, Value& value, int mode, std::string* func, bool throwExce
 }
 
 bool Value::walk(Visitor* visitor) const {
-  switch (type_) {
+  std::string text;
+  return walk(visitor, text);
+}
+bool Value::walk(Visitor* visitor, std::string& text) const {
+  switch (type()) {
   case tUndefined:
   case tNull:
     return visitor->onNull();
   case tBoolean:
     return visitor->onBoolean(bool_);
   case tString:
-    return visitor->onString(*string_);
+    if (isLarge()) return visitor->onString(*string_);
+    text.assign(bytes_, static_cast<uint8>(bytes_[14]));
+    return visitor->onString(text);
   case tInteger:
-    return visitor->onInteger(int_);
+    if (int_ >= -0x80000000LL && int_ <= 0x7FFFFFFFLL) {
+      return visitor->onInteger(static_cast<int>(int_));
+    }
+    return visitor->onInteger64(int_);
   case tNumber:
     return visitor->onNumber(number_);
   case tObject:
     if (!visitor->onOpenMap()) return false;
     for (auto it = map_->begin(); it != map_->end(); ++it) {
-      if (!visitor->onMapKey(it->first)) return false;
-      if (!it->second.walk(visitor)) return false;
+      if (it->first.isLarge()) {
+        if (!visitor->onMapKey(*it->first.string_)) return false;
+      } else {
+        StringView key = it->first.getString();
+        text.assign(key.data(), key.size());
+        if (!visitor->onMapKey(text)) return false;
+      }
+      if (!it->second.walk(visitor, text)) return false;
     }
     return visitor->onCloseMap();
   case tArray:
     if (!visitor->onOpenArray()) return false;
     for (auto it = array_->begin(); it != array_->end(); ++it) {
-      if (!it->walk(visitor)) return false;
+      if (!it->walk(visitor, text)) return false;
     }
     return visitor->onCloseArray();
   default:
@@ -835,6 +1053,61 @@ bool Value::walk(Visitor* visitor) const {
   }
 }
 
+namespace {
+
+char const hexDigits[] = "0123456789ABCDEF";
+
+void appendCodePoint(std::string& out, uint32 cp) {
+  char buf[6] = {'\\', 'u', hexDigits[(cp >> 12) & 15], hexDigits[(cp >> 8) & 15], hexDigits[(cp >> 4) & 15], hexDigits[cp & 15]};
+  out.append(buf, 6);
+}
+
+template<class U>
+char* formatDigits(char* end, U val) {
+  do {
+    *--end = static_cast<char>('0' + val % 10);
+    val /= 10;
+  } while (val);
+  return end;
+}
+
+inline int lowestBit(uint32 mask) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return int(index);
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+// Length of the part of a string that is written as it is: everything up to
+// the first quote, backslash or control character, or non-ASCII byte if those
+// are escaped.
+size_t cleanPrefix(uint8 const* str, size_t size, bool escape) {
+  size_t pos = 0;
+#ifdef JSON_WRITER_SSE2
+  __m128i const quote = _mm_set1_epi8('"');
+  __m128i const slash = _mm_set1_epi8('\\');
+  __m128i const control = _mm_set1_epi8(0x1F);
+  int const high = (escape ? 0xFFFF : 0);
+  for (; pos + 16 <= size; pos += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(str + pos));
+    __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash));
+    special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+    int mask = _mm_movemask_epi8(special) | (_mm_movemask_epi8(v) & high);
+    if (mask) return pos + lowestBit(mask);
+  }
+#endif
+  for (; pos < size; ++pos) {
+    uint8 chr = str[pos];
+    if (chr < 32 || chr == '"' || chr == '\\' || (escape && chr > 0x7F)) break;
+  }
+  return pos;
+}
+
+}
+
 WriterVisitor::WriterVisitor(File& file, int mode, char const* func)
   : file_(file)
   , mode_(mode)
@@ -843,16 +1116,29 @@ WriterVisitor::WriterVisitor(File& file, int mode, char const* func)
   , object_(false)
 {
   if (mode == mJSCall) {
-    file.printf("%s(", func ? func : "");
+    buffer_.append(func ? func : "");
+    buffer_.push_back('(');
+  }
+}
+WriterVisitor::~WriterVisitor() {
+  flush();
+}
+
+void WriterVisitor::flush() {
+  if (!buffer_.empty()) {
+    file_.write(buffer_.data(), buffer_.size());
+    buffer_.clear();
   }
 }
 
 void WriterVisitor::onValue() {
+  if (buffer_.size() >= BufferSize) flush();
   if (!object_ && !empty_) {
-    file_.putc(',');
+    buffer_.push_back(',');
   }
   if (!object_ && !curIndent_.empty()) {
-    file_.printf("\n%s", curIndent_.c_str());
+    buffer_.push_back('\n');
+    buffer_.append(curIndent_);
   }
   empty_ = false;
   object_ = false;
@@ -861,86 +1147,126 @@ void WriterVisitor::onValue() {
 void WriterVisitor::openValue(char chr) {
   onValue();
   empty_ = true;
-  file_.putc(chr);
+  buffer_.push_back(chr);
   curIndent_.append(indent_);
 }
 void WriterVisitor::closeValue(char chr) {
   curIndent_.resize(curIndent_.size() - indent_.size());
   if (!empty_ && !indent_.empty()) {
-    if (mode_ != mJSON) file_.putc(',');
-    file_.printf("\n%s", curIndent_.c_str());
+    if (mode_ != mJSON) buffer_.push_back(',');
+    buffer_.push_back('\n');
+    buffer_.append(curIndent_);
   }
-  file_.putc(chr);
+  buffer_.push_back(chr);
   empty_ = false;
 }
 
-void WriterVisitor::writeString(std::string const& str) {
-  file_.putc('"');
-  for (uint32 pos = 0; pos < str.length(); ++pos) {
-    uint8 chr = static_cast<uint8>(str[pos]);
+void WriterVisitor::writeString(StringView str) {
+  uint8 const* data = reinterpret_cast<uint8 const*>(str.data());
+  size_t size = str.size();
+  buffer_.push_back('"');
+  size_t pos = 0;
+  while (pos < size) {
+    size_t clean = cleanPrefix(data + pos, size - pos, escape_);
+    buffer_.append(str.data() + pos, clean);
+    pos += clean;
+    if (pos >= size) break;
+    uint8 chr = data[pos++];
     switch (chr) {
     case '"':
-      file_.printf("\\\"");
+      buffer_.append("\\\"", 2);
       break;
     case '\\':
-      file_.printf("\\\\");
+      buffer_.append("\\\\", 2);
       break;
     case '\b':
-      file_.printf("\\b");
+      buffer_.append("\\b", 2);
       break;
     case '\f':
-      file_.printf("\\f");
+      buffer_.append("\\f", 2);
       break;
     case '\n':
-      file_.printf("\\n");
+      buffer_.append("\\n", 2);
       break;
     case '\r':
-      file_.printf("\\r");
+      buffer_.append("\\r", 2);
       break;
     case '\t':
-      file_.printf("\\t");
+      buffer_.append("\\t", 2);
       break;
     default:
       if (chr < 32) {
-        file_.printf("\\u%04X", (int)chr);
-      } else if (chr <= 0x7F || !escape_) {
-        file_.putc(chr);
+        appendCodePoint(buffer_, chr);
       } else {
         uint8 hdr = chr;
         uint32 mask = 0x3F;
         uint32 cp = chr;
-        while ((hdr & 0xC0) == 0xC0 && pos < str.length() - 1) {
-          chr = str[++pos];
+        while ((hdr & 0xC0) == 0xC0 && pos < size) {
+          chr = data[pos++];
           cp = (cp << 6) | (chr & 0x3F);
           mask = (mask << 5) | 0x1F;
           hdr <<= 1;
         }
         cp &= mask;
-        file_.printf("\\u%04X", cp & 0xFFFF);
+        appendCodePoint(buffer_, cp);
       }
     }
   }
-  file_.putc('"');
+  buffer_.push_back('"');
 }
 
 bool WriterVisitor::onNull() {
   onValue();
-  file_.printf("null");
+  buffer_.append("null", 4);
   return true;
 }
 bool WriterVisitor::onBoolean(bool val) {
   onValue();
-  file_.printf(val ? "true" : "false");
+  if (val) {
+    buffer_.append("true", 4);
+  } else {
+    buffer_.append("false", 5);
+  }
   return true;
 }
 bool WriterVisitor::onInteger(int val) {
   onValue();
-  file_.printf("%d", val);
+  char buf[16];
+  char* end = buf + sizeof buf;
+  char* pos = formatDigits(end, val < 0 ? 0 - static_cast<uint32>(val) : static_cast<uint32>(val));
+  if (val < 0) *--pos = '-';
+  buffer_.append(pos, end);
   return true;
 }
 bool WriterVisitor::onNumber(double val) {
   onValue();
-  file_.printf("%.14g", val);
+  char buf[32];
+  if (val > -1e14 && val < 1e14 && val != 0 && val == static_cast<double>(static_cast<sint64>(val))) {
+    // whole numbers come out of %.14g as plain digits
+    sint64 whole = static_cast<sint64>(val);
+    char* end = buf + sizeof buf;
+    char* pos = formatDigits(end, static_cast<uint64>(whole < 0 ? -whole : whole));
+    if (whole < 0) *--pos = '-';
+    buffer_.append(pos, end);
+  } else {
+    buffer_.append(buf, sprintf(buf, "%.14g", val));
+  }
+  return true;
+}
+bool WriterVisitor::onInteger64(sint64 val) {
+  onValue();
+  char buf[24];
+  char* end = buf + sizeof buf;
+  char* pos;
+  if (val >= -0x80000000LL && val <= 0x7FFFFFFFLL) {
+    // 64-bit division is a library call on 32-bit targets
+    int small = static_cast<int>(val);
+    pos = formatDigits(end, small < 0 ? 0 - static_cast<uint32>(small) : static_cast<uint32>(small));
+  } else {
+    pos = formatDigits(end, val < 0 ? 0 - static_cast<uint64>(val) : static_cast<uint64>(val));
+  }
+  if (val < 0) *--pos = '-';
+  buffer_.append(pos, end);
   return true;
 }
 bool WriterVisitor::onString(std::string const& val) {
@@ -948,6 +1274,11 @@ bool WriterVisitor::onString(std::string const& val) {
   writeString(val);
   return true;
 }
+bool WriterVisitor::onString(StringView val) {
+  onValue();
+  writeString(val);
+  return true;
+}
 bool WriterVisitor::onMapKey(std::string const& key) {
   onValue();
   object_ = true;
@@ -963,19 +1294,25 @@ bool WriterVisitor::onMapKey(std::string const& key) {
     }
   }
   if (safe) {
-    file_.printf("%s", key.c_str());
+    buffer_.append(key);
   } else {
     writeString(key);
   }
-  file_.putc(':');
-  if (!indent_.empty()) file_.putc(' ');
+  buffer_.push_back(':');
+  if (!indent_.empty()) buffer_.push_back(' ');
   return true;
 }
 bool WriterVisitor::onEnd() {
-  if (mode_ == mJSCall) file_.printf(");");
-  if (!indent_.empty()) file_.putc('\n');
+  if (mode_ == mJSCall) buffer_.append(");", 2);
+  if (!indent_.empty()) buffer_.push_back('\n');
+  flush();
   return true;
 }
+void WriterVisitor::endLine() {
+  buffer_.push_back('\n');
+  empty_ = true;
+  object_ = false;
+}
 
 bool write(File& file, Value& value, int mode, char const* func) {
   WriterVisitor writer(file, mode, func);
@@ -4,32 +4,54 @@
 #include "file.h"
 #include "common.h"
 #include <vector>
-#include <map>
+
+// Vectors only move their elements when growing if that can not throw.
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define JSON_NOEXCEPT
+#else
+#define JSON_NOEXCEPT noexcept
+#endif
 
 namespace json {
 
 class Visitor;
 
+// A JSON value in 16 bytes. The last byte is the type; strings of up to
+// SmallSize bytes are kept in the value itself with their length in the byte
+// before it, longer ones are on the heap. Objects are vectors of members
+// sorted by key, so lookups are binary searches with any kind of string.
 class Value {
 public:
-  typedef std::map<std::string, Value> Map;
+  typedef std::pair<Value, Value> Member;   // the key is always a string
+  typedef std::vector<Member> Map;
   typedef std::vector<Value> Array;
   enum Type { tUndefined, tNull, tString, tInteger, tNumber, tObject, tArray, tBoolean };
 
 private:
-  Type type_;
+  enum { SmallSize = 13, LargeString = 0xFF };
   union {
-    int int_;
+    sint64 int_;
     double number_;
+    bool bool_;
     std::string* string_;
     Map* map_;
     Array* array_;
-    bool bool_;
+    // small strings, then their length (or LargeString) and the type
+    char bytes_[16];
   };
+  void setTag(Type type) {
+    bytes_[15] = static_cast<char>(type);
+  }
+  bool isLarge() const {
+    return static_cast<uint8>(bytes_[14]) == LargeString;
+  }
+  // takes over the contents of rhs, leaving it undefined
+  void take(Value& rhs);
+  Member* find(StringView name) const;
+  // members are added in any order by the builder and sorted when it is done
+  friend class BuilderVisitor;
+  void sortMembers();
 public:
-  typedef std::map<std::string, Value> Map;
-  typedef std::vector<Value> Array;
-
   Value(Type type = tUndefined);
   ~Value() {
     clear();
@@ -38,23 +60,33 @@ public:
   Value(bool val);
   Value(int val);
   Value(unsigned int val);
+#ifdef _MSC_VER
+  // distinct from int only where uint32 is a long
   Value(sint32 val);
   Value(uint32 val);
+#endif
   Value(sint64 val);
   Value(uint64 val);
   Value(double val);
   Value(std::string const& val);
+  Value(std::string&& val);
   Value(char const* val);
+  Value(StringView val);
   Value(Value const& val);
+  Value(Value&& val) JSON_NOEXCEPT;
 
   Value& operator=(Value const& rhs);
+  Value& operator=(Value&& rhs) JSON_NOEXCEPT;
   Value& setValue(Value const& rhs) {
     return *this = rhs;
   }
+  Value& setValue(Value&& rhs) {
+    return *this = std::move(rhs);
+  }
 
   void clear();
   Type type() const {
-    return type_;
+    return static_cast<Type>(bytes_[15]);
   }
   Value& setType(Type type);
 
@@ -63,33 +95,34 @@ public:
   Value& setBoolean(bool data);
 
   // tString
-  std::string const& getString() const;
-  Value& setString(std::string const& data);
-  Value& setString(char const* data);
+  // The view is null-terminated and lasts until the value is changed or moved.
+  StringView getString() const;
+  Value& setString(StringView data);
+  Value& setString(std::string&& data);
+  Value& setString(char const* data) {
+    return setString(StringView(data));
+  }
 
   // tNumber
+  // tInteger holds 64-bit values; isInteger() and getInteger() are about int
   bool isInteger() const;
   int getInteger() const;
+  sint64 getInteger64() const;
   double getNumber() const;
   Value& setInteger(int data);
+  Value& setInteger64(sint64 data);
   Value& setNumber(double data);
 
   // tObject
   Map const& getMap() const;
-  bool has(std::string const& name) const;
-  bool has(char const* name) const;
-  Value const* get(std::string const& name) const;
-  Value* get(std::string const& name);
-  Value const* get(char const* name) const;
-  Value* get(char const* name);
-  Value& insert(std::string const& name, Value const& data);
-  void remove(std::string const& name);
-  Value& insert(char const* name, Value const& data);
-  void remove(char const* name);
-  Value const& operator[](std::string const& name) const;
-  Value& operator[](std::string const& name);
-  Value const& operator[](char const* name) const;
-  Value& operator[](char const* name);
+  bool has(StringView name) const;
+  Value const* get(StringView name) const;
+  Value* get(StringView name);
+  Value& insert(StringView name, Value const& data);
+  Value& insert(StringView name, Value&& data);
+  void remove(StringView name);
+  Value const& operator[](StringView name) const;
+  Value& operator[](StringView name);
 
   bool hasProperty(char const* name, uint8 type) const {
     Value const* prop = get(name);
@@ -102,102 +135,74 @@ public:
   Value const* at(uint32 i) const;
   Value* at(uint32 i);
   Value& insert(uint32 i, Value const& data);
+  Value& insert(uint32 i, Value&& data);
   Value& append(Value const& data);
+  Value& append(Value&& data);
   void remove(uint32 i);
   Value const& operator[](int i) const;
   Value& operator[](int i);
 
   class Iterator {
-    Type type_;
-    Map::iterator map_;
-    Array::iterator array_;
+    Member* member_;
+    Value* item_;
     friend class Value;
-    Iterator(Map::iterator map) : map_(map), type_(tObject) {}
-    Iterator(Array::iterator array) : array_(array), type_(tArray) {}
+    Iterator(Member* member) : member_(member), item_(nullptr) {}
+    Iterator(Value* item) : member_(nullptr), item_(item) {}
   public:
-    Iterator() : type_(tUndefined) {}
+    Iterator() : member_(nullptr), item_(nullptr) {}
 
-    Iterator& operator=(Iterator const& it) {
-      type_ = it.type_;
-      if (type_ == tObject) map_ = it.map_;
-      if (type_ == tArray) array_ = it.array_;
-      return *this;
-    }
     Iterator& operator++() {
-      if (type_ == tObject) ++map_;
-      if (type_ == tArray) ++array_;
+      if (member_) ++member_;
+      if (item_) ++item_;
       return *this;
     }
-    bool operator==(Iterator const& it) {
-      if (type_ != it.type_) return false;
-      if (type_ == tObject) return map_ == it.map_;
-      if (type_ == tArray) return array_ == it.array_;
-      return true;
+    bool operator==(Iterator const& it) const {
+      return member_ == it.member_ && item_ == it.item_;
     }
-    bool operator!=(Iterator const& it) {
-      if (type_ != it.type_) return true;
-      if (type_ == tObject) return map_ != it.map_;
-      if (type_ == tArray) return array_ != it.array_;
-      return false;
+    bool operator!=(Iterator const& it) const {
+      return !(*this == it);
     }
 
     Value& operator*() const {
-      if (type_ == tObject) return map_->second;
-      return *array_;
+      return (member_ ? member_->second : *item_);
     }
     Value* operator->() const {
-      if (type_ == tObject) return &map_->second;
-      return &*array_;
+      return &**this;
     }
-    std::string const& key() const {
-      return map_->first;
+    StringView key() const {
+      return member_->first.getString();
     }
   };
 
   class ConstIterator {
-    Type type_;
-    Map::const_iterator map_;
-    Array::const_iterator array_;
+    Member const* member_;
+    Value const* item_;
     friend class Value;
-    ConstIterator(Map::const_iterator map) : map_(map), type_(tObject) {}
-    ConstIterator(Array::const_iterator array) : array_(array), type_(tArray) {}
+    ConstIterator(Member const* member) : member_(member), item_(nullptr) {}
+    ConstIterator(Value const* item) : member_(nullptr), item_(item) {}
   public:
-    ConstIterator() : type_(tUndefined) {}
+    ConstIterator() : member_(nullptr), item_(nullptr) {}
 
-    ConstIterator& operator=(ConstIterator const& it) {
-      type_ = it.type_;
-      if (type_ == tObject) map_ = it.map_;
-      if (type_ == tArray) array_ = it.array_;
-      return *this;
-    }
     ConstIterator& operator++() {
-      if (type_ == tObject) ++map_;
-      if (type_ == tArray) ++array_;
+      if (member_) ++member_;
+      if (item_) ++item_;
       return *this;
     }
-    bool operator==(ConstIterator const& it) {
-      if (type_ != it.type_) return false;
-      if (type_ == tObject) return map_ == it.map_;
-      if (type_ == tArray) return array_ == it.array_;
-      return true;
+    bool operator==(ConstIterator const& it) const {
+      return member_ == it.member_ && item_ == it.item_;
     }
-    bool operator!=(ConstIterator const& it) {
-      if (type_ != it.type_) return true;
-      if (type_ == tObject) return map_ != it.map_;
-      if (type_ == tArray) return array_ != it.array_;
-      return false;
+    bool operator!=(ConstIterator const& it) const {
+      return !(*this == it);
     }
 
     Value const& operator*() const {
-      if (type_ == tObject) return map_->second;
-      return *array_;
+      return (member_ ? member_->second : *item_);
     }
     Value const* operator->() const {
-      if (type_ == tObject) return &map_->second;
-      return &*array_;
+      return &**this;
     }
-    std::string const& key() const {
-      return map_->first;
+    StringView key() const {
+      return member_->first.getString();
     }
   };
 
@@ -207,6 +212,8 @@ public:
   ConstIterator end() const;
 
   bool walk(Visitor* visitor) const;
+private:
+  bool walk(Visitor* visitor, std::string& text) const;
 };
 
 class Visitor {
@@ -222,12 +229,20 @@ public:
   virtual bool onBoolean(bool val) { return true; }
   virtual bool onInteger(int val) { return true; }
   virtual bool onNumber(double val) { return true; }
+  // integers that do not fit in an int
+  virtual bool onInteger64(sint64 val) {
+    return onNumber(static_cast<double>(val));
+  }
   virtual bool onString(std::string const& val) { return true; }
   virtual bool onOpenMap() { return true; }
   virtual bool onMapKey(std::string const& key) { return true; }
   virtual bool onCloseMap() { return true; }
   virtual bool onOpenArray() { return true; }
   virtual bool onCloseArray() { return true; }
+  // Asked by parse() before every item of an array and every member value;
+  // if it returns true, the value is checked but not decoded, and none of
+  // the handlers are called for it.
+  virtual bool skipValue() { return false; }
   virtual bool onIntegerEx(int val, std::string const& alt) {
     if (printExStrings) {
       return onString(alt);
@@ -247,6 +262,12 @@ private:
 class BuilderVisitor : public Visitor {
 public:
   BuilderVisitor(Value& value, bool throwExceptions = false);
+  // clears the value to build it again
+  void reset() {
+    value_.clear();
+    stack_.clear();
+    state_ = sStart;
+  }
   bool onNull() {
     return setValue(Value::tNull);
   }
@@ -259,6 +280,9 @@ public:
   bool onNumber(double val) {
     return setValue(val);
   }
+  bool onInteger64(sint64 val) {
+    return setValue(val);
+  }
   bool onString(std::string const& val) {
     return setValue(val);
   }
@@ -296,18 +320,19 @@ protected:
     sFinish,
   } state_;
 
+  // the new value is built once and moved into place
   template<class T>
   bool setValue(T const& value) {
     switch (state_) {
     case sStart:
-      value_.setValue(value);
+      value_.setValue(Value(value));
       break;
     case sMapValue:
-      stack_.back()->insert(key_, value);
+      stack_.back()->map_->emplace_back(Value(key_), Value(value));
       state_ = sMapKey;
       break;
     case sArrayValue:
-      stack_.back()->append(value);
+      stack_.back()->append(Value(value));
       break;
     default:
       return false;
@@ -323,10 +348,17 @@ enum {mJSON, mJS, mJSCall};
 
 bool parse(File& file, Visitor* visitor, int mode = mJSON, std::string* func = nullptr);
 bool parse(File& file, Value& value, int mode = mJSON, std::string* func = nullptr, bool throwExceptions = false);
+// Parses strict JSON items separated by commas, as found between the brackets
+// of an array, up to the end of the file. The visitor sees them as one array.
+bool parseItems(File& file, Visitor* visitor);
 
+// Output is collected in a buffer and goes to the file when the buffer fills
+// up, on flush(), onEnd() or when the writer is destroyed; flush it before
+// writing anything else to the same file.
 class WriterVisitor : public Visitor {
 public:
   WriterVisitor(File& file, int mode = mJSON, char const* func = nullptr);
+  ~WriterVisitor();
 
   void setIndent(std::string indent) {
     indent_ = indent;
@@ -342,7 +374,13 @@ public:
   bool onBoolean(bool val);
   bool onInteger(int val);
   bool onNumber(double val);
+  bool onInteger64(sint64 val);
   bool onString(std::string const& val);
+  // the same for text that is not held in a std::string
+  bool onString(StringView val);
+  bool onString(char const* val) {
+    return onString(StringView(val));
+  }
   bool onOpenMap() {
     openValue('{');
     return true;
@@ -362,8 +400,14 @@ public:
   }
   bool onEnd();
 
+  // ends a line of newline-delimited output; the next value starts a new one
+  void endLine();
+  void flush();
+
 protected:
+  enum { BufferSize = 1 << 16 };
   File& file_;
+  std::string buffer_;
   int mode_;
   bool escape_;
   bool empty_;
@@ -373,7 +417,7 @@ protected:
   void onValue();
   void openValue(char chr);
   void closeValue(char chr);
-  void writeString(std::string const& str);
+  void writeString(StringView str);
 };
 
 bool write(File& file, Value& value, int mode = mJSON, char const* func = nullptr);
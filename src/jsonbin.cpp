@@ -0,0 +1,331 @@
+#include "jsonbin.h"
+#include "trace.h"
+#include <algorithm>
+#include <string.h>
+
+namespace json {
+
+namespace {
+
+enum {
+  bNull = 0xC0,
+  bFalse,
+  bTrue,
+  bInt32,     // 4 bytes
+  bInt64,     // 8 bytes
+  bDouble,    // 8 bytes
+  bString,    // length, bytes
+  bObject,    // size, count, then count keys (length, bytes) and values
+  bArray,     // size, count, then count values
+};
+
+// bytes after the tag that are there whatever the contents
+size_t headerSize(uint8 tag) {
+  switch (tag) {
+  case bNull:
+  case bFalse:
+  case bTrue:
+    return 0;
+  case bInt32:
+  case bString:
+    return 4;
+  case bInt64:
+  case bDouble:
+  case bObject:
+  case bArray:
+    return 8;
+  default:
+    return size_t(-1);
+  }
+}
+
+inline uint32 getUint32(uint8 const* ptr) {
+  uint32 res;
+  memcpy(&res, ptr, sizeof res);
+  return res;
+}
+
+class BinaryReader {
+public:
+  BinaryReader(uint8 const* data, size_t size, Visitor* visitor)
+    : begin_(data)
+    , pos_(data)
+    , end_(data + size)
+    , visitor_(visitor)
+    , depth_(0)
+  {}
+
+  bool value();
+  size_t used() const {
+    return pos_ - begin_;
+  }
+
+private:
+  uint8 const* begin_;
+  uint8 const* pos_;
+  uint8 const* end_;
+  enum { MaxDepth = 1024 };
+  Visitor* visitor_;
+  std::string text_;
+  int depth_;
+
+  bool error(char const* reason) {
+    visitor_->onError(0, static_cast<uint32>(pos_ - begin_), reason);
+    return false;
+  }
+  bool has(size_t size) const {
+    return size <= size_t(end_ - pos_);
+  }
+  // a string or key into text_
+  bool string();
+  bool skip();
+  bool container(bool object);
+};
+
+bool BinaryReader::string() {
+  if (!has(4)) return error("unexpected end of data");
+  uint32 length = getUint32(pos_);
+  pos_ += 4;
+  if (!has(length)) return error("unexpected end of data");
+  text_.assign(reinterpret_cast<char const*>(pos_), length);
+  pos_ += length;
+  return true;
+}
+
+bool BinaryReader::skip() {
+  if (!has(1)) return error("unexpected end of data");
+  size_t header = headerSize(*pos_);
+  if (header == size_t(-1)) return error("invalid tag");
+  if (!has(1 + header)) return error("unexpected end of data");
+  uint32 size = 0;
+  if (*pos_ == bString || *pos_ == bObject || *pos_ == bArray) {
+    size = getUint32(pos_ + 1);
+  }
+  pos_ += 1 + header;
+  if (!has(size)) return error("unexpected end of data");
+  pos_ += size;
+  return true;
+}
+
+bool BinaryReader::container(bool object) {
+  if (!has(8)) return error("unexpected end of data");
+  uint32 size = getUint32(pos_);
+  uint32 count = getUint32(pos_ + 4);
+  pos_ += 8;
+  if (!has(size)) return error("unexpected end of data");
+  uint8 const* stop = pos_ + size;
+  if (depth_ >= MaxDepth) return error("nesting too deep");
+  ++depth_;
+  if (!(object ? visitor_->onOpenMap() : visitor_->onOpenArray())) return false;
+  for (uint32 i = 0; i < count; ++i) {
+    if (object) {
+      if (!string()) return false;
+      if (!visitor_->onMapKey(text_)) return false;
+    }
+    if (visitor_->skipValue()) {
+      if (!skip()) return false;
+    } else {
+      if (!value()) return false;
+    }
+  }
+  if (pos_ != stop) return error("container size mismatch");
+  --depth_;
+  return (object ? visitor_->onCloseMap() : visitor_->onCloseArray());
+}
+
+bool BinaryReader::value() {
+  if (!has(1)) return error("unexpected end of data");
+  uint8 tag = *pos_;
+  size_t header = headerSize(tag);
+  if (header == size_t(-1)) return error("invalid tag");
+  if (!has(1 + header)) return error("unexpected end of data");
+  ++pos_;
+  switch (tag) {
+  case bNull:
+    return visitor_->onNull();
+  case bFalse:
+    return visitor_->onBoolean(false);
+  case bTrue:
+    return visitor_->onBoolean(true);
+  case bInt32: {
+    sint32 val;
+    memcpy(&val, pos_, sizeof val);
+    pos_ += sizeof val;
+    return visitor_->onInteger(val);
+  }
+  case bInt64: {
+    sint64 val;
+    memcpy(&val, pos_, sizeof val);
+    pos_ += sizeof val;
+    return visitor_->onInteger64(val);
+  }
+  case bDouble: {
+    double val;
+    memcpy(&val, pos_, sizeof val);
+    pos_ += sizeof val;
+    return visitor_->onNumber(val);
+  }
+  case bString:
+    return string() && visitor_->onString(text_);
+  case bObject:
+    return container(true);
+  default:
+    return container(false);
+  }
+}
+
+}
+
+BinaryWriterVisitor::BinaryWriterVisitor(File& file)
+  : file_(file)
+  , failed_(false)
+{}
+BinaryWriterVisitor::~BinaryWriterVisitor() {
+  flush();
+}
+
+bool BinaryWriterVisitor::flush() {
+  if (open_.empty() && !buffer_.empty()) {
+    if (file_.write(buffer_.data(), buffer_.size()) != buffer_.size()) failed_ = true;
+    buffer_.clear();
+  }
+  return !failed_;
+}
+
+void BinaryWriterVisitor::onValue(uint8 tag) {
+  if (!open_.empty() && !open_.back().object) ++open_.back().count;
+  buffer_.push_back(static_cast<char>(tag));
+}
+
+void BinaryWriterVisitor::putString(std::string const& str) {
+  uint32 length = static_cast<uint32>(str.size());
+  put(&length, sizeof length);
+  put(str.data(), str.size());
+}
+
+bool BinaryWriterVisitor::open(uint8 tag, bool object) {
+  onValue(tag);
+  Container container;
+  container.start = buffer_.size() - 1;
+  container.count = 0;
+  container.object = object;
+  open_.push_back(container);
+  // size and count are filled in on close
+  buffer_.append(8, '\0');
+  return true;
+}
+bool BinaryWriterVisitor::close(bool object) {
+  if (open_.empty() || open_.back().object != object) return false;
+  Container container = open_.back();
+  open_.pop_back();
+  uint32 size = static_cast<uint32>(buffer_.size() - container.start - 9);
+  memcpy(&buffer_[container.start + 1], &size, sizeof size);
+  memcpy(&buffer_[container.start + 5], &container.count, sizeof container.count);
+  if (buffer_.size() >= BufferSize) flush();
+  return true;
+}
+
+bool BinaryWriterVisitor::onNull() {
+  onValue(bNull);
+  return true;
+}
+bool BinaryWriterVisitor::onBoolean(bool val) {
+  onValue(val ? bTrue : bFalse);
+  return true;
+}
+bool BinaryWriterVisitor::onInteger(int val) {
+  onValue(bInt32);
+  sint32 data = val;
+  put(&data, sizeof data);
+  return true;
+}
+bool BinaryWriterVisitor::onNumber(double val) {
+  onValue(bDouble);
+  put(&val, sizeof val);
+  return true;
+}
+bool BinaryWriterVisitor::onInteger64(sint64 val) {
+  if (val >= -0x80000000LL && val <= 0x7FFFFFFFLL) {
+    return onInteger(static_cast<int>(val));
+  }
+  onValue(bInt64);
+  put(&val, sizeof val);
+  return true;
+}
+bool BinaryWriterVisitor::onString(std::string const& val) {
+  onValue(bString);
+  putString(val);
+  return true;
+}
+bool BinaryWriterVisitor::onOpenMap() {
+  return open(bObject, true);
+}
+bool BinaryWriterVisitor::onMapKey(std::string const& key) {
+  if (open_.empty() || !open_.back().object) return false;
+  ++open_.back().count;
+  putString(key);
+  return true;
+}
+bool BinaryWriterVisitor::onCloseMap() {
+  return close(true);
+}
+bool BinaryWriterVisitor::onOpenArray() {
+  return open(bArray, false);
+}
+bool BinaryWriterVisitor::onCloseArray() {
+  return close(false);
+}
+bool BinaryWriterVisitor::onEnd() {
+  return flush() && open_.empty();
+}
+
+bool writeBinary(File& file, Value const& value) {
+  BinaryWriterVisitor writer(file);
+  if (!value.walk(&writer)) return false;
+  return writer.onEnd();
+}
+
+bool parseBinary(File& file, Visitor* visitor) {
+  TRACE_SPAN("json::parseBinary");
+  uint64 start = file.tell();
+  size_t size;
+  uint8 const* data = file.contiguous(size);
+  bool inMemory = (data != nullptr);
+  std::vector<uint8> buffer;
+  if (!inMemory) {
+    // the header tells how much more there is to read; it is read a chunk at
+    // a time, so a damaged size does not allocate more than the file holds
+    uint8 head[9];
+    size_t got = file.read(head, 1);
+    size_t header = (got ? headerSize(head[0]) : 0);
+    if (got && header != size_t(-1)) got += file.read(head + 1, header);
+    uint32 rest = 0;
+    if (got == 1 + header && (head[0] == bString || head[0] == bObject || head[0] == bArray)) {
+      rest = getUint32(head + 1);
+    }
+    buffer.assign(head, head + got);
+    while (rest) {
+      size_t chunk = std::min<size_t>(rest, 1 << 20);
+      size_t have = buffer.size();
+      buffer.resize(have + chunk);
+      size_t read = file.read(buffer.data() + have, chunk);
+      buffer.resize(have + read);
+      if (read < chunk) break;
+      rest -= static_cast<uint32>(chunk);
+    }
+    data = buffer.data();
+    size = buffer.size();
+  }
+  BinaryReader reader(data, size, visitor);
+  if (!reader.value()) return false;
+  if (inMemory) file.seek(start + reader.used());
+  return visitor->onEnd();
+}
+
+bool parseBinary(File& file, Value& value, bool throwExceptions) {
+  BuilderVisitor builder(value, throwExceptions);
+  value.clear();
+  return parseBinary(file, &builder);
+}
+
+}
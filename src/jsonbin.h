@@ -0,0 +1,69 @@
+#pragma once
+
+#include "json.h"
+#include <vector>
+
+namespace json {
+
+// Binary form of JSON for data we write and read back ourselves. Every value
+// starts with a tag byte. Numbers are stored as they are in memory
+// (little-endian), strings and keys after a 32-bit length, and objects and
+// arrays after the size in bytes of their contents and the number of items,
+// so a reader steps over any value without looking inside it. Tags are all
+// above 0x7F, so text JSON is never taken for binary.
+//
+// Output is collected in memory, since the size of a container is only known
+// when it closes, and goes to the file when the top-level value is done and
+// the buffer is large, on flush(), onEnd() or when the writer is destroyed.
+// A short write to the file is remembered, and onEnd() returns false after it.
+class BinaryWriterVisitor : public Visitor {
+public:
+  explicit BinaryWriterVisitor(File& file);
+  ~BinaryWriterVisitor();
+
+  bool onNull();
+  bool onBoolean(bool val);
+  bool onInteger(int val);
+  bool onNumber(double val);
+  bool onInteger64(sint64 val);
+  bool onString(std::string const& val);
+  bool onOpenMap();
+  bool onMapKey(std::string const& key);
+  bool onCloseMap();
+  bool onOpenArray();
+  bool onCloseArray();
+  bool onEnd();
+
+  bool flush();
+
+private:
+  enum { BufferSize = 1 << 16 };
+  struct Container {
+    size_t start;   // of the header in the buffer
+    uint32 count;
+    bool object;
+  };
+  File& file_;
+  std::string buffer_;
+  std::vector<Container> open_;
+  bool failed_;
+
+  void onValue(uint8 tag);
+  void put(void const* data, size_t size) {
+    buffer_.append(static_cast<char const*>(data), size);
+  }
+  void putString(std::string const& str);
+  bool open(uint8 tag, bool object);
+  bool close(bool object);
+};
+
+bool writeBinary(File& file, Value const& value);
+
+// Reads one value written by BinaryWriterVisitor and leaves the file right
+// after it. Visitor::skipValue() is asked before every item and member value,
+// and skipped values cost nothing. Errors are reported at line 0, with the
+// byte offset into the value as the column.
+bool parseBinary(File& file, Visitor* visitor);
+bool parseBinary(File& file, Value& value, bool throwExceptions = false);
+
+}
@@ -0,0 +1,319 @@
+#include "jsondoc.h"
+#include <algorithm>
+
+namespace json {
+
+namespace {
+
+Node const missing;
+
+// the order of std::string, which Value objects are sorted by
+int compareKeys(StringView lhs, StringView rhs) {
+  int res = memcmp(lhs.data(), rhs.data(), std::min(lhs.size(), rhs.size()));
+  if (res) return res;
+  return basic_compare(lhs.size(), rhs.size());
+}
+
+bool memberLess(Member const& lhs, Member const& rhs) {
+  return compareKeys(lhs.key, rhs.key) < 0;
+}
+
+}
+
+// tNumber
+bool Node::isInteger() const {
+  switch (type_) {
+  case Value::tInteger: return int_ >= -0x80000000LL && int_ <= 0x7FFFFFFFLL;
+  case Value::tNumber: return (int)number_ == number_;
+  default: return false;
+  }
+}
+int Node::getInteger() const {
+  if (!isInteger()) return 0;
+  return (type_ == Value::tInteger ? static_cast<int>(int_) : static_cast<int>(number_));
+}
+sint64 Node::getInteger64() const {
+  switch (type_) {
+  case Value::tInteger: return int_;
+  case Value::tNumber:
+    if (number_ >= -9223372036854775808.0 && number_ < 9223372036854775808.0 && (sint64)number_ == number_) {
+      return static_cast<sint64>(number_);
+    }
+    return 0;
+  default: return 0;
+  }
+}
+double Node::getNumber() const {
+  switch (type_) {
+  case Value::tInteger: return static_cast<double>(int_);
+  case Value::tNumber: return number_;
+  default: return 0;
+  }
+}
+
+// tObject
+Node const* Node::get(StringView name) const {
+  if (type_ != Value::tObject) return nullptr;
+  size_t left = 0, right = size_;
+  while (left < right) {
+    size_t mid = (left + right) / 2;
+    int cmp = compareKeys(members_[mid].key, name);
+    if (!cmp) return &members_[mid].value;
+    if (cmp < 0) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+  return nullptr;
+}
+Node const& Node::operator[](StringView name) const {
+  Node const* ptr = get(name);
+  return (ptr ? *ptr : missing);
+}
+
+// tArray
+Node const& Node::operator[](int i) const {
+  if (type_ != Value::tArray || i < 0 || static_cast<uint32>(i) >= size_) return missing;
+  return items_[i];
+}
+
+Node::ConstIterator& Node::ConstIterator::operator++() {
+  if (member_) ++member_;
+  if (item_) ++item_;
+  return *this;
+}
+Node const& Node::ConstIterator::operator*() const {
+  return (member_ ? member_->value : *item_);
+}
+StringView Node::ConstIterator::key() const {
+  return member_->key;
+}
+Node::ConstIterator Node::begin() const {
+  switch (type_) {
+  case Value::tObject:
+    return ConstIterator(members_);
+  case Value::tArray:
+    return ConstIterator(items_);
+  default:
+    return ConstIterator();
+  }
+}
+Node::ConstIterator Node::end() const {
+  switch (type_) {
+  case Value::tObject:
+    return ConstIterator(members_ + size_);
+  case Value::tArray:
+    return ConstIterator(items_ + size_);
+  default:
+    return ConstIterator();
+  }
+}
+
+bool Node::walk(Visitor* visitor) const {
+  std::string text;
+  return walk(visitor, text);
+}
+bool Node::walk(Visitor* visitor, std::string& text) const {
+  switch (type_) {
+  case Value::tUndefined:
+  case Value::tNull:
+    return visitor->onNull();
+  case Value::tBoolean:
+    return visitor->onBoolean(bool_);
+  case Value::tString:
+    text.assign(string_, size_);
+    return visitor->onString(text);
+  case Value::tInteger:
+    if (int_ >= -0x80000000LL && int_ <= 0x7FFFFFFFLL) {
+      return visitor->onInteger(static_cast<int>(int_));
+    }
+    return visitor->onInteger64(int_);
+  case Value::tNumber:
+    return visitor->onNumber(number_);
+  case Value::tObject:
+    if (!visitor->onOpenMap()) return false;
+    for (uint32 i = 0; i < size_; ++i) {
+      text.assign(members_[i].key.data(), members_[i].key.size());
+      if (!visitor->onMapKey(text)) return false;
+      if (!members_[i].value.walk(visitor, text)) return false;
+    }
+    return visitor->onCloseMap();
+  case Value::tArray:
+    if (!visitor->onOpenArray()) return false;
+    for (uint32 i = 0; i < size_; ++i) {
+      if (!items_[i].walk(visitor, text)) return false;
+    }
+    return visitor->onCloseArray();
+  default:
+    return false;
+  }
+}
+
+Value Node::toValue() const {
+  switch (type_) {
+  case Value::tBoolean:
+    return Value(bool_);
+  case Value::tString:
+    return Value(std::string(string_, size_));
+  case Value::tInteger:
+    return Value(int_);
+  case Value::tNumber:
+    return Value(number_);
+  case Value::tObject: {
+    Value res(Value::tObject);
+    for (uint32 i = 0; i < size_; ++i) {
+      res.insert(members_[i].key, members_[i].value.toValue());
+    }
+    return res;
+  }
+  case Value::tArray: {
+    Value res(Value::tArray);
+    for (uint32 i = 0; i < size_; ++i) {
+      res.append(items_[i].toValue());
+    }
+    return res;
+  }
+  default:
+    return Value(static_cast<Value::Type>(type_));
+  }
+}
+
+DocumentBuilder::DocumentBuilder(Document& document, bool throwExceptions)
+  : Visitor(throwExceptions)
+  , document_(document)
+  , done_(false)
+  , hasKey_(false)
+{
+  document_.clear();
+}
+
+void DocumentBuilder::reset() {
+  document_.clear();
+  done_ = false;
+  hasKey_ = false;
+  pending_.clear();
+  frames_.clear();
+}
+
+bool DocumentBuilder::add(Node const& node) {
+  if (frames_.empty()) {
+    if (done_) return false;
+    document_.root_ = node;
+    done_ = true;
+    return true;
+  }
+  if (frames_.back().object && !hasKey_) return false;
+  Member member;
+  member.key = key_;
+  member.value = node;
+  pending_.push_back(member);
+  hasKey_ = false;
+  return true;
+}
+
+bool DocumentBuilder::open(bool object) {
+  if (frames_.empty() ? done_ : (frames_.back().object && !hasKey_)) return false;
+  Frame frame;
+  frame.start = pending_.size();
+  frame.object = object;
+  frame.key = key_;
+  frames_.push_back(frame);
+  hasKey_ = false;
+  return true;
+}
+
+bool DocumentBuilder::close(bool object) {
+  if (frames_.empty() || frames_.back().object != object || hasKey_) return false;
+  Frame frame = frames_.back();
+  frames_.pop_back();
+  Member* first = pending_.data() + frame.start;
+  size_t count = pending_.size() - frame.start;
+  Node node;
+  if (object) {
+    // sorted by key; of equal keys the last one stays
+    std::stable_sort(first, first + count, memberLess);
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i) {
+      if (i + 1 < count && first[i].key == first[i + 1].key) continue;
+      first[kept++] = first[i];
+    }
+    Member* members = static_cast<Member*>(document_.arena_.alloc(kept * sizeof(Member)));
+    if (kept) memcpy(members, first, kept * sizeof(Member));
+    node.type_ = Value::tObject;
+    node.size_ = static_cast<uint32>(kept);
+    node.members_ = members;
+  } else {
+    Node* items = static_cast<Node*>(document_.arena_.alloc(count * sizeof(Node)));
+    for (size_t i = 0; i < count; ++i) {
+      memcpy(items + i, &first[i].value, sizeof(Node));
+    }
+    node.type_ = Value::tArray;
+    node.size_ = static_cast<uint32>(count);
+    node.items_ = items;
+  }
+  pending_.resize(frame.start);
+  key_ = frame.key;
+  hasKey_ = (!frames_.empty() && frames_.back().object);
+  return add(node);
+}
+
+bool DocumentBuilder::onNull() {
+  Node node;
+  node.type_ = Value::tNull;
+  return add(node);
+}
+bool DocumentBuilder::onBoolean(bool val) {
+  Node node;
+  node.type_ = Value::tBoolean;
+  node.bool_ = val;
+  return add(node);
+}
+bool DocumentBuilder::onInteger(int val) {
+  return onInteger64(val);
+}
+bool DocumentBuilder::onInteger64(sint64 val) {
+  Node node;
+  node.type_ = Value::tInteger;
+  node.int_ = val;
+  return add(node);
+}
+bool DocumentBuilder::onNumber(double val) {
+  Node node;
+  node.type_ = Value::tNumber;
+  node.number_ = val;
+  return add(node);
+}
+bool DocumentBuilder::onString(std::string const& val) {
+  StringView str = document_.arena_.copy(val);
+  Node node;
+  node.type_ = Value::tString;
+  node.size_ = static_cast<uint32>(str.size());
+  node.string_ = str.data();
+  return add(node);
+}
+bool DocumentBuilder::onOpenMap() {
+  return open(true);
+}
+bool DocumentBuilder::onMapKey(std::string const& key) {
+  if (frames_.empty() || !frames_.back().object || hasKey_) return false;
+  key_ = document_.arena_.copy(key);
+  hasKey_ = true;
+  return true;
+}
+bool DocumentBuilder::onCloseMap() {
+  return close(true);
+}
+bool DocumentBuilder::onOpenArray() {
+  return open(false);
+}
+bool DocumentBuilder::onCloseArray() {
+  return close(false);
+}
+
+bool parse(File& file, Document& document, int mode, std::string* func, bool throwExceptions) {
+  DocumentBuilder builder(document, throwExceptions);
+  return parse(file, &builder, mode, func);
+}
+
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include "json.h"
+#include "arena.h"
+
+namespace json {
+
+struct Member;
+
+// Read-only value inside a Document. The read side of the Value API works the
+// same way, except that strings and keys come back as views into the arena
+// (followed by a null character). Objects are kept sorted by key with the
+// last of any duplicate keys, so lookups are binary searches and walk() sees
+// the same order as it does for a Value.
+class Node {
+public:
+  Node()
+    : type_(Value::tUndefined)
+    , size_(0)
+    , int_(0)
+  {}
+
+  Value::Type type() const {
+    return static_cast<Value::Type>(type_);
+  }
+
+  // tBoolean
+  bool getBoolean() const {
+    return (type_ == Value::tBoolean ? bool_ : false);
+  }
+
+  // tString
+  StringView getString() const {
+    return (type_ == Value::tString ? StringView(string_, size_) : StringView("", 0));
+  }
+
+  // tNumber
+  bool isInteger() const;
+  int getInteger() const;
+  sint64 getInteger64() const;
+  double getNumber() const;
+
+  // tObject
+  bool has(StringView name) const {
+    return get(name) != nullptr;
+  }
+  Node const* get(StringView name) const;
+  Node const& operator[](StringView name) const;
+  bool hasProperty(char const* name, uint8 type) const {
+    Node const* prop = get(name);
+    return prop && prop->type() == type;
+  }
+
+  // tArray
+  uint32 length() const {
+    return (type_ == Value::tArray ? size_ : 0);
+  }
+  Node const* at(uint32 i) const {
+    return (type_ == Value::tArray && i < size_ ? items_ + i : nullptr);
+  }
+  Node const& operator[](int i) const;
+
+  class ConstIterator {
+    Member const* member_;
+    Node const* item_;
+    friend class Node;
+    ConstIterator(Member const* member) : member_(member), item_(nullptr) {}
+    ConstIterator(Node const* item) : member_(nullptr), item_(item) {}
+  public:
+    ConstIterator() : member_(nullptr), item_(nullptr) {}
+
+    ConstIterator& operator++();
+    bool operator==(ConstIterator const& it) const {
+      return member_ == it.member_ && item_ == it.item_;
+    }
+    bool operator!=(ConstIterator const& it) const {
+      return !(*this == it);
+    }
+
+    Node const& operator*() const;
+    Node const* operator->() const {
+      return &**this;
+    }
+    StringView key() const;
+  };
+  ConstIterator begin() const;
+  ConstIterator end() const;
+
+  bool walk(Visitor* visitor) const;
+  // a copy that does not depend on the document
+  Value toValue() const;
+
+private:
+  friend class DocumentBuilder;
+  uint8 type_;
+  uint32 size_;   // bytes of a string, items of an array, members of an object
+  union {
+    sint64 int_;
+    double number_;
+    bool bool_;
+    char const* string_;
+    Node const* items_;
+    Member const* members_;
+  };
+
+  bool walk(Visitor* visitor, std::string& text) const;
+};
+
+struct Member {
+  StringView key;
+  Node value;
+};
+
+// A parsed JSON value that allocates every node, key and string from one
+// monotonic arena. Children of an object or array are stored next to each
+// other, nothing is freed one at a time, and clear() keeps the memory for
+// the next parse.
+class Document {
+public:
+  explicit Document(size_t blockSize = Arena::DefaultBlock)
+    : arena_(blockSize)
+  {}
+  Document(Document&& other)
+    : arena_(std::move(other.arena_))
+    , root_(other.root_)
+  {
+    other.root_ = Node();
+  }
+  Document& operator=(Document&& other) {
+    arena_ = std::move(other.arena_);
+    root_ = other.root_;
+    other.root_ = Node();
+    return *this;
+  }
+
+  Node const& root() const {
+    return root_;
+  }
+  void clear() {
+    arena_.reset();
+    root_ = Node();
+  }
+  // memory held by the document
+  size_t capacity() const {
+    return arena_.capacity();
+  }
+
+private:
+  friend class DocumentBuilder;
+  Arena arena_;
+  Node root_;
+
+  Document(Document const&) = delete;
+  Document& operator=(Document const&) = delete;
+};
+
+// Builds a Document from parser events, like BuilderVisitor does for a Value.
+// The document is cleared first.
+class DocumentBuilder : public Visitor {
+public:
+  DocumentBuilder(Document& document, bool throwExceptions = false);
+
+  // Clears the document to build it again.
+  void reset();
+
+  bool onNull();
+  bool onBoolean(bool val);
+  bool onInteger(int val);
+  bool onNumber(double val);
+  bool onInteger64(sint64 val);
+  bool onString(std::string const& val);
+  bool onOpenMap();
+  bool onMapKey(std::string const& key);
+  bool onCloseMap();
+  bool onOpenArray();
+  bool onCloseArray();
+
+private:
+  struct Frame {
+    size_t start;
+    bool object;
+    StringView key;   // of the container itself
+  };
+  Document& document_;
+  bool done_;
+  bool hasKey_;
+  StringView key_;
+  // values of the open containers, moved to the arena when they close
+  std::vector<Member> pending_;
+  std::vector<Frame> frames_;
+
+  bool add(Node const& node);
+  bool open(bool object);
+  bool close(bool object);
+};
+
+bool parse(File& file, Document& document, int mode = mJSON, std::string* func = nullptr, bool throwExceptions = false);
+
+}
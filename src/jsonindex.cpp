@@ -0,0 +1,241 @@
+#include "jsonindex.h"
+#include <string.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define JSON_INDEX_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(JSON_INDEX_X86) && defined(__GNUC__)
+#define JSON_TARGET(isa) __attribute__((target(isa)))
+#else
+#define JSON_TARGET(isa)
+#endif
+
+namespace json {
+
+namespace {
+
+// masks of a 64-byte block, bit i for byte i
+struct Block {
+  uint64 quote;
+  uint64 squote;
+  uint64 backslash;
+  uint64 slash;
+  uint64 space;
+  uint64 structural;
+};
+
+typedef void (*Classifier)(uint8 const* data, Block& block);
+
+void classifyScalar(uint8 const* data, Block& block) {
+  memset(&block, 0, sizeof block);
+  for (int i = 0; i < 64; ++i) {
+    uint64 bit = uint64(1) << i;
+    switch (data[i]) {
+    case '"': block.quote |= bit; break;
+    case '\'': block.squote |= bit; break;
+    case '\\': block.backslash |= bit; break;
+    case '/': block.slash |= bit; break;
+    case ' ': case '\t': case '\n': case '\v': case '\f': case '\r':
+      block.space |= bit;
+      break;
+    case '{': case '}': case '[': case ']': case ':': case ',': case '(': case ')':
+      block.structural |= bit;
+      break;
+    }
+  }
+}
+
+#ifdef JSON_INDEX_X86
+
+// '[' and ']' are '{' and '}' without 0x20, '(' and ')' differ in the low bit
+JSON_TARGET("sse2")
+void classifySSE2(uint8 const* data, Block& block) {
+  __m128i const lower = _mm_set1_epi8(0x20);
+  __m128i const paren = _mm_set1_epi8(char(0xFE));
+  memset(&block, 0, sizeof block);
+  for (int i = 0; i < 4; ++i) {
+    __m128i v = _mm_loadu_si128((__m128i const*) (data + 16 * i));
+    __m128i lv = _mm_or_si128(v, lower);
+    __m128i space = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+      _mm_cmpeq_epi8(_mm_max_epu8(_mm_sub_epi8(v, _mm_set1_epi8('\t')), _mm_set1_epi8(4)), _mm_set1_epi8(4)));
+    __m128i structural = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(lv, _mm_set1_epi8('{')), _mm_cmpeq_epi8(lv, _mm_set1_epi8('}'))),
+      _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')), _mm_cmpeq_epi8(v, _mm_set1_epi8(','))),
+        _mm_cmpeq_epi8(_mm_and_si128(v, paren), _mm_set1_epi8('('))));
+    int shift = 16 * i;
+    block.quote |= uint64(uint32(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))))) << shift;
+    block.squote |= uint64(uint32(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\''))))) << shift;
+    block.backslash |= uint64(uint32(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))))) << shift;
+    block.slash |= uint64(uint32(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('/'))))) << shift;
+    block.space |= uint64(uint32(_mm_movemask_epi8(space))) << shift;
+    block.structural |= uint64(uint32(_mm_movemask_epi8(structural))) << shift;
+  }
+}
+
+JSON_TARGET("avx2")
+void classifyAVX2(uint8 const* data, Block& block) {
+  __m256i const lower = _mm256_set1_epi8(0x20);
+  __m256i const paren = _mm256_set1_epi8(char(0xFE));
+  memset(&block, 0, sizeof block);
+  for (int i = 0; i < 2; ++i) {
+    __m256i v = _mm256_loadu_si256((__m256i const*) (data + 32 * i));
+    __m256i lv = _mm256_or_si256(v, lower);
+    __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+      _mm256_cmpeq_epi8(_mm256_max_epu8(_mm256_sub_epi8(v, _mm256_set1_epi8('\t')), _mm256_set1_epi8(4)), _mm256_set1_epi8(4)));
+    __m256i structural = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(lv, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(lv, _mm256_set1_epi8('}'))),
+      _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))),
+        _mm256_cmpeq_epi8(_mm256_and_si256(v, paren), _mm256_set1_epi8('('))));
+    int shift = 32 * i;
+    block.quote |= uint64(uint32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))))) << shift;
+    block.squote |= uint64(uint32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\''))))) << shift;
+    block.backslash |= uint64(uint32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))))) << shift;
+    block.slash |= uint64(uint32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('/'))))) << shift;
+    block.space |= uint64(uint32(_mm256_movemask_epi8(space))) << shift;
+    block.structural |= uint64(uint32(_mm256_movemask_epi8(structural))) << shift;
+  }
+}
+
+bool cpuHas(char const* isa) {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  int maxLeaf = info[0];
+  __cpuid(info, 1);
+  if (!strcmp(isa, "sse2")) {
+    return (info[3] & (1 << 26)) != 0;
+  }
+  // AVX2 also needs the OS to save the upper halves of the registers
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  if (maxLeaf < 7 || !osxsave || (_xgetbv(0) & 6) != 6) {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return (!strcmp(isa, "sse2") ? __builtin_cpu_supports("sse2") : __builtin_cpu_supports("avx2")) != 0;
+#endif
+}
+
+#endif
+
+Classifier pickClassifier() {
+#ifdef JSON_INDEX_X86
+  if (cpuHas("avx2")) return classifyAVX2;
+  if (cpuHas("sse2")) return classifySSE2;
+#endif
+  return classifyScalar;
+}
+
+Classifier const classify = pickClassifier();
+
+inline int lowestBit(uint64 x) {
+#ifdef _MSC_VER
+  unsigned long index;
+#ifdef _M_X64
+  _BitScanForward64(&index, x);
+#else
+  if (!_BitScanForward(&index, uint32(x))) {
+    _BitScanForward(&index, uint32(x >> 32));
+    index += 32;
+  }
+#endif
+  return index;
+#else
+  return __builtin_ctzll(x);
+#endif
+}
+
+// Characters that follow an odd number of backslashes. A run that starts on
+// an odd bit and has odd length overflows the add into the next even bit, so
+// odd runs end up marked in the inverted positions (as in simdjson).
+inline uint64 findEscaped(uint64 backslash, uint64& carry) {
+  uint64 const even = 0x5555555555555555ULL;
+  backslash &= ~carry;
+  uint64 follows = (backslash << 1) | carry;
+  uint64 oddStarts = backslash & ~even & ~follows;
+  uint64 evenSequences = oddStarts + backslash;
+  carry = (evenSequences < oddStarts ? 1 : 0);
+  return (even ^ (evenSequences << 1)) & follows;
+}
+
+// bit i is the parity of bits 0..i: set from an opening quote up to the
+// character before its closing quote
+inline uint64 prefixXor(uint64 x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+}
+
+uint8 const* StructuralIndex::build(uint8 const* data, size_t size, bool strict) {
+  base_ = data;
+  count_ = next_ = 0;
+  if (positions_.size() < size + 64) {
+    positions_.resize(size + 64);
+  }
+  uint32* out = positions_.data();
+
+  uint64 escapedCarry = 0;
+  uint64 stringCarry = 0;
+  uint64 boundaryCarry = 1;  // starts between tokens
+  uint8 padded[64];
+  Block block;
+  size_t offset;
+  for (offset = 0; offset < size; offset += 64) {
+    uint8 const* chunk = data + offset;
+    if (size - offset < 64) {
+      memset(padded, ' ', sizeof padded);
+      memcpy(padded, chunk, size - offset);
+      chunk = padded;
+    }
+    classify(chunk, block);
+
+    uint64 escaped = findEscaped(block.backslash, escapedCarry);
+    uint64 quote = block.quote & ~escaped;
+    uint64 inString = prefixXor(quote) ^ stringCarry;
+    stringCarry = uint64(int64(inString) >> 63);
+
+    uint64 structural = block.structural & ~inString;
+    uint64 boundary = block.space | structural | quote;
+    uint64 other = ~(block.space | block.structural | quote | inString);
+    uint64 atoms = other & ((boundary << 1) | boundaryCarry);
+    boundaryCarry = boundary >> 63;
+    uint64 escapes = block.backslash & ~escaped & inString;
+
+    uint64 bits = structural | quote | escapes | atoms;
+    uint64 stops = (block.slash | (strict ? 0 : block.squote)) & ~inString;
+    size_t stop = 0;
+    if (stops) {
+      stop = lowestBit(stops);
+      bits &= (uint64(1) << stop) - 1;
+    }
+    while (bits) {
+      *out++ = uint32(offset + lowestBit(bits));
+      bits &= bits - 1;
+    }
+    if (stops) {
+      count_ = out - positions_.data();
+      end_ = data + offset + stop;
+      return end_;
+    }
+  }
+  count_ = out - positions_.data();
+  end_ = data + size;
+  return end_;
+}
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "common.h"
+#include <vector>
+
+namespace json {
+
+// First stage of parsing: classifies the text 64 bytes at a time (with AVX2
+// or SSE2 when the CPU has them) and lists the positions the tokenizer has to
+// look at. Those are the structural characters {}[]:,(), the quotes around
+// strings, the backslashes that start escape sequences inside strings, and
+// the first character of every other token. Escaped characters and the inside
+// of strings are worked out with bit operations on the masks of a block, so
+// everything in between can be skipped without looking at it.
+//
+// Comments and single-quoted strings (non-strict mode) can not be followed
+// that way; indexing stops right before a '/' or '\'' outside of strings and
+// the tokenizer reads on by itself from there.
+class StructuralIndex {
+public:
+  StructuralIndex()
+    : base_(nullptr)
+    , end_(nullptr)
+    , count_(0)
+    , next_(0)
+  {}
+
+  // Indexes at most size bytes, starting outside of any string, and returns
+  // the end of the indexed part. Positions are 32-bit, so callers index large
+  // inputs a window at a time.
+  uint8 const* build(uint8 const* data, size_t size, bool strict);
+  void clear() {
+    base_ = end_ = nullptr;
+    count_ = next_ = 0;
+  }
+
+  bool covers(uint8 const* pos) const {
+    return pos >= base_ && pos < end_;
+  }
+  // The first listed position at or after pos, or the end of the indexed part.
+  // Calls must not go backwards.
+  uint8 const* next(uint8 const* pos) {
+    size_t offset = pos - base_;
+    while (next_ < count_ && positions_[next_] < offset) {
+      ++next_;
+    }
+    return (next_ < count_ ? base_ + positions_[next_] : end_);
+  }
+
+private:
+  uint8 const* base_;
+  uint8 const* end_;
+  std::vector<uint32> positions_;
+  size_t count_;
+  size_t next_;
+};
+
+}
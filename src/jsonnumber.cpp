@@ -0,0 +1,298 @@
+#include "jsonnumber.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// The fast path needs double arithmetic without x87 extended precision.
+#if (defined(_M_IX86) && (!defined(_M_IX86_FP) || _M_IX86_FP < 2)) || (defined(__i386__) && !defined(__SSE2_MATH__))
+#define JSON_NO_EXACT_PATH
+#endif
+
+namespace json {
+
+namespace {
+
+enum {
+  SmallestPower = -342,   // anything below rounds to zero
+  LargestPower = 308,     // anything above is infinite
+  MantissaBits = 52,
+  MinimumExponent = -1023,
+  InfinitePower = 0x7FF,
+};
+
+// Every power of ten up to 10^22 is exact as a double.
+double const exactPowers[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// Little-endian 32-bit words; only used to build the table.
+typedef std::vector<uint32> BigInt;
+
+size_t bitLength(BigInt const& x) {
+  size_t n = x.size();
+  while (n && !x[n - 1]) --n;
+  if (!n) return 0;
+  size_t bits = 0;
+  for (uint32 top = x[n - 1]; top; top >>= 1) ++bits;
+  return (n - 1) * 32 + bits;
+}
+void multiply(BigInt& x, uint32 m) {
+  uint64 carry = 0;
+  for (size_t i = 0; i < x.size(); ++i) {
+    uint64 v = uint64(x[i]) * m + carry;
+    x[i] = uint32(v);
+    carry = v >> 32;
+  }
+  if (carry) x.push_back(uint32(carry));
+}
+void divide(BigInt& x, uint32 d) {
+  uint64 rem = 0;
+  for (size_t i = x.size(); i--;) {
+    uint64 v = (rem << 32) | x[i];
+    x[i] = uint32(v / d);
+    rem = v % d;
+  }
+}
+void increment(BigInt& x) {
+  for (size_t i = 0; i < x.size(); ++i) {
+    if (++x[i]) return;
+  }
+  x.push_back(1);
+}
+// bits [shift, shift + 64) of x; bits below zero are zero
+uint64 bitsAt(BigInt const& x, ptrdiff_t shift) {
+  uint64 res = 0;
+  for (int i = 0; i < 64; ++i) {
+    ptrdiff_t bit = shift + i;
+    if (bit >= 0 && size_t(bit / 32) < x.size() && ((x[bit / 32] >> (bit % 32)) & 1)) {
+      res |= uint64(1) << i;
+    }
+  }
+  return res;
+}
+BigInt shiftRight(BigInt const& x, size_t shift) {
+  BigInt res((x.size() * 32 + 31 - shift) / 32 + 1, 0);
+  for (size_t i = 0; i < res.size(); ++i) {
+    res[i] = uint32(bitsAt(x, ptrdiff_t(shift + i * 32)));
+  }
+  return res;
+}
+
+// For every q in [SmallestPower, LargestPower], the top 128 bits of 5^q as
+// a high and a low word: truncated for q >= 0, and one more than the
+// truncated reciprocal for q < 0 (the same table as fast_float).
+struct PowerTable {
+  uint64 data[2 * (LargestPower - SmallestPower + 1)];
+
+  PowerTable() {
+    size_t const K = 1760;  // more than twice the bits of 5^342, plus 128
+    BigInt power(1, 1);     // 5^n
+    BigInt inverse(K / 32 + 1, 0);  // floor(2^K / 5^n)
+    inverse[K / 32] = uint32(1) << (K % 32);
+    set(0, power);
+    for (int n = 1; n <= -SmallestPower; ++n) {
+      multiply(power, 5);
+      divide(inverse, 5);
+      if (n <= LargestPower) set(n, power);
+      size_t z = bitLength(power);
+      size_t b = (n <= 27 ? z + 127 : 2 * z + 128);
+      BigInt c = shiftRight(inverse, K - b);
+      increment(c);
+      set(-n, c);
+    }
+  }
+  void set(int q, BigInt const& x) {
+    ptrdiff_t shift = ptrdiff_t(bitLength(x)) - 128;
+    data[2 * (q - SmallestPower)] = bitsAt(x, shift + 64);
+    data[2 * (q - SmallestPower) + 1] = bitsAt(x, shift);
+  }
+};
+
+PowerTable const powers;
+
+inline uint64 fullMultiply(uint64 a, uint64 b, uint64& low) {
+  uint64 aLo = uint32(a), aHi = a >> 32;
+  uint64 bLo = uint32(b), bHi = b >> 32;
+  uint64 p0 = aLo * bLo;
+  uint64 p1 = aLo * bHi;
+  uint64 p2 = aHi * bLo;
+  uint64 p3 = aHi * bHi;
+  uint64 mid = (p0 >> 32) + uint32(p1) + uint32(p2);
+  low = (mid << 32) | uint32(p0);
+  return p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+}
+
+inline int leadingZeros(uint64 x) {
+#ifdef _MSC_VER
+  unsigned long index;
+#ifdef _M_X64
+  _BitScanReverse64(&index, x);
+#else
+  if (_BitScanReverse(&index, uint32(x >> 32))) {
+    index += 32;
+  } else {
+    _BitScanReverse(&index, uint32(x));
+  }
+#endif
+  return 63 - int(index);
+#else
+  return __builtin_clzll(x);
+#endif
+}
+
+}
+
+double decimalToDouble(uint64 w, int64 q, bool negative) {
+  double result;
+#ifndef JSON_NO_EXACT_PATH
+  if (w <= (uint64(1) << 53) && q >= -22 && q <= 22) {
+    result = double(w);
+    if (q < 0) {
+      result /= exactPowers[-q];
+    } else {
+      result *= exactPowers[q];
+    }
+    return (negative ? -result : result);
+  }
+#endif
+
+  uint64 bits;
+  if (w == 0 || q < SmallestPower) {
+    bits = 0;
+  } else if (q > LargestPower) {
+    bits = uint64(InfinitePower) << MantissaBits;
+  } else {
+    int lz = leadingZeros(w);
+    w <<= lz;
+    size_t index = 2 * size_t(q - SmallestPower);
+    uint64 low;
+    uint64 high = fullMultiply(w, powers.data[index], low);
+    if ((high & 0x1FF) == 0x1FF) {
+      // the truncated product may be off in the bits that decide rounding
+      uint64 secondLow;
+      uint64 secondHigh = fullMultiply(w, powers.data[index + 1], secondLow);
+      low += secondHigh;
+      if (secondHigh > low) ++high;
+    }
+    int upperbit = int(high >> 63);
+    int shift = upperbit + 64 - MantissaBits - 3;
+    uint64 mantissa = high >> shift;
+    int power2 = int((((152170 + 65536) * int(q)) >> 16) + 63 + upperbit - lz - MinimumExponent);
+    if (power2 <= 0) {
+      // subnormal, unless rounding carries it up to the smallest normal
+      if (-power2 + 1 >= 64) {
+        mantissa = 0;
+        power2 = 0;
+      } else {
+        mantissa >>= -power2 + 1;
+        mantissa += (mantissa & 1);
+        mantissa >>= 1;
+        power2 = (mantissa < (uint64(1) << MantissaBits) ? 0 : 1);
+      }
+    } else {
+      // exactly halfway between two doubles: round to even
+      if (low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 && (mantissa << shift) == high) {
+        mantissa &= ~uint64(1);
+      }
+      mantissa += (mantissa & 1);
+      mantissa >>= 1;
+      if (mantissa >= (uint64(2) << MantissaBits)) {
+        mantissa = uint64(1) << MantissaBits;
+        ++power2;
+      }
+      mantissa &= ~(uint64(1) << MantissaBits);
+      if (power2 >= InfinitePower) {
+        power2 = InfinitePower;
+        mantissa = 0;
+      }
+    }
+    bits = mantissa | (uint64(power2) << MantissaBits);
+  }
+  if (negative) bits |= uint64(1) << 63;
+  memcpy(&result, &bits, sizeof result);
+  return result;
+}
+
+bool DecimalNumber::toInteger(sint64& value) const {
+  if (isFloat || truncated) return false;
+  if (mantissa > (negative ? uint64(1) << 63 : (uint64(1) << 63) - 1)) return false;
+  value = (negative ? sint64(0 - mantissa) : sint64(mantissa));
+  return true;
+}
+
+double DecimalNumber::toDouble(char const* text) const {
+  if (truncated) return strtod(text, nullptr);
+  return decimalToDouble(mantissa, exponent, negative);
+}
+
+uint8 const* scanNumber(uint8 const* p, uint8 const* end, bool strict, DecimalNumber& number) {
+  number.mantissa = 0;
+  number.exponent = 0;
+  number.negative = false;
+  number.isFloat = false;
+  number.truncated = false;
+  number.invalid = false;
+  int significant = 0;
+  if (p < end && (*p == '-' || (!strict && *p == '+'))) {
+    number.negative = (*p++ == '-');
+  }
+  if (p < end && *p == '0') {
+    ++p;
+  } else if (p < end && *p >= '1' && *p <= '9') {
+    for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+      if (significant < 19) {
+        number.mantissa = number.mantissa * 10 + (*p - '0');
+        ++significant;
+      } else {
+        number.truncated = true;
+      }
+    }
+  } else if (strict || p >= end || *p != '.') {
+    number.invalid = true;
+    return p;
+  }
+  if (p < end && *p == '.') {
+    number.isFloat = true;
+    ++p;
+    if (strict && (p >= end || *p < '0' || *p > '9')) {
+      number.invalid = true;
+      return p;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+      if (significant < 19) {
+        if (number.mantissa || *p != '0') {
+          number.mantissa = number.mantissa * 10 + (*p - '0');
+          ++significant;
+        }
+        --number.exponent;
+      } else {
+        number.truncated = true;
+      }
+    }
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    number.isFloat = true;
+    ++p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+      negative = (*p++ == '-');
+    }
+    if (p >= end || *p < '0' || *p > '9') {
+      number.invalid = true;
+      return p;
+    }
+    int64 exp = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+      if (exp < 100000) exp = exp * 10 + (*p - '0');
+    }
+    number.exponent += (negative ? -exp : exp);
+  }
+  return p;
+}
+
+}
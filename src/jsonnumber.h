@@ -0,0 +1,35 @@
+#pragma once
+
+#include "types.h"
+
+namespace json {
+
+// Correctly rounded conversion of mantissa * 10^exponent to the nearest
+// double, for a mantissa of at most 19 decimal digits (longer ones have to go
+// through strtod). Small cases are exact in double arithmetic (Clinger's fast
+// path), the rest go through the Eisel-Lemire algorithm with a 128-bit table
+// of powers of five.
+double decimalToDouble(uint64 mantissa, int64 exponent, bool negative);
+
+// A number as it is written: the first 19 significant digits and a power of
+// ten to scale them by.
+struct DecimalNumber {
+  uint64 mantissa;
+  int64 exponent;
+  bool negative;
+  bool isFloat;     // has a fraction or an exponent
+  bool truncated;   // had more digits than the mantissa holds
+  bool invalid;
+
+  // The value, if it is written as an integer that fits in 64 bits.
+  bool toInteger(sint64& value) const;
+  // Truncated numbers are read again from text with strtod.
+  double toDouble(char const* text) const;
+};
+
+// Reads the number at pos, stopping at end. Unless strict, a leading '+' and
+// numbers that start or end with '.' are accepted. Returns the end of the
+// number, or where it went wrong if it is invalid.
+uint8 const* scanNumber(uint8 const* pos, uint8 const* end, bool strict, DecimalNumber& number);
+
+}
@@ -0,0 +1,227 @@
+#include "jsonpath.h"
+
+namespace json {
+
+bool Path::compile(std::string const& query) {
+  steps_.clear();
+  if (query.empty() || query[0] != '$') return false;
+  size_t pos = 1, size = query.size();
+  while (pos < size) {
+    Step step;
+    step.kind = kName;
+    step.index = 0;
+    bool ok = true;
+    if (query[pos] == '.') {
+      ++pos;
+      if (pos < size && query[pos] == '*') {
+        step.kind = kAny;
+        ++pos;
+      } else {
+        size_t start = pos;
+        while (pos < size && query[pos] != '.' && query[pos] != '[') ++pos;
+        step.name = query.substr(start, pos - start);
+        ok = (pos > start);
+      }
+    } else if (query[pos] == '[') {
+      ++pos;
+      if (pos < size && query[pos] == '*') {
+        step.kind = kAny;
+        ++pos;
+      } else if (pos < size && (query[pos] == '\'' || query[pos] == '"')) {
+        char quote = query[pos++];
+        while (pos < size && query[pos] != quote) {
+          if (query[pos] == '\\' && pos + 1 < size) ++pos;
+          step.name.push_back(query[pos++]);
+        }
+        ok = (pos < size);
+        ++pos;
+      } else {
+        size_t start = pos;
+        uint64 index = 0;
+        while (pos < size && query[pos] >= '0' && query[pos] <= '9' && index <= 0xFFFFFFFFULL) {
+          index = index * 10 + (query[pos++] - '0');
+        }
+        step.kind = kIndex;
+        step.index = static_cast<uint32>(index);
+        ok = (pos > start && index <= 0xFFFFFFFFULL);
+      }
+      ok = ok && pos < size && query[pos] == ']';
+      ++pos;
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      steps_.clear();
+      return false;
+    }
+    steps_.push_back(step);
+  }
+  return true;
+}
+
+struct PathVisitor::ValueSink {
+  Value value;
+  BuilderVisitor builder;
+  Callback callback;
+  explicit ValueSink(Callback const& callback)
+    : builder(value)
+    , callback(callback)
+  {}
+};
+
+PathVisitor::PathVisitor(bool throwExceptions)
+  : Visitor(throwExceptions)
+  , live_(0)
+  , next_(0)
+  , pending_(false)
+{}
+PathVisitor::~PathVisitor() {}
+
+void PathVisitor::add(Path const& path, Callback const& callback) {
+  sinks_.emplace_back(new ValueSink(callback));
+  ValueSink* sink = sinks_.back().get();
+  add(path, &sink->builder, [sink]() {
+    bool res = sink->callback(sink->value);
+    sink->builder.reset();
+    return res;
+  });
+}
+void PathVisitor::add(Path const& path, Visitor* target, Done const& done) {
+  if (queries_.size() >= 32) throw Exception("too many paths for one visitor");
+  Query query;
+  query.path = path;
+  query.target = target;
+  query.done = done;
+  queries_.push_back(query);
+}
+
+// paths that lead to the value that comes next
+uint32 PathVisitor::select() const {
+  if (frames_.empty()) {
+    return (queries_.size() >= 32 ? 0xFFFFFFFF : (1U << queries_.size()) - 1);
+  }
+  Frame const& frame = frames_.back();
+  size_t depth = frames_.size() - 1;
+  uint32 live = 0;
+  for (uint32 q = 0, mask = frame.live; mask; ++q, mask >>= 1) {
+    if (!(mask & 1)) continue;
+    Path::Step const& step = queries_[q].path.steps_[depth];
+    if (step.kind == Path::kAny ||
+        (frame.object ? step.kind == Path::kName && step.name == key_
+                      : step.kind == Path::kIndex && step.index == frame.index)) {
+      live |= 1U << q;
+    }
+  }
+  return live;
+}
+
+void PathVisitor::enter() {
+  live_ = (pending_ ? next_ : select());
+  pending_ = false;
+  if (!frames_.empty() && !frames_.back().object) ++frames_.back().index;
+  size_t depth = frames_.size();
+  for (uint32 q = 0, mask = live_; mask; ++q, mask >>= 1) {
+    if ((mask & 1) && queries_[q].path.length() == depth) {
+      Capture capture;
+      capture.depth = depth;
+      capture.query = q;
+      captures_.push_back(capture);
+    }
+  }
+}
+
+// finishes the matches of the value that just ended, in the order of the paths
+bool PathVisitor::leave() {
+  size_t depth = frames_.size();
+  size_t first = captures_.size();
+  while (first && captures_[first - 1].depth == depth) --first;
+  bool res = true;
+  for (size_t i = first; i < captures_.size() && res; ++i) {
+    res = queries_[captures_[i].query].done();
+  }
+  captures_.resize(first);
+  return res;
+}
+
+void PathVisitor::open(bool object) {
+  Frame frame;
+  frame.object = object;
+  frame.index = 0;
+  frame.live = 0;
+  size_t depth = frames_.size();
+  for (uint32 q = 0, mask = live_; mask; ++q, mask >>= 1) {
+    if ((mask & 1) && queries_[q].path.length() > depth) frame.live |= 1U << q;
+  }
+  frames_.push_back(frame);
+}
+
+template<class F>
+bool PathVisitor::forward(F const& event) {
+  for (size_t i = 0; i < captures_.size(); ++i) {
+    if (!event(queries_[captures_[i].query].target)) return false;
+  }
+  return true;
+}
+
+bool PathVisitor::skipValue() {
+  if (frames_.empty() || !captures_.empty()) return false;
+  next_ = select();
+  if (next_) {
+    pending_ = true;
+    return false;
+  }
+  if (!frames_.back().object) ++frames_.back().index;
+  return true;
+}
+
+bool PathVisitor::onNull() {
+  enter();
+  return forward([](Visitor* target) { return target->onNull(); }) && leave();
+}
+bool PathVisitor::onBoolean(bool val) {
+  enter();
+  return forward([val](Visitor* target) { return target->onBoolean(val); }) && leave();
+}
+bool PathVisitor::onInteger(int val) {
+  enter();
+  return forward([val](Visitor* target) { return target->onInteger(val); }) && leave();
+}
+bool PathVisitor::onNumber(double val) {
+  enter();
+  return forward([val](Visitor* target) { return target->onNumber(val); }) && leave();
+}
+bool PathVisitor::onInteger64(sint64 val) {
+  enter();
+  return forward([val](Visitor* target) { return target->onInteger64(val); }) && leave();
+}
+bool PathVisitor::onString(std::string const& val) {
+  enter();
+  return forward([&val](Visitor* target) { return target->onString(val); }) && leave();
+}
+bool PathVisitor::onOpenMap() {
+  enter();
+  open(true);
+  return forward([](Visitor* target) { return target->onOpenMap(); });
+}
+bool PathVisitor::onMapKey(std::string const& key) {
+  pending_ = false;
+  if (!frames_.empty() && frames_.back().live) key_ = key;
+  return forward([&key](Visitor* target) { return target->onMapKey(key); });
+}
+bool PathVisitor::onCloseMap() {
+  pending_ = false;
+  frames_.pop_back();
+  return forward([](Visitor* target) { return target->onCloseMap(); }) && leave();
+}
+bool PathVisitor::onOpenArray() {
+  enter();
+  open(false);
+  return forward([](Visitor* target) { return target->onOpenArray(); });
+}
+bool PathVisitor::onCloseArray() {
+  pending_ = false;
+  frames_.pop_back();
+  return forward([](Visitor* target) { return target->onCloseArray(); }) && leave();
+}
+
+}
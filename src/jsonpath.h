@@ -0,0 +1,115 @@
+#pragma once
+
+#include "json.h"
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace json {
+
+// A compiled path query: "$" for the root, followed by any number of steps
+//   .name  ['name']  ["name"]   a member of an object
+//   [n]                         an item of an array
+//   .*  [*]                     every member or item
+// Paths only go down one level per step; there is no recursive descent.
+class Path {
+public:
+  Path() {}
+
+  // Returns false and leaves the path empty if the query is malformed.
+  bool compile(std::string const& query);
+
+  // number of steps, which is the depth of the values it matches
+  size_t length() const {
+    return steps_.size();
+  }
+  // True if the first step takes every item, so that the path matches the
+  // same values in any run of the items of an array (see parseArray).
+  bool anyItem() const {
+    return !steps_.empty() && steps_[0].kind == kAny;
+  }
+
+private:
+  friend class PathVisitor;
+  enum Kind { kName, kIndex, kAny };
+  struct Step {
+    Kind kind;
+    std::string name;
+    uint32 index;
+  };
+  std::vector<Step> steps_;
+};
+
+// Streams the values matched by a set of paths out of the events of parse().
+// Values that no path can lead into are skipped by the parser without being
+// decoded (see Visitor::skipValue), so the cost of everything else in the
+// document is close to scanning it. When driven by walk() they still go by,
+// but nothing is done with them.
+//
+// A visitor holds at most 32 paths. Matches are reported when their value
+// ends; a callback that returns false stops the parse.
+class PathVisitor : public Visitor {
+public:
+  typedef std::function<bool(Value const& value)> Callback;
+  typedef std::function<bool()> Done;
+
+  explicit PathVisitor(bool throwExceptions = false);
+  ~PathVisitor();
+
+  // Every match is built into a Value and passed to the callback.
+  void add(Path const& path, Callback const& callback);
+  // Every match is sent to target as it is read, then done is called.
+  void add(Path const& path, Visitor* target, Done const& done);
+
+  bool skipValue();
+
+  bool onNull();
+  bool onBoolean(bool val);
+  bool onInteger(int val);
+  bool onNumber(double val);
+  bool onInteger64(sint64 val);
+  bool onString(std::string const& val);
+  bool onOpenMap();
+  bool onMapKey(std::string const& key);
+  bool onCloseMap();
+  bool onOpenArray();
+  bool onCloseArray();
+
+private:
+  struct Query {
+    Path path;
+    Visitor* target;
+    Done done;
+  };
+  struct ValueSink;
+  struct Frame {
+    bool object;
+    uint32 index;   // of the next item of an array
+    uint32 live;    // paths that go on into the children
+  };
+  struct Capture {
+    size_t depth;
+    uint32 query;
+  };
+  std::vector<Query> queries_;
+  std::vector<std::unique_ptr<ValueSink>> sinks_;
+  std::vector<Frame> frames_;
+  std::vector<Capture> captures_;
+  std::string key_;
+  uint32 live_;       // paths that lead to the current value
+  uint32 next_;       // the same for the next value, if skipValue() was asked
+  bool pending_;
+
+  uint32 select() const;
+  void enter();
+  bool leave();
+  void open(bool object);
+  bool close();
+  template<class F>
+  bool forward(F const& event);
+
+  PathVisitor(PathVisitor const&) = delete;
+  PathVisitor& operator=(PathVisitor const&) = delete;
+};
+
+}
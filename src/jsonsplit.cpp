@@ -0,0 +1,244 @@
+#include "jsonsplit.h"
+#include "jsonindex.h"
+#include "queue.h"
+#include "trace.h"
+#include <algorithm>
+#include <deque>
+
+namespace json {
+
+namespace {
+
+enum {
+  Window = 1 << 20,
+  MinRunSize = 1 << 16,
+  MaxRunSize = 1 << 24,
+};
+
+struct RunJob {
+  size_t index;
+  uint8 const* data;
+  size_t size;
+  Visitor* visitor;
+  // the rest of an array that is not closed
+  bool unclosed;
+};
+
+bool parseRun(RunJob const& job) {
+  File run = File::memfile(job.data, job.size);
+  if (!parseItems(run, job.visitor)) return false;
+  if (!job.unclosed) return true;
+  // the items are fine, but the ']' after them is missing
+  uint32 line = 0;
+  size_t lineStart = 0;
+  for (size_t i = 0; i < job.size; ++i) {
+    if (job.data[i] == '\n') ++line;
+    if (job.data[i] == '\r' || job.data[i] == '\n') lineStart = i;
+  }
+  job.visitor->onError(line, static_cast<uint32>(job.size - lineStart), "']' or ',' expected");
+  return false;
+}
+
+}
+
+size_t splitArray(uint8 const* data, size_t size, size_t runSize,
+                  std::function<bool(ArrayRun const& run)> const& callback) {
+  size_t pos = 0;
+  while (pos < size && (data[pos] == ' ' || (data[pos] >= '\t' && data[pos] <= '\r'))) ++pos;
+  if (pos >= size || data[pos] != '[') return 0;
+  ArrayRun run;
+  run.begin = ++pos;
+  size_t depth = 1;
+  // whether anything came after the last comma, and if there was one; an
+  // empty item at the edge of a run would not be noticed by its parser
+  bool item = false, comma = false;
+  size_t window = Window;
+  StructuralIndex index;
+  while (pos < size) {
+    uint8 const* base = data + pos;
+    size_t length = std::min(window, size - pos);
+    uint8 const* end = index.build(base, length, true);
+    // right after the last bracket or comma, where the next window can start
+    size_t resume = pos;
+    for (uint8 const* ptr = index.next(base); ptr < end; ptr = index.next(ptr + 1)) {
+      switch (*ptr) {
+      case '[':
+      case '{':
+        ++depth;
+        item = true;
+        break;
+      case ']':
+      case '}':
+        if (--depth == 0) {
+          if (*ptr != ']' || (comma && !item)) return 0;
+          run.end = ptr - data;
+          return callback(run) ? run.end + 1 : 0;
+        }
+        break;
+      case ',':
+        if (depth > 1) break;
+        if (!item) return 0;
+        if (size_t(ptr - data) - run.begin >= runSize) {
+          run.end = ptr - data;
+          if (!callback(run)) return 0;
+          run.begin = run.end + 1;
+        }
+        item = false;
+        comma = true;
+        break;
+      default:
+        // quotes, escapes and the first characters of other tokens
+        item = true;
+        continue;
+      }
+      resume = ptr + 1 - data;
+    }
+    // stopped at a '/', or the array goes on past the end
+    if (end < base + length || pos + length == size) return 0;
+    // a string longer than the window needs a larger one
+    if (resume > pos) {
+      pos = resume;
+    } else {
+      window *= 2;
+    }
+  }
+  return 0;
+}
+
+bool parseArray(File& file, int threads, RunStart const& start, RunDone const& done) {
+  TRACE_SPAN("json::parseArray");
+  uint64 origin = file.tell();
+  size_t size;
+  uint8 const* data = file.contiguous(size);
+  if (!data || threads < 2) {
+    bool ok = parse(file, start(0));
+    return done(0) && ok;
+  }
+
+  enum { rParsing, rParsed, rFailed, rSkipped };
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::vector<char> states;   // of every run
+  // runs after the first one that failed are not parsed; the ones before it
+  // still are, so that the output up to the error does not depend on timing
+  size_t firstFailed = size_t(-1);
+  std::atomic<bool> failed(false);
+  BlockingQueue<RunJob> queue(threads * 2);
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back([&]() {
+      RunJob job;
+      while (queue.pop(job)) {
+        bool skip;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          skip = (job.index > firstFailed);
+        }
+        char state = (skip ? rSkipped : parseRun(job) ? rParsed : rFailed);
+        std::lock_guard<std::mutex> lock(mutex);
+        states[job.index] = state;
+        if (state == rFailed) {
+          firstFailed = std::min(firstFailed, job.index);
+          failed = true;
+        }
+        changed.notify_all();
+      }
+    });
+  }
+
+  // calls done for the runs that are parsed, in order, up to and including
+  // the first one that failed
+  size_t next = 0;
+  bool stopped = false;
+  auto finish = [&](bool wait) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopped && next < states.size()) {
+      if (states[next] == rParsing) {
+        if (!wait) break;
+        changed.wait(lock);
+        continue;
+      }
+      bool ok = (states[next] == rParsed);
+      lock.unlock();
+      if (!done(next) || !ok) stopped = true;
+      lock.lock();
+      if (stopped) {
+        firstFailed = std::min(firstFailed, next);
+        failed = true;
+      }
+      ++next;
+    }
+  };
+  auto submit = [&](size_t begin, size_t end, bool unclosed) {
+    RunJob job;
+    job.index = states.size();
+    job.data = data + begin;
+    job.size = end - begin;
+    job.visitor = start(job.index);
+    job.unclosed = unclosed;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      states.push_back(rParsing);
+    }
+    queue.push(std::move(job));
+  };
+
+  size_t runSize = std::min<size_t>(std::max<size_t>(size / (threads * 16), MinRunSize), MaxRunSize);
+  size_t rest = 0;
+  size_t end = splitArray(data, size, runSize, [&](ArrayRun const& run) {
+    submit(run.begin, run.end, false);
+    rest = run.end + 1;
+    finish(false);
+    return !failed;
+  });
+  // the runs found so far are fine; the rest of the text has the error
+  if (!end && rest && !failed) submit(rest, size, true);
+  queue.close();
+  if (states.size()) finish(true);
+  for (auto& thread : workers) {
+    thread.join();
+  }
+
+  if (states.empty()) {
+    bool ok = parse(file, start(0));
+    return done(0) && ok;
+  }
+  if (failed || !end) return false;
+  file.seek(origin + end);
+  return true;
+}
+
+bool parseArray(File& file, Value& value, int threads, bool throwExceptions) {
+  struct RunValue {
+    Value value;
+    BuilderVisitor builder;
+    RunValue()
+      : builder(value)
+    {}
+  };
+  uint64 origin = file.tell();
+  std::deque<RunValue> runs;
+  size_t first = 0;
+  value.clear();
+  bool ok = parseArray(file, threads, [&](size_t run) -> Visitor* {
+    runs.emplace_back();
+    return &runs.back().builder;
+  }, [&](size_t run) {
+    Value& items = runs[run - first].value;
+    if (!run) {
+      value = std::move(items);
+    } else {
+      for (uint32 i = 0, count = items.length(); i < count; ++i) {
+        value.append(std::move(*items.at(i)));
+      }
+    }
+    runs.pop_front();
+    ++first;
+    return true;
+  });
+  if (ok) return true;
+  file.seek(origin);
+  return parse(file, value, mJSON, nullptr, throwExceptions);
+}
+
+}
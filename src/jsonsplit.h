@@ -0,0 +1,48 @@
+#pragma once
+
+#include "json.h"
+#include <functional>
+
+namespace json {
+
+// A run of whole items of an array, as offsets into the text: from just after
+// the '[' or ',' before its first item to the ',' or ']' after its last.
+struct ArrayRun {
+  size_t begin;
+  size_t end;
+};
+
+// Finds the items of the array at the start of data (after any whitespace)
+// along a StructuralIndex, and cuts them into runs of at least runSize bytes
+// where the items allow. Runs are passed to the callback as they are found;
+// a callback that returns false stops the search. Only the nesting of
+// brackets is followed, so runs still have to be parsed to know they are
+// valid. Returns the offset right after the closing ']', or 0 if there is no
+// array, it is not closed, there is a '/' outside of strings, or the callback
+// stopped it.
+size_t splitArray(uint8 const* data, size_t size, size_t runSize,
+                  std::function<bool(ArrayRun const& run)> const& callback);
+
+// Parses a file that holds one large array on several threads. The array is
+// split into runs while worker threads parse the runs found so far, each with
+// its own visitor, which sees the items of its run as an array of their own
+// and then onEnd(). start(run) gives the visitor when a run is found, and
+// done(run) is called once the run and all the runs before it are parsed, so
+// results can be merged in order while later runs are still being read. Both
+// are called on the calling thread; visitors must not throw.
+//
+// A run that fails to parse reports the error to its visitor, with lines and
+// columns counted from the start of the run. done() is still called for it,
+// so the items before the error are kept as they would be by parse(), and
+// nothing after it is done.
+// Files that are not in memory, or do not start with an array, are parsed as
+// one run on the calling thread, with errors reported as by parse(). The file
+// is left right after the array.
+typedef std::function<Visitor*(size_t run)> RunStart;
+typedef std::function<bool(size_t run)> RunDone;
+bool parseArray(File& file, int threads, RunStart const& start, RunDone const& done);
+// Errors are found again by parse() on one thread, so they are reported as
+// usual.
+bool parseArray(File& file, Value& value, int threads, bool throwExceptions = false);
+
+}
@@ -0,0 +1,559 @@
+#include "jsontape.h"
+#include "jsonindex.h"
+#include "jsonnumber.h"
+#include "trace.h"
+#include <algorithm>
+#include <string.h>
+
+namespace json {
+
+namespace {
+
+inline bool isSpace(int chr) {
+  return chr == ' ' || (chr >= '\t' && chr <= '\r');
+}
+inline bool isHex(int chr) {
+  return (chr >= '0' && chr <= '9') || (chr >= 'a' && chr <= 'f') || (chr >= 'A' && chr <= 'F');
+}
+inline int hexValue(int chr) {
+  if (chr <= '9') return chr - '0';
+  return (chr | 0x20) - 'a' + 10;
+}
+
+}
+
+// The token loop of parse() in strict mode, except that tokens are only
+// checked and recorded, not decoded.
+class TapeParser {
+  enum { WindowSize = 1 << 16 };
+  enum Token { tEnd, tSymbol, tString, tNumber, tIdentifier, tError };
+  typedef Tape::Entry Entry;
+
+  std::vector<Entry>& entries;
+  uint8 const* begin;
+  uint8 const* pos;
+  uint8 const* end;
+  StructuralIndex index;
+
+  Token token;
+  uint8 const* start;     // of the token, after the quote for strings
+  uint8 const* stop;
+  bool escaped;
+  bool pastEnd;           // a string ran into the end of the text
+  std::string error;
+
+  Token next();
+  uint32 push(uint8 type, uint8 flags);
+  Token fail(char const* reason) {
+    error = reason;
+    return token = tError;
+  }
+public:
+  TapeParser(Tape& tape)
+    : entries(tape.entries_)
+    , begin((uint8 const*) tape.text_.data())
+    , pos(begin)
+    , end(begin + tape.text_.size())
+    , pastEnd(false)
+  {}
+
+  // Returns the length of the text used, or -1 after reporting an error.
+  int64 run(Visitor& reporter);
+};
+
+TapeParser::Token TapeParser::next() {
+  if (!index.covers(pos) && pos < end) {
+    index.build(pos, std::min<size_t>(end - pos, WindowSize), true);
+  }
+  while (pos < end && isSpace(*pos)) {
+    if (index.covers(pos)) {
+      pos = index.next(pos);
+    } else {
+      while (pos < end && isSpace(*pos)) ++pos;
+    }
+  }
+  start = pos;
+  if (pos >= end) {
+    return token = tEnd;
+  }
+  int chr = *pos;
+  if (chr == '"') {
+    escaped = false;
+    uint8 const* p = start = ++pos;
+    while (true) {
+      if (index.covers(p)) {
+        // only the closing quote and escapes are listed inside a string
+        p = index.next(p);
+        if (!index.covers(p)) continue;
+      } else {
+        while (p < end && *p != '"' && *p != '\\') ++p;
+      }
+      // like the tokenizer, a string can run into the end of the input
+      if (p >= end || *p == '"') break;
+      escaped = true;
+      if (++p >= end) {
+        pos = end;
+        return fail("invalid escape sequence");
+      }
+      switch (*p) {
+      case '\'': case '"': case '\\': case '/':
+      case 'b': case 'f': case 'n': case 'r': case 't':
+        ++p;
+        break;
+      case 'u':
+        ++p;
+        for (int i = 0; i < 4; ++i, ++p) {
+          if (p >= end || !isHex(*p)) {
+            pos = p;
+            return fail("invalid hex digit");
+          }
+        }
+        break;
+      default:
+        pos = p;
+        return fail("invalid escape sequence");
+      }
+    }
+    stop = p;
+    if (p >= end) pastEnd = true;
+    pos = std::min(p + 1, end);
+    return token = tString;
+  } else if (chr == '-' || (chr >= '0' && chr <= '9')) {
+    DecimalNumber number;
+    pos = scanNumber(pos, end, true, number);
+    if (number.invalid) return fail("invalid number");
+    stop = pos;
+    return token = tNumber;
+  } else if (chr == '{' || chr == '}' || chr == '[' || chr == ']' || chr == ':' || chr == ',' || chr == '(' || chr == ')') {
+    stop = ++pos;
+    return token = tSymbol;
+  } else if ((chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z') || chr == '_') {
+    while (pos < end && ((*pos >= 'a' && *pos <= 'z') || (*pos >= 'A' && *pos <= 'Z') || (*pos >= '0' && *pos <= '9') || *pos == '_')) {
+      ++pos;
+    }
+    stop = pos;
+    return token = tIdentifier;
+  } else if (chr == '/') {
+    ++pos;
+    if (pos < end && *pos == '/') {
+      while (pos < end && *pos != '\n') ++pos;
+      return next();
+    } else if (pos < end && *pos == '*') {
+      ++pos;
+      bool star = false;
+      while (pos < end && (!star || *pos != '/')) {
+        star = (*pos++ == '*');
+      }
+      if (pos >= end) return fail("unterminated comment");
+      ++pos;
+      return next();
+    } else {
+      return fail("unexpected symbol '/'");
+    }
+  } else {
+    error = "unexpected symbol '";
+    error.push_back(chr);
+    error.push_back('\'');
+    return token = tError;
+  }
+}
+
+uint32 TapeParser::push(uint8 type, uint8 flags) {
+  Entry entry;
+  entry.type = type;
+  entry.flags = flags;
+  entry.offset = uint32(start - begin);
+  entry.size = uint32(stop - start);
+  entry.next = uint32(entries.size() + 1);
+  entries.push_back(entry);
+  return entry.next - 1;
+}
+
+int64 TapeParser::run(Visitor& reporter) {
+  enum State{sValue, sKey, sColon, sNext, sEnd} state = sValue;
+  std::vector<uint32> stack;
+  bool topEmpty = true;
+  next();
+  while (state != sEnd) {
+    if (token == tError) break;
+    bool advance = true;
+    int symbol = (token == tSymbol ? *start : 0);
+    switch (state) {
+    case sValue:
+      if (token == tNumber) {
+        push(Value::tNumber, 0);
+      } else if (token == tString) {
+        push(Value::tString, escaped);
+      } else if (token == tIdentifier) {
+        StringView name((char const*) start, stop - start);
+        if (name == "null") {
+          push(Value::tNull, 0);
+        } else if (name == "true") {
+          push(Value::tBoolean, 1);
+        } else if (name == "false") {
+          push(Value::tBoolean, 0);
+        } else {
+          error = "unexpected identifier " + name.str();
+          token = tError;
+          break;
+        }
+      } else if (symbol == '{' || symbol == '[') {
+        if (!stack.empty() && entries[stack.back()].type == Value::tArray) {
+          ++entries[stack.back()].size;
+        }
+        stack.push_back(push(symbol == '{' ? Value::tObject : Value::tArray, 0));
+        entries.back().size = 0;
+        topEmpty = true;
+        state = (symbol == '{' ? sKey : sValue);
+        break;
+      } else if (topEmpty && symbol == ']' && !stack.empty() && entries[stack.back()].type == Value::tArray) {
+        state = sNext;
+        advance = false;
+        break;
+      } else {
+        error = (token == tSymbol ? "unexpected symbol '" + std::string(1, char(symbol)) + "'" : "value expected");
+        token = tError;
+        break;
+      }
+      if (!stack.empty() && entries[stack.back()].type == Value::tArray) {
+        ++entries[stack.back()].size;
+      }
+      topEmpty = false;
+      state = (stack.empty() ? sEnd : sNext);
+      advance = !stack.empty();
+      break;
+    case sKey:
+      if (token == tString) {
+        push(Value::tString, escaped);
+        ++entries[stack.back()].size;
+        state = sColon;
+      } else if (topEmpty && symbol == '}') {
+        state = sNext;
+        advance = false;
+      } else {
+        error = "object key expected";
+        token = tError;
+      }
+      break;
+    case sColon:
+      if (symbol == ':') {
+        state = sValue;
+      } else {
+        error = "':' expected";
+        token = tError;
+      }
+      break;
+    case sNext:
+      if (symbol == ',') {
+        state = (entries[stack.back()].type == Value::tObject ? sKey : sValue);
+      } else if (symbol == '}' || symbol == ']') {
+        uint8 type = (symbol == '}' ? Value::tObject : Value::tArray);
+        if (entries[stack.back()].type != type) {
+          error = (symbol == '}' ? "mismatched '}'" : "mismatched ']'");
+          token = tError;
+          break;
+        }
+        entries[stack.back()].next = uint32(entries.size());
+        stack.pop_back();
+        topEmpty = false;
+        if (stack.empty()) {
+          advance = false;
+          state = sEnd;
+        }
+      } else if (token == tSymbol) {
+        error = "unexpected symbol '" + std::string(1, char(symbol)) + "'";
+        token = tError;
+      } else if (entries[stack.back()].type == Value::tObject) {
+        error = "'}' or ',' expected";
+        token = tError;
+      } else {
+        error = "']' or ',' expected";
+        token = tError;
+      }
+      break;
+    default:
+      break;
+    }
+    if (token == tError) break;
+    if (advance) {
+      next();
+    }
+  }
+  if (token != tError) {
+    return pos - begin;
+  }
+
+  // same numbers as Tokenizer::error, including the column it counts for
+  // reading past the end of an unterminated string
+  uint32 line = 0;
+  int64 lineStart = -1;
+  uint8 const* errorEnd = (pos < end ? pos + 1 : end);
+  for (uint8 const* p = begin; p < errorEnd; ++p) {
+    if (*p == '\n') ++line;
+    if (*p == '\r' || *p == '\n') lineStart = p - begin;
+  }
+  int64 at = (pos - begin) + (pastEnd ? 1 : 0);
+  reporter.onError(line, uint32(lineStart >= 0 ? at - lineStart : at), error);
+  return -1;
+}
+
+bool parse(File& file, Tape& tape, bool throwExceptions) {
+  TRACE_SPAN("json::parse");
+  Visitor reporter(throwExceptions);
+  tape.clear();
+  uint64 start = file.tell();
+  size_t size;
+  if (uint8 const* data = file.contiguous(size)) {
+    tape.text_.assign((char const*) data, size);
+  } else {
+    size_t done = 0;
+    while (true) {
+      size_t chunk = std::max<size_t>(done, 1 << 16);
+      tape.text_.resize(done + chunk);
+      size_t count = file.read(&tape.text_[done], chunk);
+      done += count;
+      if (!count) break;
+    }
+    tape.text_.resize(done);
+  }
+  if (uint64(tape.text_.size()) >= (uint64(1) << 32)) {
+    reporter.onError(0, 0, "input too large");
+    tape.clear();
+    return false;
+  }
+
+  int64 used = TapeParser(tape).run(reporter);
+  if (used < 0) {
+    tape.clear();
+    return false;
+  }
+  file.seek(start + used);
+  return true;
+}
+
+void Tape::decode(Entry const& entry, std::string& text) const {
+  char const* p = text_.data() + entry.offset;
+  char const* stop = p + entry.size;
+  if (!entry.flags) {
+    text.assign(p, stop);
+    return;
+  }
+  // escapes were checked by the parser
+  text.clear();
+  while (p < stop) {
+    char const* run = p;
+    while (p < stop && *p != '\\') ++p;
+    text.append(run, p);
+    if (p >= stop) break;
+    switch (p[1]) {
+    case 'b': text.push_back('\b'); break;
+    case 'f': text.push_back('\f'); break;
+    case 'n': text.push_back('\n'); break;
+    case 'r': text.push_back('\r'); break;
+    case 't': text.push_back('\t'); break;
+    case 'u': {
+      uint32 cp = 0;
+      for (int i = 2; i < 6; ++i) {
+        cp = cp * 16 + hexValue(p[i]);
+      }
+      if (cp <= 0x7F) {
+        text.push_back(cp);
+      } else if (cp <= 0x7FF) {
+        text.push_back(0xC0 | ((cp >> 6) & 0x1F));
+        text.push_back(0x80 | (cp & 0x3F));
+      } else {
+        text.push_back(0xE0 | ((cp >> 12) & 0x0F));
+        text.push_back(0x80 | ((cp >> 6) & 0x3F));
+        text.push_back(0x80 | (cp & 0x3F));
+      }
+      p += 4;
+      break;
+    }
+    default: text.push_back(p[1]); break;
+    }
+    p += 2;
+  }
+}
+
+Value::Type Tape::number(Entry const& entry, sint64& integer, double& real) const {
+  uint8 const* text = (uint8 const*) text_.data() + entry.offset;
+  DecimalNumber number;
+  scanNumber(text, text + entry.size, true, number);
+  if (number.toInteger(integer)) {
+    return Value::tInteger;
+  }
+  real = number.toDouble((char const*) text);
+  return Value::tNumber;
+}
+
+bool Tape::walk(uint32 index, Visitor* visitor, std::string& text) const {
+  Entry const& entry = entries_[index];
+  switch (entry.type) {
+  case Value::tNull:
+    return visitor->onNull();
+  case Value::tBoolean:
+    return visitor->onBoolean(entry.flags != 0);
+  case Value::tString:
+    decode(entry, text);
+    return visitor->onString(text);
+  case Value::tNumber: {
+    sint64 integer;
+    double real;
+    if (number(entry, integer, real) == Value::tNumber) {
+      return visitor->onNumber(real);
+    }
+    if (integer >= -0x80000000LL && integer <= 0x7FFFFFFFLL) {
+      return visitor->onInteger(static_cast<int>(integer));
+    }
+    return visitor->onInteger64(integer);
+  }
+  case Value::tObject:
+    if (!visitor->onOpenMap()) return false;
+    for (uint32 i = index + 1; i < entry.next; i = entries_[i + 1].next) {
+      decode(entries_[i], text);
+      if (!visitor->onMapKey(text)) return false;
+      if (!walk(i + 1, visitor, text)) return false;
+    }
+    return visitor->onCloseMap();
+  case Value::tArray:
+    if (!visitor->onOpenArray()) return false;
+    for (uint32 i = index + 1; i < entry.next; i = entries_[i].next) {
+      if (!walk(i, visitor, text)) return false;
+    }
+    return visitor->onCloseArray();
+  default:
+    return false;
+  }
+}
+
+Value::Type TapeValue::type() const {
+  if (!tape_) return Value::tUndefined;
+  Tape::Entry const& entry = tape_->entries_[index_];
+  if (entry.type != Value::tNumber) return static_cast<Value::Type>(entry.type);
+  sint64 integer;
+  double real;
+  return tape_->number(entry, integer, real);
+}
+
+// tBoolean
+bool TapeValue::getBoolean() const {
+  if (!tape_) return false;
+  Tape::Entry const& entry = tape_->entries_[index_];
+  return entry.type == Value::tBoolean && entry.flags;
+}
+
+// tString
+std::string TapeValue::getString() const {
+  std::string text;
+  if (tape_ && tape_->entries_[index_].type == Value::tString) {
+    tape_->decode(tape_->entries_[index_], text);
+  }
+  return text;
+}
+
+// tNumber
+bool TapeValue::isInteger() const {
+  if (!tape_ || tape_->entries_[index_].type != Value::tNumber) return false;
+  sint64 integer;
+  double real;
+  if (tape_->number(tape_->entries_[index_], integer, real) == Value::tInteger) {
+    return integer >= -0x80000000LL && integer <= 0x7FFFFFFFLL;
+  }
+  return (int)real == real;
+}
+int TapeValue::getInteger() const {
+  if (!isInteger()) return 0;
+  return static_cast<int>(getInteger64());
+}
+sint64 TapeValue::getInteger64() const {
+  if (!tape_ || tape_->entries_[index_].type != Value::tNumber) return 0;
+  sint64 integer;
+  double real;
+  if (tape_->number(tape_->entries_[index_], integer, real) == Value::tInteger) {
+    return integer;
+  }
+  if (real >= -9223372036854775808.0 && real < 9223372036854775808.0 && (sint64)real == real) {
+    return static_cast<sint64>(real);
+  }
+  return 0;
+}
+double TapeValue::getNumber() const {
+  if (!tape_ || tape_->entries_[index_].type != Value::tNumber) return 0;
+  sint64 integer;
+  double real;
+  if (tape_->number(tape_->entries_[index_], integer, real) == Value::tInteger) {
+    return static_cast<double>(integer);
+  }
+  return real;
+}
+
+// tObject
+TapeValue TapeValue::get(StringView name) const {
+  if (!tape_ || tape_->entries_[index_].type != Value::tObject) return TapeValue();
+  std::vector<Tape::Entry> const& entries = tape_->entries_;
+  char const* text = tape_->text_.data();
+  std::string key;
+  TapeValue found;
+  for (uint32 i = index_ + 1; i < entries[index_].next; i = entries[i + 1].next) {
+    Tape::Entry const& entry = entries[i];
+    if (entry.flags) {
+      tape_->decode(entry, key);
+      if (StringView(key) == name) found = TapeValue(tape_, i + 1);
+    } else if (entry.size == name.size() && !memcmp(text + entry.offset, name.data(), entry.size)) {
+      found = TapeValue(tape_, i + 1);
+    }
+  }
+  return found;
+}
+
+// tArray
+uint32 TapeValue::length() const {
+  if (!tape_ || tape_->entries_[index_].type != Value::tArray) return 0;
+  return tape_->entries_[index_].size;
+}
+TapeValue TapeValue::operator[](int i) const {
+  if (i < 0 || static_cast<uint32>(i) >= length()) return TapeValue();
+  uint32 index = index_ + 1;
+  while (i--) {
+    index = tape_->entries_[index].next;
+  }
+  return TapeValue(tape_, index);
+}
+
+TapeValue::ConstIterator& TapeValue::ConstIterator::operator++() {
+  index_ = tape_->entries_[object_ ? index_ + 1 : index_].next;
+  return *this;
+}
+TapeValue TapeValue::ConstIterator::operator*() const {
+  return TapeValue(tape_, object_ ? index_ + 1 : index_);
+}
+std::string TapeValue::ConstIterator::key() const {
+  std::string text;
+  tape_->decode(tape_->entries_[index_], text);
+  return text;
+}
+TapeValue::ConstIterator TapeValue::begin() const {
+  Value::Type type = (tape_ ? static_cast<Value::Type>(tape_->entries_[index_].type) : Value::tUndefined);
+  if (type != Value::tObject && type != Value::tArray) return ConstIterator();
+  return ConstIterator(tape_, index_ + 1, type == Value::tObject);
+}
+TapeValue::ConstIterator TapeValue::end() const {
+  Value::Type type = (tape_ ? static_cast<Value::Type>(tape_->entries_[index_].type) : Value::tUndefined);
+  if (type != Value::tObject && type != Value::tArray) return ConstIterator();
+  return ConstIterator(tape_, tape_->entries_[index_].next, type == Value::tObject);
+}
+
+bool TapeValue::walk(Visitor* visitor) const {
+  if (!tape_) return visitor->onNull();
+  std::string text;
+  return tape_->walk(index_, visitor, text);
+}
+
+Value TapeValue::toValue() const {
+  Value res;
+  BuilderVisitor builder(res);
+  walk(&builder);
+  return res;
+}
+
+}
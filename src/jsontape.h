@@ -0,0 +1,148 @@
+#pragma once
+
+#include "json.h"
+#include <vector>
+
+namespace json {
+
+class Tape;
+
+// Read-only cursor into a Tape, with the read side of the Value API. Nothing
+// is decoded until it is asked for: strings are unescaped and numbers are
+// converted on every call, so callers that use a value more than once should
+// keep the result. Skipping a value is a single jump however large it is.
+//
+// Objects keep the order and the duplicate keys of the text; lookups scan the
+// members and find the last one with the name, like a Value would keep, but
+// walk() and iteration go in text order rather than sorted by key.
+class TapeValue {
+public:
+  TapeValue()
+    : tape_(nullptr)
+    , index_(0)
+  {}
+
+  // numbers are tInteger if they are written as 64-bit integers
+  Value::Type type() const;
+
+  // tBoolean
+  bool getBoolean() const;
+
+  // tString
+  std::string getString() const;
+
+  // tNumber
+  bool isInteger() const;
+  int getInteger() const;
+  sint64 getInteger64() const;
+  double getNumber() const;
+
+  // tObject
+  bool has(StringView name) const {
+    return get(name).tape_ != nullptr;
+  }
+  TapeValue get(StringView name) const;
+  TapeValue operator[](StringView name) const {
+    return get(name);
+  }
+  bool hasProperty(char const* name, uint8 type) const {
+    return get(name).type() == type;
+  }
+
+  // tArray
+  uint32 length() const;
+  TapeValue operator[](int i) const;
+
+  class ConstIterator {
+    Tape const* tape_;
+    uint32 index_;
+    bool object_;
+    friend class TapeValue;
+    ConstIterator(Tape const* tape, uint32 index, bool object)
+      : tape_(tape)
+      , index_(index)
+      , object_(object)
+    {}
+  public:
+    ConstIterator()
+      : tape_(nullptr)
+      , index_(0)
+      , object_(false)
+    {}
+
+    ConstIterator& operator++();
+    bool operator==(ConstIterator const& it) const {
+      return tape_ == it.tape_ && index_ == it.index_;
+    }
+    bool operator!=(ConstIterator const& it) const {
+      return !(*this == it);
+    }
+
+    TapeValue operator*() const;
+    std::string key() const;
+  };
+  ConstIterator begin() const;
+  ConstIterator end() const;
+
+  bool walk(Visitor* visitor) const;
+  // a copy that does not depend on the tape
+  Value toValue() const;
+
+private:
+  friend class Tape;
+  Tape const* tape_;
+  uint32 index_;
+  TapeValue(Tape const* tape, uint32 index)
+    : tape_(tape)
+    , index_(index)
+  {}
+};
+
+// Strict JSON parsed into a flat list of entries, one per value and object
+// key, in text order. Every entry holds the offset and size of its text and
+// the index of the entry after it, so a container is skipped by jumping to
+// its end. The text is kept with the tape for the values that get decoded.
+//
+// This is the cheap way to read a few fields out of a large file; anything
+// that reads all of it is better off with a Document.
+class Tape {
+public:
+  Tape() {}
+
+  TapeValue root() const {
+    return (entries_.empty() ? TapeValue() : TapeValue(this, 0));
+  }
+  void clear() {
+    text_.clear();
+    entries_.clear();
+  }
+
+private:
+  friend class TapeValue;
+  friend class TapeParser;
+  friend bool parse(File& file, Tape& tape, bool throwExceptions);
+  struct Entry {
+    uint8 type;     // Value::Type, with both kinds of numbers as tNumber
+    uint8 flags;    // the value of a boolean, or a string with escapes
+    uint32 offset;  // of the text, after the quote for strings
+    uint32 size;    // bytes of a string or number, items or members of a container
+    uint32 next;    // index of the entry after this value
+  };
+  std::string text_;
+  std::vector<Entry> entries_;
+
+  // unescaped text of a string
+  void decode(Entry const& entry, std::string& text) const;
+  // tInteger or tNumber, with the value in the matching argument
+  Value::Type number(Entry const& entry, sint64& integer, double& real) const;
+  bool walk(uint32 index, Visitor* visitor, std::string& text) const;
+
+  Tape(Tape const&) = delete;
+  Tape& operator=(Tape const&) = delete;
+};
+
+// Reads the rest of the file and leaves it right after the first value, like
+// parse() does. Errors are reported the same way, with the same messages.
+bool parse(File& file, Tape& tape, bool throwExceptions = false);
+
+}
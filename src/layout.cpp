@@ -0,0 +1,38 @@
+#include "layout.h"
+
+static uint32 Qualities[] = {
+  0x000000,
+  0x12129A, // 1
+  0x121278, // 2
+  0x121256, // 3
+  0x121234, // 4
+  0x121212, // 5
+  0x123412, // 6
+  0x125612, // 7
+  0x127812, // 8
+  0x129A12, // 9
+};
+
+void layoutTooltip(MatchResult const& data, TooltipLayout& rows) {
+  rows.clear();
+  for (auto& group : data.groups()) {
+    if (&group != &data.groups()[0]) {
+      rows.emplace_back(TooltipRow::Separator);
+    }
+    if (group.effect == MatchResult::Unknown) {
+      rows.emplace_back(data.name(group), 0x0000FF, true);
+    } else {
+      StringView effect = data.description(group);
+      if (effect.size() >= 2 && effect[0] == '$' && effect[1] >= '0' && effect[1] <= '9') {
+        rows.emplace_back(TooltipRow::Fill, Qualities[effect[1] - '0'], -4);
+        effect = StringView(effect.data() + 2, effect.size() - 2);
+      }
+      rows.emplace_back(data.name(group), 0xFFFFFF, true);
+      rows.emplace_back(effect, 0xFFFFFF, false);
+    }
+    for (uint32 i = 0; i < group.count; ++i) {
+      rows.emplace_back(data.line(group, i), 0x999999, false);
+    }
+    rows.emplace_back(TooltipRow::Fill, TooltipBackground, 5);
+  }
+}
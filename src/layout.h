@@ -0,0 +1,37 @@
+#pragma once
+
+#include "shrines.h"
+#include <string>
+#include <vector>
+
+// Device independent part of the tooltip rendering: turns match results into
+// the rows the window draws, top to bottom. Measuring and wrapping the text is
+// left to the renderer.
+struct TooltipRow {
+  enum Type {Text, Separator, Fill};
+  Type type;
+  std::wstring text;
+  uint32 color;   // text color, or background color for Fill rows
+  bool large;
+  int offset;     // Fill rows paint the background from this many pixels below the current line
+
+  TooltipRow(Type type_, uint32 color_ = 0, int offset_ = 0)
+    : type(type_)
+    , color(color_)
+    , large(false)
+    , offset(offset_)
+  {}
+  TooltipRow(StringView text_, uint32 color_, bool large_)
+    : type(Text)
+    , text(utf8_to_utf16(text_))
+    , color(color_)
+    , large(large_)
+    , offset(0)
+  {}
+};
+
+typedef std::vector<TooltipRow> TooltipLayout;
+
+enum { TooltipBackground = 0x121212 };
+
+void layoutTooltip(MatchResult const& data, TooltipLayout& rows);
@@ -1,232 +1,12 @@
 #define NOMINMAX
 #include <windows.h>
-#include "http.h"
-#include "json.h"
-#include "regexp.h"
+#include "shrines.h"
+#include "layout.h"
+#include "trace.h"
 #include "resource.h"
-#include <list>
+#include <shlobj.h>
 #include <algorithm>
 
-struct KeyValue {
-  std::string key;
-  std::string value;
-  KeyValue() {}
-  KeyValue(std::string const& k, std::string const& v)
-    : key(k)
-    , value(v)
-  {}
-};
-
-struct ItemTip {
-  std::string rarity;
-  std::string name;
-  std::string base;
-
-  std::vector<KeyValue> baseStats;
-  std::vector<KeyValue> requirements;
-  std::string sockets;
-  int ilvl;
-  std::vector<std::vector<std::string>> sections;
-
-  ItemTip() {}
-  bool parse(std::string const& data);
-};
-
-bool ItemTip::parse(std::string const& data) {
-  static re::Prog reRarity(R"(Rarity: (\w+))");
-  static re::Prog reJunk(R"(<<set:\w+>>)");
-  static re::Prog reKeyValue(R"(([^:]+): (.+))");
-  static re::Prog reSockets(R"(Sockets: ([RGB \-]+))");
-  static re::Prog reLevel(R"((Itemlevel|Item Level): (\d+))");
-
-  std::vector<std::string> lines = split(data, '\n');
-  std::vector<std::string> sub;
-  int section = 0, line = 0, baseSection = -1;
-  for (auto& str : lines) {
-    str = trim(str);
-    if (str.empty()) continue;
-    if (str == "--------") {
-      ++section;
-      line = 0;
-    } else {
-      switch (section) {
-      case 0:
-        switch (line) {
-        case 0:
-          if (!reRarity.match(str, &sub)) return false;
-          rarity = strlower(sub[1]);
-          break;
-        case 1:
-          name = reJunk.replace(str, "");
-          break;
-        case 2:
-          base = str;
-          break;
-        }
-        break;
-      case 1:
-        if (reKeyValue.match(str, &sub)) {
-          baseStats.emplace_back(sub[1], sub[2]);
-        } else {
-          baseStats.emplace_back(str, "");
-        }
-        break;
-      case 2:
-        if (str == "Requirements:" || line > 0) {
-          if (line > 0) {
-            if (!reKeyValue.match(str, &sub)) return false;
-            requirements.emplace_back(sub[1], sub[2]);
-          } else if (str != "Requirements:") {
-            return false;
-          }
-          break;
-        } else {
-          ++section;
-          // fall through
-        }
-      case 3:
-        if (reSockets.match(str, &sub)) {
-          sockets = sub[1];
-          break;
-        } else {
-          ++section;
-          // fall through
-        }
-      case 4:
-        if (reLevel.match(str, &sub)) {
-          ilvl = atoi(sub[1].c_str());
-          break;
-        } else {
-          ++section;
-          // fall through
-        }
-      default:
-        if (baseSection < 0) baseSection = section;
-        if (section - baseSection >= sections.size()) sections.resize(section - baseSection + 1);
-        sections[section - baseSection].push_back(str);
-      }
-      ++line;
-    }
-  }
-  return !(rarity.empty() || name.empty());
-}
-
-typedef std::vector<std::vector<std::string>> MatchData;
-
-class ShrineData {
-public:
-  ShrineData() {
-    update();
-  }
-
-  MatchData match(ItemTip const& tip);
-
-  int version() {
-    return effects[0].getInteger();
-  }
-
-  bool update() {
-    matchers.clear();
-    HttpRequest request("http://poe.rivsoft.net/shrines/shrines.js");
-    if (!request.send()) return false;
-    File data = request.response();
-    if (!data) return false;
-    if (!json::parse(data, effects)) return false;
-
-    for (size_t i = 0; i < effects.length(); ++i) {
-      if (effects[i].type() != json::Value::tArray) continue;
-      for (size_t j = 2; j < effects[i].length(); ++j) {
-        auto& reg = effects[i][j];
-        if (reg.type() == json::Value::tArray) {
-          matchers.emplace_back(makeRe(reg[0].getString()), i, reg[1].getString());
-        } else {
-          matchers.emplace_back(makeRe(reg.getString()), i, "");
-        }
-      }
-    }
-    return true;
-  }
-private:
-  json::Value effects;
-  struct Matcher {
-    re::Prog prog;
-    int index;
-    std::string req;
-    Matcher(std::string const& regex, int i, std::string const& r)
-      : prog(regex, -1, re::Prog::CaseInsensitive)
-      , index(i)
-      , req(r)
-    {}
-  };
-  std::list<Matcher> matchers;
-  std::string makeRe(std::string const& src) {
-    std::string dst;
-    for (char c : src) {
-      if (c == '+') dst.append("\\+");
-      else if (c == '#') dst.append("[0-9.]+");
-      else dst.push_back(c);
-    }
-    return dst;
-  }
-  bool checkReq(std::string const& req, std::string const& type) {
-    if (req.empty()) return true;
-    if (type.empty()) return false;
-    std::vector<std::string> parts;
-    bool def;
-    if (req.substr(0, 5) == "type+") {
-      def = true;
-      parts = split(req, '+');
-    } else if (req.substr(0, 5) == "type-") {
-      def = false;
-      parts = split(req, '-');
-    } else {
-      return true;
-    }
-    std::string tlow = strlower(type);
-    for (size_t i = 1; i < parts.size(); ++i) {
-      if (tlow.find(parts[i]) != std::string::npos) return def;
-    }
-    return !def;
-  }
-};
-
-MatchData ShrineData::match(ItemTip const& tip) {
-  std::map<int, std::vector<std::string>> matched;
-  std::vector<std::string> unknown;
-  size_t hasImplicit = 0;
-  for (size_t i = 0; i < tip.sections.size(); ++i) {
-    if (tip.sections[i].size() == 1 && i == 0 && tip.sections.size() > 1) {
-      hasImplicit = 1;
-      continue;
-    }
-    for (auto& str : tip.sections[i]) {
-      bool found = false;
-      for (auto& m : matchers) {
-        if (m.prog.match(str) && checkReq(m.req, tip.base)) {
-          matched[m.index].push_back(str);
-          found = true;
-        }
-      }
-      if (!found && i == hasImplicit) unknown.push_back(str);
-    }
-  }
-  MatchData res;
-  for (auto& kv : matched) {
-    res.emplace_back();
-    auto& dst = res.back();
-    dst.push_back(effects[kv.first][0].getString());
-    dst.push_back(effects[kv.first][1].getString());
-    dst.insert(dst.end(), kv.second.begin(), kv.second.end());
-  }
-  if (!unknown.empty()) {
-    res.emplace_back();
-    auto& dst = res.back();
-    dst.push_back("Unknown");
-    dst.insert(dst.end(), unknown.begin(), unknown.end());
-  }
-  return res;
-}
-
 class TooltipWindow {
 public:
   TooltipWindow(HINSTANCE hInstance);
@@ -239,7 +19,9 @@ private:
   static HRESULT CALLBACK WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
   int render(HDC hDC);
   HWND hWnd_;
-  MatchData data_;
+  ItemTip item_;
+  MatchResult data_;
+  TooltipLayout layout_;
   int attempts_;
   ShrineData shrines_;
   POINT cursor_;
@@ -247,11 +29,27 @@ private:
   bool hooked_;
   int version_;
   void checkVersion();
+  void refresh();
 };
 
-enum {MenuRefresh = 100, MenuExit = 101, WM_TRAYNOTIFY = WM_USER + 104};
+enum {MenuRefresh = 100, MenuExit = 101, WM_TRAYNOTIFY = WM_USER + 104, WM_SHRINESUPDATED = WM_USER + 105};
+
+static std::string dataPath(wchar_t const* name) {
+  wchar_t path[MAX_PATH];
+  if (FAILED(SHGetFolderPath(NULL, CSIDL_LOCAL_APPDATA | CSIDL_FLAG_CREATE, NULL, 0, path))) {
+    return "";
+  }
+  std::wstring dir = std::wstring(path) + L"\\ShrineTips";
+  CreateDirectory(dir.c_str(), NULL);
+  return utf16_to_utf8(dir + L"\\" + name);
+}
+
+TooltipWindow::TooltipWindow(HINSTANCE hInstance)
+  : shrines_(dataPath(L"shrines.cache"))
+{
+  std::string telemetry = dataPath(L"telemetry.json");
+  if (!telemetry.empty()) shrines_.loadTelemetry(telemetry);
 
-TooltipWindow::TooltipWindow(HINSTANCE hInstance) {
   attempts_ = 0;
   hooked_ = false;
   version_ = 102;
@@ -297,8 +95,11 @@ TooltipWindow::TooltipWindow(HINSTANCE hInstance) {
   nid.hIcon = LoadIcon(hInstance, MAKEINTRESOURCE(IDI_MAIN));
   wcscpy(nid.szTip, L"Shrine Effect Tooltip");
   Shell_NotifyIcon(NIM_ADD, &nid);
+
+  refresh();
 }
 TooltipWindow::~TooltipWindow() {
+  shrines_.saveTelemetry();
   DestroyMenu(tray_);
 }
 void TooltipWindow::checkVersion() {
@@ -312,6 +113,13 @@ void TooltipWindow::checkVersion() {
   }
 }
 
+void TooltipWindow::refresh() {
+  HWND hWnd = hWnd_;
+  shrines_.refresh([hWnd](bool result) {
+    PostMessage(hWnd, WM_SHRINESUPDATED, result, 0);
+  });
+}
+
 struct LineDrawer {
   LineDrawer(HWND hwnd, HDC hdc)
     : hWnd(hwnd)
@@ -328,7 +136,7 @@ struct LineDrawer {
     hFontSmall = CreateFontIndirect(&lf);
     lf.lfHeight = -16;
     hFontLarge = CreateFontIndirect(&lf);
-    SetBkColor(hDC, 0x121212);
+    SetBkColor(hDC, TooltipBackground);
 
     GetClientRect(hWnd, &rc);
     wrc = rc;
@@ -351,12 +159,10 @@ struct LineDrawer {
     wrc.top = rc.top + delta;
     ExtTextOut(hDC, 0, 0, ETO_OPAQUE, &wrc, NULL, 0, NULL);
   }
-  void text(std::string const& str, uint32 color = 0x000000, bool large = false) {
+  void text(std::wstring const& wstr, uint32 color = 0x000000, bool large = false) {
     SetTextColor(hDC, color);
     if (large) SelectObject(hDC, hFontLarge);
     else SelectObject(hDC, hFontSmall);
-    SIZE sz;
-    std::wstring wstr = utf8_to_utf16(str);
     rc.bottom = rc.top + 256;
     rc.bottom = (rc.top += DrawText(hDC, wstr.c_str(), wstr.size(), &rc, DT_LEFT | DT_TOP | DT_WORDBREAK));
   }
@@ -369,53 +175,28 @@ struct LineDrawer {
   RECT rc, wrc;
 };
 
-static uint32 Qualities[] = {
-  0x000000,
-  0x12129A, // 1
-  0x121278, // 2
-  0x121256, // 3
-  0x121234, // 4
-  0x121212, // 5
-  0x123412, // 6
-  0x125612, // 7
-  0x127812, // 8
-  0x129A12, // 9
-};
-
 int TooltipWindow::render(HDC hDC) {
   LineDrawer painter(hWnd_, hDC);
 
-  for (auto& group : data_) {
-    if (!group.size()) continue;
-    if (&group != &data_[0]) {
+  layoutTooltip(data_, layout_);
+  for (auto& row : layout_) {
+    switch (row.type) {
+    case TooltipRow::Separator:
       painter.line();
+      break;
+    case TooltipRow::Fill:
+      SetBkColor(hDC, row.color);
+      painter.fill(row.offset);
+      break;
+    default:
+      painter.text(row.text, row.color, row.large);
     }
-    size_t index = 0;
-    if (group[0] == "Unknown") {
-      painter.text(group[0], 0x0000FF, true);
-      index = 1;
-    } else if (group.size() > 1) {
-      std::string effect = group[1];
-      if (effect.size() >= 2 && effect[0] == '$') {
-        SetBkColor(hDC, Qualities[effect[1] - '0']);
-        painter.fill(-4);
-        effect = effect.substr(2);
-      }
-      painter.text(group[0], 0xFFFFFF, true);
-      painter.text(effect, 0xFFFFFF, false);
-      index = 2;
-    }
-    while (index < group.size()) {
-      painter.text(group[index++], 0x999999, false);
-    }
-    SetBkColor(hDC, 0x121212);
-    painter.fill(5);
   }
 
   return painter.rc.bottom;
 }
 
-enum { TimerUpdate = 102, TimerClipboard = 100, TimerCursor = 101, TimerForeground = 103, HotkeyId = 108 };
+enum { TimerUpdate = 102, TimerClipboard = 100, TimerCursor = 101, TimerForeground = 103, TimerTelemetry = 104, HotkeyId = 108 };
 
 HRESULT CALLBACK TooltipWindow::WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
   TooltipWindow* wnd = nullptr;
@@ -430,6 +211,7 @@ HRESULT CALLBACK TooltipWindow::WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPA
   switch (uMsg) {
   case WM_CREATE:
     SetTimer(hWnd, TimerUpdate, 1000 * 1800, NULL);
+    SetTimer(hWnd, TimerTelemetry, 1000 * 600, NULL);
     SetTimer(hWnd, TimerForeground, 1000, NULL);
     wnd->checkVersion();
     return 0;
@@ -470,7 +252,9 @@ HRESULT CALLBACK TooltipWindow::WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPA
           KillTimer(hWnd, wParam);
         }
       } else {
-        wnd->data_ = wnd->shrines_.match(item);
+        // the match result refers to the lines of the item
+        wnd->item_ = std::move(item);
+        wnd->shrines_.match(wnd->item_, wnd->data_);
         SetWindowPos(hWnd, NULL, 0, 0, 300, 1024, SWP_NOZORDER | SWP_NOMOVE | SWP_HIDEWINDOW | SWP_NOACTIVATE);
         HDC hDC = GetDC(hWnd);
         int height = wnd->render(hDC);
@@ -486,9 +270,10 @@ HRESULT CALLBACK TooltipWindow::WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPA
         wnd->cursor_ = pt;
         SetTimer(hWnd, TimerCursor, 50, NULL);
       }
+    } else if (wParam == TimerTelemetry) {
+      wnd->shrines_.saveTelemetry();
     } else if (wParam == TimerUpdate) {
-      wnd->shrines_.update();
-      wnd->checkVersion();
+      wnd->refresh();
     } else if (wParam == TimerCursor) {
       POINT pt;
       GetCursorPos(&pt);
@@ -514,6 +299,9 @@ HRESULT CALLBACK TooltipWindow::WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPA
       }
     }
     return 0;
+  case WM_SHRINESUPDATED:
+    if (wParam) wnd->checkVersion();
+    return 0;
   case WM_NCHITTEST:
     return HTNOWHERE;
   case WM_TRAYNOTIFY: {
@@ -524,8 +312,7 @@ HRESULT CALLBACK TooltipWindow::WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPA
     int result = TrackPopupMenuEx(wnd->tray_, TPM_HORIZONTAL | TPM_LEFTALIGN | TPM_RETURNCMD | TPM_NONOTIFY,
       pt.x, pt.y, hWnd, NULL);
     if (result == MenuRefresh) {
-      wnd->shrines_.update();
-      wnd->checkVersion();
+      wnd->refresh();
     } else {
       PostQuitMessage(0);
     }
@@ -537,6 +324,7 @@ HRESULT CALLBACK TooltipWindow::WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPA
 }
 
 bool TooltipWindow::getClipboard(std::wstring& text) {
+  TRACE_SPAN("clipboard");
   if (!IsClipboardFormatAvailable(CF_UNICODETEXT)) return false;
   if (!OpenClipboard(hWnd_)) return false;
   text.clear();
@@ -558,13 +346,26 @@ void TooltipWindow::clearClipboard() {
 }
 
 int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLine, int nCmdShow) {
-  TooltipWindow window(hInstance);
+  // "--trace=path" records timing spans and writes them to path on exit
+  std::wstring cmdLine(lpCmdLine);
+  std::string tracePath;
+  if (cmdLine.compare(0, 8, L"--trace=") == 0) {
+    tracePath = utf16_to_utf8(cmdLine.substr(8));
+    trace::enable(true);
+  }
 
   MSG msg;
-  while (GetMessage(&msg, NULL, 0, 0)) {
-    TranslateMessage(&msg);
-    DispatchMessage(&msg);
+  {
+    TooltipWindow window(hInstance);
+    while (GetMessage(&msg, NULL, 0, 0)) {
+      TranslateMessage(&msg);
+      DispatchMessage(&msg);
+    }
   }
 
+  if (!tracePath.empty()) {
+    File file(tracePath, "wb");
+    if (file) trace::dump(file);
+  }
   return msg.wParam;
 }
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Fixed-capacity FIFO shared between threads. push() waits while the queue is
+// full, which gives producers backpressure; pop() waits until an item arrives,
+// and returns false once the queue is closed and drained.
+template<class T>
+class BlockingQueue {
+public:
+  explicit BlockingQueue(size_t capacity)
+    : capacity_(capacity)
+    , closed_(false)
+  {}
+
+  bool push(T&& item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    notFull_.wait(lock, [this]() { return closed_ || items_.size() < capacity_; });
+    if (closed_) return false;
+    items_.push_back(std::move(item));
+    notEmpty_.notify_one();
+    return true;
+  }
+  // fails instead of waiting when the queue is full
+  bool tryPush(T&& item) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_ || items_.size() >= capacity_) return false;
+    items_.push_back(std::move(item));
+    notEmpty_.notify_one();
+    return true;
+  }
+
+  bool pop(T& item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    notEmpty_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+    if (items_.empty()) return false;
+    item = std::move(items_.front());
+    items_.pop_front();
+    notFull_.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    notFull_.notify_all();
+    notEmpty_.notify_all();
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return items_.size();
+  }
+
+private:
+  size_t capacity_;
+  bool closed_;
+  std::deque<T> items_;
+  mutable std::mutex mutex_;
+  std::condition_variable notFull_;
+  std::condition_variable notEmpty_;
+};
+
+// Bounded multi-producer multi-consumer queue without locks (Vyukov's ring of
+// sequenced cells). Capacity is rounded up to a power of two. push() and pop()
+// spin and then yield while the queue is full or empty, which is cheap for the
+// short waits between busy pipeline stages but burns some CPU when idle.
+template<class T>
+class ConcurrentQueue {
+public:
+  explicit ConcurrentQueue(size_t capacity)
+    : head_(0)
+    , tail_(0)
+    , closed_(false)
+  {
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+    mask_ = size - 1;
+    cells_.reset(new Cell[size]);
+    for (size_t i = 0; i < size; ++i) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  bool tryPush(T&& item) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell = cells_[pos & mask_];
+      size_t seq = cell.seq.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell.value = std::move(item);
+          cell.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+  bool tryPop(T& item) {
+    size_t pos = head_.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell = cells_[pos & mask_];
+      size_t seq = cell.seq.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          item = std::move(cell.value);
+          cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // waits while the queue is full; fails if it is closed
+  bool push(T&& item) {
+    for (int spins = 0; !tryPush(std::move(item)); ++spins) {
+      if (closed_.load(std::memory_order_acquire)) return false;
+      backoff(spins);
+    }
+    return true;
+  }
+  // waits for an item; fails once the queue is closed and empty
+  bool pop(T& item) {
+    for (int spins = 0; !tryPop(item); ++spins) {
+      if (closed_.load(std::memory_order_acquire)) return tryPop(item);
+      backoff(spins);
+    }
+    return true;
+  }
+
+  void close() {
+    closed_.store(true, std::memory_order_release);
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T value;
+  };
+  // keep the producer and consumer counters on separate cache lines
+  enum { CacheLine = 64 };
+  std::unique_ptr<Cell[]> cells_;
+  size_t mask_;
+  char pad0_[CacheLine];
+  std::atomic<size_t> head_;
+  char pad1_[CacheLine];
+  std::atomic<size_t> tail_;
+  char pad2_[CacheLine];
+  std::atomic<bool> closed_;
+
+  static void backoff(int spins) {
+    if (spins < 64) return;
+    if (spins < 256) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+  }
+};
@@ -1,8 +1,10 @@
 #include <string.h>
+#include <wctype.h>
 #include <algorithm>
 
 #include "regexp.h"
 #include "utf8.h"
+#include "trace.h"
 
 namespace re {
 
@@ -36,7 +38,7 @@ static uint32 unescape(uint8_const_ptr& chr) {
     }
   }
 }
-static uint32 getchar(uint8_const_ptr& chr, uint32* table = NULL) {
+static uint32 getchar(uint8_const_ptr& chr, uintptr_t* table = NULL) {
   if (*chr == '\\') return unescape(++chr);
   return utf8::parse(utf8::transform(&chr, table));
 }
@@ -66,15 +68,15 @@ static void _addchar(std::string& res, char chr) {
 
 std::string CharacterClass::format() const {
   bool chrmap[256];
-  int has = 0, not = 0;
+  int has = 0, hasnot = 0;
   for (uint32 cp = 32; cp <= 126; ++cp) {
     chrmap[cp] = match(cp);
     has += (chrmap[cp] == true);
-    not += (chrmap[cp] == false);
+    hasnot += (chrmap[cp] == false);
   }
-  if (!not) return ".";
+  if (!hasnot) return ".";
   std::string res("[");
-  if (has > not) {
+  if (has > hasnot) {
     res.push_back('^');
     for (uint32 cp = 32; cp <= 126; ++cp) {
       chrmap[cp] = !chrmap[cp];
@@ -125,7 +127,7 @@ uint8_const_ptr CharacterClass::init(char const* src, int flags) {
   invert = (*src == '^');
   if (invert) src++;
   uint8_const_ptr pos = (uint8_const_ptr)src;
-  uint32* table = ((flags & Prog::CaseInsensitive) ? utf8::tf_lower : NULL);
+  uintptr_t* table = ((flags & Prog::CaseInsensitive) ? utf8::tf_lower : NULL);
   while (*pos && (pos == (uint8_const_ptr)src || *pos != ']')) {
     uint32 cp = -1;
     if (*pos == '\\') {
@@ -431,13 +433,43 @@ struct Thread {
   Match match;
 };
 
+// Scratch space for a single run; the program itself is never modified while
+// matching, so one Prog can be used from several threads at once.
+struct Context {
+  State* states;
+  uint32 flags;
+  int maxThreads;
+  Thread* threads;
+  int* list;
+  int cur;
+  int numThreads[2];
+  char const* matchText;
+
+  Context(State* states, int numStates, uint32 flags)
+    : states(states)
+    , flags(flags)
+    , maxThreads(32)
+  {
+    threads = new Thread[maxThreads * 2];
+    list = new int[numStates];
+  }
+  ~Context() {
+    delete[] threads;
+    delete[] list;
+  }
+
+  void addthread(State* state, Match const& match);
+  void advance(State* state, Match const& match, uint32 cp, char const* ref);
+};
+
 Prog::Prog(char const* expr, int length, uint32 f) {
+  TRACE_SPAN("re::compile");
   flags = f;
   Compiler comp;
   if (length < 0) length = strlen(expr);
   comp.init(expr, length);
 
-  uint32* ut_table = (flags & CaseInsensitive ? utf8::tf_lower : NULL);
+  uintptr_t* ut_table = (flags & CaseInsensitive ? utf8::tf_lower : NULL);
 
   uint8_const_ptr pos = (uint8_const_ptr)expr;
   uint8_const_ptr end = pos + length;
@@ -545,18 +577,39 @@ Prog::Prog(char const* expr, int length, uint32 f) {
   start = &states[startpos];
 
   numCaptures = comp.cursub;
-  maxThreads = 32;
-  threads = new Thread[maxThreads * 2];
+  for (auto& context : contexts_) {
+    context = nullptr;
+  }
 }
 Prog::~Prog() {
   delete[] states;
   for (int i = 0; i < masks.size(); i++) {
     delete masks[i];
   }
-  delete[] threads;
+  for (auto& context : contexts_) {
+    delete context.load();
+  }
 }
-void Prog::addthread(State* state, Match const& match) {
-  if (state->list < 0) {
+Context* Prog::acquire() const {
+  for (auto& cached : contexts_) {
+    if (Context* context = cached.exchange(nullptr)) {
+      return context;
+    }
+  }
+  return new Context(states, numStates, flags);
+}
+void Prog::release(Context* context) const {
+  for (auto& cached : contexts_) {
+    Context* empty = nullptr;
+    if (cached.compare_exchange_strong(empty, context)) {
+      return;
+    }
+  }
+  delete context;
+}
+void Context::addthread(State* state, Match const& match) {
+  int& slot = list[state - states];
+  if (slot < 0) {
     if (numThreads[1 - cur] >= maxThreads) {
       Thread* newthreads = new Thread[maxThreads * 4];
       memcpy(newthreads, threads, sizeof(Thread)* numThreads[0]);
@@ -566,13 +619,13 @@ void Prog::addthread(State* state, Match const& match) {
       maxThreads *= 2;
     }
     Thread* thread = &threads[(1 - cur) * maxThreads + numThreads[1 - cur]];
-    state->list = numThreads[1 - cur];
+    slot = numThreads[1 - cur];
     numThreads[1 - cur]++;
     thread->state = state;
     memcpy(&thread->match, &match, sizeof match);
   }
 }
-void Prog::advance(State* state, Match const& match, uint32 cp, char const* ref) {
+void Context::advance(State* state, Match const& match, uint32 cp, char const* ref) {
   if (state->type == State::OR) {
     advance(state->left, match, cp, ref);
     advance(state->right, match, cp, ref);
@@ -587,7 +640,7 @@ void Prog::advance(State* state, Match const& match, uint32 cp, char const* ref)
     m2.end[state->subid] = ref;
     advance(state->next, m2, cp, ref);
   } else if (state->type == State::BOL) {
-    if (flags & MultiLine) {
+    if (flags & Prog::MultiLine) {
       if (ref == matchText || ref[-1] == '\n') {
         advance(state->next, match, 0xFFFFFFFF, ref);
       }
@@ -597,7 +650,7 @@ void Prog::advance(State* state, Match const& match, uint32 cp, char const* ref)
       }
     }
   } else if (state->type == State::EOL) {
-    if (flags & MultiLine) {
+    if (flags & Prog::MultiLine) {
       if (*ref == 0 || *ref == '\r' || *ref == '\n') {
         advance(state->next, match, 0xFFFFFFFF, ref);
       }
@@ -617,49 +670,59 @@ void Prog::advance(State* state, Match const& match, uint32 cp, char const* ref)
   }
 }
 int Prog::run(char const* text, int length, bool exact,
-              bool(*callback) (Match const& match, void* arg), void* arg) {
+              bool(*callback) (Match const& match, void* arg), void* arg) const {
+  Context* context = acquire();
+  int count = run(context, text, length, exact, callback, arg);
+  release(context);
+  return count;
+}
+int Prog::run(Context* ctx, char const* text, int length, bool exact,
+              bool(*callback) (Match const& match, void* arg), void* arg) const {
+  int& cur = ctx->cur;
+  int* numThreads = ctx->numThreads;
   cur = 0;
   numThreads[0] = 0;
   numThreads[1] = 0;
   int pos = 0;
   if (length < 0) length = strlen(text);
-  matchText = text;
+  ctx->matchText = text;
   int count = 0;
-  uint32* ut_table = (flags & CaseInsensitive ? utf8::tf_lower : NULL);
+  uintptr_t* ut_table = (flags & CaseInsensitive ? utf8::tf_lower : NULL);
 
   while (true) {
     for (int i = 0; i < numStates; i++) {
-      if (pos > 0 && states[i].type == State::END && states[i].list >= 0 &&
+      if (pos > 0 && states[i].type == State::END && ctx->list[i] >= 0 &&
           (!exact || pos == length)) {
-        Thread* thread = &threads[cur * maxThreads + states[i].list];
+        Thread* thread = &ctx->threads[cur * ctx->maxThreads + ctx->list[i]];
         thread->match.end[0] = text + pos;
         count++;
         if (callback) {
           if (!callback(thread->match, arg)) return count;
         }
       }
-      states[i].list = -1;
+      ctx->list[i] = -1;
     }
     numThreads[1 - cur] = 0;
     uint8_const_ptr next = (uint8_const_ptr)(text + pos);
     uint32 cp = utf8::parse(utf8::transform(&next, ut_table));
     if (cp == '\r' && *next == '\n') next++;
     for (int i = 0; i < numThreads[cur]; i++) {
-      advance(threads[cur * maxThreads + i].state, threads[cur * maxThreads + i].match, cp, text + pos);
+      Thread* thread = &ctx->threads[cur * ctx->maxThreads + i];
+      ctx->advance(thread->state, thread->match, cp, text + pos);
     }
     if (pos == 0 || !exact) {
       Match match;
       memset(&match, 0, sizeof match);
       match.start[0] = text + pos;
-      advance(start, match, cp, text + pos);
+      ctx->advance(start, match, cp, text + pos);
     }
     cur = 1 - cur;
     if (pos >= length) break;
     pos = (char*)next - text;
   }
   for (int i = 0; i < numStates; i++) {
-    if (states[i].type == State::END && states[i].list >= 0) {
-      Thread* thread = &threads[cur * maxThreads + states[i].list];
+    if (states[i].type == State::END && ctx->list[i] >= 0) {
+      Thread* thread = &ctx->threads[cur * ctx->maxThreads + ctx->list[i]];
       thread->match.end[0] = text + pos;
       count++;
       if (callback) {
@@ -680,7 +743,7 @@ static bool matcher(Match const& match, void* arg) {
   }
   return true;
 }
-bool Prog::match(char const* text, std::vector<std::string>* sub) {
+bool Prog::match(char const* text, std::vector<std::string>* sub) const {
   int res = run(text, -1, true, matcher, sub);
   if (res) {
     if (sub) {
@@ -697,7 +760,7 @@ static bool finder(Match const& match, void* arg) {
   memcpy(arg, &match, sizeof match);
   return false;
 }
-int Prog::find(char const* text, int start, std::vector<std::string>* sub)
+int Prog::find(char const* text, int start, std::vector<std::string>* sub) const
 {
   Match match;
   if (run(text + start, -1, false, finder, &match)) {
@@ -752,7 +815,7 @@ void FindStruct::finish() {
     }
   }
 }
-std::vector<std::string> Prog::findAll(char const* text) {
+std::vector<std::string> Prog::findAll(char const* text) const {
   std::vector<std::string> result;
   FindStruct rs(text);
   rs.result = &result;
@@ -760,7 +823,7 @@ std::vector<std::string> Prog::findAll(char const* text) {
   rs.finish();
   return result;
 }
-void Prog::findAll_(char const* text, FindFunc* func) {
+void Prog::findAll_(char const* text, FindFunc* func) const {
   FindStruct rs(text);
   rs.func = func;
   run(text, -1, false, FindStruct::callback, &rs);
@@ -820,13 +883,13 @@ std::string ReplaceStruct::finish() {
   return result;
 }
 
-std::string Prog::replace(char const* text, char const* with) {
+std::string Prog::replace(char const* text, char const* with) const {
   ReplaceStruct rs(text);
   rs.with = with;
   run(text, -1, false, ReplaceStruct::callback, &rs);
   return rs.finish();
 }
-std::string Prog::replace_(char const* text, ReplaceFunc* with) {
+std::string Prog::replace_(char const* text, ReplaceFunc* with) const {
   ReplaceStruct rs(text);
   rs.func = with;
   run(text, -1, false, ReplaceStruct::callback, &rs);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "types.h"
+#include <atomic>
 #include <string>
 #include <vector>
 
@@ -57,6 +58,7 @@ struct Match {
 };
 struct Thread;
 struct State;
+struct Context;
 
 class Prog {
   uint32 flags;
@@ -66,13 +68,13 @@ class Prog {
   std::vector<CharacterClass*> masks;
   int numCaptures;
 
-  int maxThreads;
-  Thread* threads;
-  int cur;
-  int numThreads[2];
-  char const* matchText;
-  void addthread(State* state, Match const& match);
-  void advance(State* state, Match const& match, uint32 cp, char const* ref);
+  // scratch space of finished runs, kept for reuse by the next ones
+  enum { CachedContexts = 4 };
+  mutable std::atomic<Context*> contexts_[CachedContexts];
+  Context* acquire() const;
+  void release(Context* context) const;
+  int run(Context* context, char const* text, int length, bool exact,
+          bool(*callback) (Match const& match, void* arg), void* arg) const;
 
   friend struct FindStruct;
   struct FindFunc {
@@ -100,8 +102,8 @@ class Prog {
     Func const& func_;
   };
 
-  void findAll_(char const* text, FindFunc* func);
-  std::string replace_(char const* text, ReplaceFunc* func);
+  void findAll_(char const* text, FindFunc* func) const;
+  std::string replace_(char const* text, ReplaceFunc* func) const;
 public:
   Prog(char const* expr, int length = -1, uint32 flags = 0);
   Prog(std::string const& expr, int length = -1, uint32 flags = 0)
@@ -116,48 +118,52 @@ public:
     Unicode = 0x08,
   };
 
-  bool match(char const* text, std::vector<std::string>* sub = NULL);
-  int find(char const* text, int start = 0, std::vector<std::string>* sub = NULL);
+  bool match(char const* text, std::vector<std::string>* sub = NULL) const;
+  int find(char const* text, int start = 0, std::vector<std::string>* sub = NULL) const;
 
-  bool match(std::string const& text, std::vector<std::string>* sub = NULL) {
+  bool match(std::string const& text, std::vector<std::string>* sub = NULL) const {
     return match(text.c_str(), sub);
   }
-  int find(std::string const& text, int start = 0, std::vector<std::string>* sub = NULL) {
+  int find(std::string const& text, int start = 0, std::vector<std::string>* sub = NULL) const {
     return find(text.c_str(), start, sub);
   }
 
-  std::vector<std::string> findAll(char const* text);
+  std::vector<std::string> findAll(char const* text) const;
   template<class Func>
-  void findAll(char const* text, Func const& func) {
-    findAll_(text, &FindFuncHolder<Func>(func));
+  void findAll(char const* text, Func const& func) const {
+    FindFuncHolder<Func> holder(func);
+    findAll_(text, &holder);
   }
 
-  std::vector<std::string> findAll(std::string const& text) {
+  std::vector<std::string> findAll(std::string const& text) const {
     return findAll(text.c_str());
   }
   template<class Func>
-  void findAll(std::string const& text, Func const& func) {
-    findAll_(text.c_str(), &FindFuncHolder<Func>(func));
+  void findAll(std::string const& text, Func const& func) const {
+    FindFuncHolder<Func> holder(func);
+    findAll_(text.c_str(), &holder);
   }
 
   template<class Func>
-  std::string replace(char const* text, Func const& func) {
-    return replace_(text, &ReplaceFuncHolder<Func>(func));
+  std::string replace(char const* text, Func const& func) const {
+    ReplaceFuncHolder<Func> holder(func);
+    return replace_(text, &holder);
   }
-  std::string replace(char const* text, char const* with);
+  std::string replace(char const* text, char const* with) const;
 
   template<class Func>
-  std::string replace(std::string const& text, Func const& func) {
-    return replace_(text.c_str(), &ReplaceFuncHolder<Func>(func));
+  std::string replace(std::string const& text, Func const& func) const {
+    ReplaceFuncHolder<Func> holder(func);
+    return replace_(text.c_str(), &holder);
   }
-  std::string replace(std::string const& text, char const* with) {
+  std::string replace(std::string const& text, char const* with) const {
     return replace(text.c_str(), with);
   }
 
   int captures() const {
     return numCaptures;
   }
-  int run(char const* text, int length, bool exact, bool(*callback) (Match const& match, void* arg), void* arg);
+  int run(char const* text, int length, bool exact, bool(*callback) (Match const& match, void* arg), void* arg) const;
 };
 
 }
@@ -0,0 +1,321 @@
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <unistd.h>
+#endif
+#include "tool.h"
+#include "shrines.h"
+#include "queue.h"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <thread>
+
+#ifndef _WIN32
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace {
+
+enum {
+  MaxRequestSize = 1 << 20,
+  // responses a single connection may have outstanding before its reader stops
+  // taking requests off the socket
+  MaxPipeline = 64,
+  // how often the accept loop looks at the stop flag
+  PollInterval = 200,
+  // the longest wait after accept fails before trying again
+  MaxBackoff = 1000,
+};
+
+volatile std::sig_atomic_t stopRequested = 0;
+
+void onStopSignal(int) {
+  stopRequested = 1;
+}
+
+struct Request {
+  std::string text;
+  std::promise<std::string> result;
+};
+
+typedef BlockingQueue<std::unique_ptr<Request>> RequestQueue;
+
+// Counts the connection threads, which are detached, so that the accept loop
+// can wait for a free slot.
+struct Connections {
+  std::mutex lock;
+  std::condition_variable freed;
+  int open;
+  Connections()
+    : open(0)
+  {}
+};
+
+bool recvAll(SOCKET sock, char* data, size_t size) {
+  while (size) {
+    int count = recv(sock, data, static_cast<int>(std::min<size_t>(size, 1 << 16)), 0);
+    if (count <= 0) return false;
+    data += count;
+    size -= count;
+  }
+  return true;
+}
+
+bool sendAll(SOCKET sock, char const* data, size_t size) {
+  while (size) {
+    int count = send(sock, data, static_cast<int>(std::min<size_t>(size, 1 << 16)), MSG_NOSIGNAL);
+    if (count <= 0) return false;
+    data += count;
+    size -= count;
+  }
+  return true;
+}
+
+// frames are a 4-byte big-endian length followed by that many bytes
+bool recvFrame(SOCKET sock, std::string& text) {
+  uint8 header[4];
+  if (!recvAll(sock, reinterpret_cast<char*>(header), 4)) return false;
+  uint32 size = (uint32(header[0]) << 24) | (uint32(header[1]) << 16) | (uint32(header[2]) << 8) | uint32(header[3]);
+  if (size > MaxRequestSize) return false;
+  text.resize(size);
+  return !size || recvAll(sock, &text[0], size);
+}
+
+bool sendFrame(SOCKET sock, std::string const& text) {
+  uint32 size = static_cast<uint32>(text.size());
+  std::string frame;
+  frame.reserve(size + 4);
+  frame.push_back(char(size >> 24));
+  frame.push_back(char(size >> 16));
+  frame.push_back(char(size >> 8));
+  frame.push_back(char(size));
+  frame.append(text);
+  return sendAll(sock, frame.data(), frame.size());
+}
+
+std::string evaluate(ShrineData const& shrines, ItemTip& tip, std::string const& text) {
+  MemoryFile out;
+  json::WriterVisitor writer(out);
+  writer.onOpenMap();
+  if (tip.parse(text)) {
+    writeMatch(writer, &tip, shrines.match(tip));
+  } else {
+    writeMatch(writer, nullptr, MatchResult());
+  }
+  writer.onCloseMap();
+  writer.flush();
+  return std::string(reinterpret_cast<char const*>(out.data()), out.csize());
+}
+
+void worker(ShrineData const& shrines, RequestQueue& requests) {
+  std::unique_ptr<Request> request;
+  ItemTip tip;
+  while (requests.pop(request)) {
+    request->result.set_value(evaluate(shrines, tip, request->text));
+  }
+}
+
+// Each connection has a reader (this thread) that hands requests to the shared
+// worker pool, and a writer that sends the responses back in request order.
+// When either queue is full the reader stops reading, so a client that sends
+// faster than we answer is slowed down by TCP flow control.
+void serveConnection(SOCKET sock, std::shared_ptr<RequestQueue> requests, std::shared_ptr<Connections> connections) {
+  BlockingQueue<std::future<std::string>> pending(MaxPipeline);
+  std::thread writer([sock, &pending]() {
+    std::future<std::string> result;
+    bool connected = true;
+    while (pending.pop(result)) {
+      try {
+        std::string text = result.get();
+        if (connected) connected = sendFrame(sock, text);
+      } catch (std::future_error&) {
+        // the request was dropped because the server is shutting down
+        connected = false;
+      }
+    }
+  });
+
+  std::string text;
+  while (recvFrame(sock, text)) {
+    std::unique_ptr<Request> request(new Request);
+    request->text.swap(text);
+    if (!pending.push(request->result.get_future())) break;
+    if (!requests->push(std::move(request))) break;
+  }
+  pending.close();
+  writer.join();
+  closesocket(sock);
+  std::lock_guard<std::mutex> lock(connections->lock);
+  --connections->open;
+  connections->freed.notify_one();
+}
+
+// Errors that say something is wrong with the listening socket itself; any
+// other error (a connection reset before it was accepted, out of descriptors or
+// buffers) may go away, so accept is tried again.
+bool acceptFatal() {
+#ifdef _WIN32
+  int error = WSAGetLastError();
+  return error == WSAENOTSOCK || error == WSAEINVAL || error == WSAEOPNOTSUPP || error == WSANOTINITIALISED;
+#else
+  return errno == EBADF || errno == ENOTSOCK || errno == EINVAL || errno == EOPNOTSUPP;
+#endif
+}
+
+// Waits until the socket has a connection to accept, or the wait times out.
+bool readable(SOCKET sock, int ms) {
+  fd_set fds;
+  FD_ZERO(&fds);
+  FD_SET(sock, &fds);
+  timeval timeout;
+  timeout.tv_sec = ms / 1000;
+  timeout.tv_usec = (ms % 1000) * 1000;
+  return select(static_cast<int>(sock + 1), &fds, nullptr, nullptr, &timeout) > 0;
+}
+
+SOCKET listenOn(std::string const& host, int port) {
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16>(port));
+  if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) return INVALID_SOCKET;
+
+  SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (sock == INVALID_SOCKET) return INVALID_SOCKET;
+  int reuse = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<char const*>(&reuse), sizeof reuse);
+  if (bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0 || listen(sock, SOMAXCONN) != 0) {
+    closesocket(sock);
+    return INVALID_SOCKET;
+  }
+  return sock;
+}
+
+}
+
+int runServer(Options const& opts) {
+  ShrineData shrines;
+  File effects(opts.get("effects"));
+  if (!effects || !shrines.load(effects)) {
+    fprintf(stderr, "failed to load effects from '%s'\n", opts.get("effects").c_str());
+    return 1;
+  }
+  int numThreads = std::max(opts.getInt("threads", defaultThreads()), 1);
+  int queueSize = std::max(opts.getInt("queue", 1024), 1);
+  int maxConnections = std::max(opts.getInt("connections", 256), 1);
+  std::string host = opts.get("host", "127.0.0.1");
+  int port = opts.getInt("port", 7411);
+  if (opts.has("telemetry")) shrines.loadTelemetry(opts.get("telemetry"));
+
+#ifdef _WIN32
+  WSADATA wsa;
+  if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+    fprintf(stderr, "failed to initialize winsock\n");
+    return 1;
+  }
+#endif
+  SOCKET server = listenOn(host, port);
+  if (server == INVALID_SOCKET) {
+    fprintf(stderr, "failed to listen on %s:%d\n", host.c_str(), port);
+    return 1;
+  }
+  fprintf(stderr, "serving effects version %d on %s:%d with %d threads\n",
+    shrines.version(), host.c_str(), port, numThreads);
+  signal(SIGINT, onStopSignal);
+  signal(SIGTERM, onStopSignal);
+#ifdef SIGBREAK
+  signal(SIGBREAK, onStopSignal);
+#endif
+
+  // shared with the connection threads, which are never joined
+  std::shared_ptr<RequestQueue> requests(new RequestQueue(queueSize));
+  std::shared_ptr<Connections> connections(new Connections);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < numThreads; ++i) {
+    threads.emplace_back(worker, std::cref(shrines), std::ref(*requests));
+  }
+
+  // hit counts are saved once a minute and on shutdown
+  std::mutex stopLock;
+  std::condition_variable stopSignal;
+  bool stopping = false;
+  std::thread telemetry;
+  if (opts.has("telemetry")) {
+    telemetry = std::thread([&]() {
+      std::unique_lock<std::mutex> lock(stopLock);
+      while (!stopSignal.wait_for(lock, std::chrono::seconds(60), [&]() { return stopping; })) {
+        shrines.saveTelemetry();
+      }
+    });
+  }
+
+  // runs until a stop signal, or until the listening socket breaks
+  int backoff = 0;
+  bool failed = false;
+  while (!stopRequested) {
+    {
+      std::unique_lock<std::mutex> lock(connections->lock);
+      if (!connections->freed.wait_for(lock, std::chrono::milliseconds(PollInterval),
+                                       [&]() { return connections->open < maxConnections; })) {
+        continue;
+      }
+    }
+    if (!readable(server, PollInterval)) continue;
+    SOCKET client = accept(server, nullptr, nullptr);
+    if (client == INVALID_SOCKET) {
+      if (acceptFatal()) {
+        failed = true;
+        break;
+      }
+      backoff = std::min(std::max(backoff * 2, 10), static_cast<int>(MaxBackoff));
+      std::this_thread::sleep_for(std::chrono::milliseconds(backoff));
+      continue;
+    }
+    backoff = 0;
+    int nodelay = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char const*>(&nodelay), sizeof nodelay);
+    {
+      std::lock_guard<std::mutex> lock(connections->lock);
+      ++connections->open;
+    }
+    std::thread(serveConnection, client, requests, connections).detach();
+  }
+  fprintf(stderr, failed ? "accept failed, shutting down\n" : "stopping\n");
+
+  // connections still open see their requests dropped and are closed by the client
+  closesocket(server);
+  requests->close();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  if (telemetry.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(stopLock);
+      stopping = true;
+    }
+    stopSignal.notify_one();
+    telemetry.join();
+    shrines.saveTelemetry();
+  }
+#ifdef _WIN32
+  WSACleanup();
+#endif
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,444 @@
+#include "shrines.h"
+#include "jsonbin.h"
+#include "jsondoc.h"
+#include "jsontape.h"
+#include "trace.h"
+#ifdef _WIN32
+#include "http.h"
+#endif
+#include <algorithm>
+#include <map>
+
+static std::string makeRe(std::string const& src) {
+  std::string dst;
+  for (char c : src) {
+    if (c == '+') dst.append("\\+");
+    else if (c == '#') dst.append("[0-9.]+");
+    else dst.push_back(c);
+  }
+  return dst;
+}
+
+// Patterns made of plain text and '#' match exactly the mod lines that have
+// the same template: a '#' stands for a whole run of digits and dots as long
+// as there are no other digits, dots or '#' next to it.
+static std::string makeTemplate(std::string const& src) {
+  std::string dst;
+  for (size_t i = 0; i < src.size(); ++i) {
+    char c = src[i];
+    if ((c & 0x80) || (c >= '0' && c <= '9') || strchr(".\\^$|?*()[]{}", c)) return "";
+    if (c == '#' && i && src[i - 1] == '#') return "";
+    dst.push_back(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+  }
+  return dst;
+}
+
+ShrineData::Effects::Matcher::Matcher(std::string const& regex, int i, std::string const& r)
+  : prog(makeRe(regex), -1, re::Prog::CaseInsensitive)
+  , index(i)
+  , req(ReqNone)
+  , pattern(regex)
+  , templ(makeTemplate(regex))
+  , seq(0)
+  , hits(0)
+{
+  if (r.empty()) return;
+  if (r.substr(0, 5) == "type+") {
+    req = ReqInclude;
+    types = split(r, '+');
+  } else if (r.substr(0, 5) == "type-") {
+    req = ReqExclude;
+    types = split(r, '-');
+  } else {
+    req = ReqOther;
+    return;
+  }
+  types.erase(types.begin());
+}
+
+// whether text contains the lowercase part, ignoring the case of text
+static bool containsLower(StringView text, std::string const& part) {
+  if (part.size() > text.size()) return false;
+  for (size_t i = 0; i + part.size() <= text.size(); ++i) {
+    size_t j = 0;
+    while (j < part.size()) {
+      char c = text[i + j];
+      if ((c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c) != part[j]) break;
+      ++j;
+    }
+    if (j == part.size()) return true;
+  }
+  return false;
+}
+
+bool ShrineData::Effects::Matcher::check(StringView type) const {
+  if (req == ReqNone) return true;
+  if (type.empty()) return false;
+  if (req == ReqOther) return true;
+  for (auto& part : types) {
+    if (containsLower(type, part)) return req == ReqInclude;
+  }
+  return req != ReqInclude;
+}
+
+// strings of a TapeValue and of a Node
+static std::string toString(std::string&& str) {
+  return std::move(str);
+}
+static std::string toString(StringView str) {
+  return str.str();
+}
+
+std::shared_ptr<ShrineData::Effects> ShrineData::Effects::load(File& data) {
+  // only strings are read out, so there is no point in building a Value
+  json::Tape tape;
+  if (!json::parse(data, tape)) return nullptr;
+  return build(tape.root());
+}
+
+std::shared_ptr<ShrineData::Effects> ShrineData::Effects::loadBinary(File& data) {
+  json::Document document;
+  json::DocumentBuilder builder(document);
+  if (!json::parseBinary(data, &builder)) return nullptr;
+  return build(document.root());
+}
+
+template<class V>
+std::shared_ptr<ShrineData::Effects> ShrineData::Effects::build(V const& effects) {
+  std::shared_ptr<Effects> res(new Effects);
+  res->version_ = effects[0].getInteger();
+  res->table.resize(effects.length());
+  res->effectHits.reset(new std::atomic<uint64>[effects.length() + 1]);
+  for (size_t i = 0; i <= effects.length(); ++i) {
+    res->effectHits[i] = 0;
+  }
+  int i = 0;
+  for (auto it = effects.begin(); it != effects.end(); ++it, ++i) {
+    V const& effect = *it;
+    if (effect.type() != json::Value::tArray) continue;
+    int j = 0;
+    for (auto line = effect.begin(); line != effect.end(); ++line, ++j) {
+      V const& reg = *line;
+      if (j == 0) {
+        res->table[i].name = toString(reg.getString());
+      } else if (j == 1) {
+        res->table[i].description = toString(reg.getString());
+      } else if (reg.type() == json::Value::tArray) {
+        res->matchers.emplace_back(toString(reg[0].getString()), i, toString(reg[1].getString()));
+      } else {
+        res->matchers.emplace_back(toString(reg.getString()), i, "");
+      }
+    }
+  }
+
+  std::map<std::string, MatcherList> byTemplate;
+  size_t seq = 0;
+  for (auto& m : res->matchers) {
+    m.seq = seq++;
+    if (m.templ.empty()) {
+      res->regexOnly.push_back(&m);
+    } else {
+      byTemplate[m.templ].push_back(&m);
+    }
+  }
+  res->templates.assign(byTemplate.begin(), byTemplate.end());
+  return res;
+}
+
+static bool lessTemplate(StringView lhs, StringView rhs) {
+  int cmp = memcmp(lhs.data(), rhs.data(), std::min(lhs.size(), rhs.size()));
+  return cmp ? cmp < 0 : lhs.size() < rhs.size();
+}
+
+ShrineData::Effects::MatcherList const* ShrineData::Effects::findTemplate(StringView templ) const {
+  auto it = std::lower_bound(templates.begin(), templates.end(), templ,
+    [](std::pair<std::string, MatcherList> const& entry, StringView key) {
+      return lessTemplate(entry.first, key);
+    });
+  return (it != templates.end() && StringView(it->first) == templ ? &it->second : nullptr);
+}
+
+ShrineData::Effects::~Effects() {
+  if (!totals) return;
+  HitCounts counts;
+  countHits(counts);
+  std::lock_guard<std::mutex> lock(totals->lock);
+  totals->counts.add(counts);
+}
+
+void ShrineData::Effects::countHits(HitCounts& counts) const {
+  counts.items += items.load(std::memory_order_relaxed);
+  for (size_t i = 0; i <= table.size(); ++i) {
+    uint64 hits = effectHits[i].load(std::memory_order_relaxed);
+    if (hits) counts.effects[i < table.size() ? table[i].name : "Unknown"] += hits;
+  }
+  for (auto& m : matchers) {
+    uint64 hits = m.hits.load(std::memory_order_relaxed);
+    if (hits) counts.matchers[HitCounts::MatcherKey(table[m.index].name, m.pattern)] += hits;
+  }
+}
+
+void ShrineData::Effects::match(ItemTip const& tip, MatchResult& res) const {
+  res.groups_.clear();
+  res.lines_.clear();
+  res.hits_.clear();
+
+  // hits are collected in item order and then grouped by effect, with the
+  // unknown lines last
+  StringView type = tip.base;
+  uint32 order = 0;
+  size_t hasImplicit = 0;
+  // items filled in by hand may have no templates; their lines, and those
+  // with multibyte characters, are checked against every regex
+  bool haveMods = (tip.mods.size() == tip.lines.size());
+  for (size_t i = 0; i < tip.sections.size(); ++i) {
+    if (tip.sections[i].count == 1 && i == 0 && tip.sections.size() > 1) {
+      hasImplicit = 1;
+      continue;
+    }
+    for (size_t mod = tip.sections[i].first; mod < tip.sections[i].first + tip.sections[i].count; ++mod) {
+      StringView str = tip.lines[mod];
+      bool found = false;
+      auto check = [&](Matcher const& m, bool exact) {
+        if ((exact || m.prog.match(str.data())) && m.check(type)) {
+          m.hits.fetch_add(1, std::memory_order_relaxed);
+          MatchResult::Hit hit = {static_cast<uint32>(m.index), order++, str};
+          res.hits_.push_back(hit);
+          found = true;
+        }
+      };
+      if (haveMods && tip.mods[mod].ascii) {
+        // matchers with this template match without running their regex;
+        // merge them with the regex-only ones to keep the order of hits
+        MatcherList const* exact = findTemplate(tip.mods[mod].templ);
+        size_t a = 0, b = 0, na = (exact ? exact->size() : 0);
+        while (a < na || b < regexOnly.size()) {
+          if (b >= regexOnly.size() || (a < na && (*exact)[a]->seq < regexOnly[b]->seq)) {
+            check(*(*exact)[a++], true);
+          } else {
+            check(*regexOnly[b++], false);
+          }
+        }
+      } else {
+        for (auto& m : matchers) {
+          check(m, false);
+        }
+      }
+      if (!found && i == hasImplicit) {
+        MatchResult::Hit hit = {static_cast<uint32>(MatchResult::Unknown), order++, str};
+        res.hits_.push_back(hit);
+      }
+    }
+  }
+  std::sort(res.hits_.begin(), res.hits_.end());
+
+  for (auto& hit : res.hits_) {
+    int effect = static_cast<int>(hit.effect);
+    if (res.groups_.empty() || res.groups_.back().effect != effect) {
+      MatchResult::Group group = {effect, static_cast<uint32>(res.lines_.size()), 0};
+      res.groups_.push_back(group);
+    }
+    res.lines_.push_back(hit.line);
+    ++res.groups_.back().count;
+  }
+
+  items.fetch_add(1, std::memory_order_relaxed);
+  for (auto& group : res.groups_) {
+    size_t index = (group.effect == MatchResult::Unknown ? table.size() : group.effect);
+    effectHits[index].fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+MatchData MatchResult::toMatchData() const {
+  MatchData res;
+  for (auto& group : groups_) {
+    res.emplace_back();
+    auto& dst = res.back();
+    dst.push_back(name(group).str());
+    if (group.effect != Unknown) dst.push_back(description(group).str());
+    for (uint32 i = 0; i < group.count; ++i) {
+      dst.push_back(line(group, i).str());
+    }
+  }
+  return res;
+}
+
+#ifdef _WIN32
+namespace {
+
+class HttpSource : public ShrineSource {
+public:
+  explicit HttpSource(std::string const& url)
+    : url_(url)
+  {}
+
+  Response fetch(std::string const& etag, std::string const& modified) {
+    Response response;
+    HttpRequest request(url_);
+    if (!etag.empty()) request.addHeader("If-None-Match: " + etag);
+    if (!modified.empty()) request.addHeader("If-Modified-Since: " + modified);
+    if (!request.send()) return response;
+    response.status = request.status();
+    if (response.status == 200) {
+      response.body = request.response();
+      response.etag = request.header("ETag");
+      response.modified = request.header("Last-Modified");
+    }
+    return response;
+  }
+
+private:
+  std::string url_;
+};
+
+}
+#endif
+
+std::unique_ptr<ShrineSource> ShrineSource::http(std::string const& url) {
+#ifdef _WIN32
+  return std::unique_ptr<ShrineSource>(new HttpSource(url));
+#else
+  return nullptr;
+#endif
+}
+
+ShrineData::ShrineData(std::string const& cache, std::unique_ptr<ShrineSource> source)
+  : totals_(new HitTotals)
+  , busy_(false)
+  , source_(source ? std::move(source) : ShrineSource::http("http://poe.rivsoft.net/shrines/shrines.js"))
+  , cache_(cache)
+{
+  if (!cache_.empty()) loadCache();
+}
+
+ShrineData::~ShrineData() {
+  if (refresh_.joinable()) refresh_.join();
+}
+
+MatchResult ShrineData::match(ItemTip const& tip) const {
+  MatchResult result;
+  match(tip, result);
+  return result;
+}
+
+void ShrineData::match(ItemTip const& tip, MatchResult& result) const {
+  TRACE_SPAN("ShrineData::match");
+  result.effects_ = data_.get();
+  if (result.effects_) {
+    result.effects_->match(tip, result);
+  } else {
+    result.groups_.clear();
+    result.lines_.clear();
+  }
+}
+
+int ShrineData::version() const {
+  auto effects = data_.get();
+  return (effects ? effects->version() : 0);
+}
+
+bool ShrineData::update() {
+  // without a source, data comes from load() or the cache
+  if (!source_) return false;
+  std::lock_guard<std::mutex> lock(update_);
+  TRACE_SPAN("ShrineData::update");
+  // validators only make sense if there is data they refer to
+  bool current = (data_.get() != nullptr);
+  auto response = source_->fetch(current ? etag_ : "", current ? modified_ : "");
+  if (response.status == 304) return current;
+  if (response.status != 200) return false;
+  if (!response.body || !load(response.body)) return false;
+  etag_ = response.etag;
+  modified_ = response.modified;
+  if (!cache_.empty()) saveCache(response.body);
+  return true;
+}
+
+// The cache file holds a small object with the validators of the last
+// response, immediately followed by the response body, both in binary JSON so
+// that starting up does not parse any text. Caches in the old text form fail
+// to load and are written again by the next update.
+bool ShrineData::loadCache() {
+  File file(cache_);
+  if (!file) return false;
+  json::Value meta;
+  if (!json::parseBinary(file, meta) || meta.type() != json::Value::tObject) return false;
+  auto effects = Effects::loadBinary(file);
+  if (!effects) return false;
+  effects->totals = totals_;
+  data_.set(effects);
+  etag_ = meta["etag"].getString().str();
+  modified_ = meta["modified"].getString().str();
+  return true;
+}
+
+void ShrineData::saveCache(File& data) {
+  std::string temp = cache_ + ".tmp";
+  {
+    File file(temp, "wb");
+    if (!file) return;
+    json::Value meta(json::Value::tObject);
+    meta["etag"] = etag_;
+    meta["modified"] = modified_;
+    bool ok = json::writeBinary(file, meta);
+    if (ok) {
+      // only called with data that loaded, so it parses again
+      data.seek(0);
+      json::BinaryWriterVisitor writer(file);
+      ok = json::parse(data, &writer);
+    }
+    if (!ok || !file.sync()) {
+      file.release();
+      remove(temp.c_str());
+      return;
+    }
+  }
+  replaceFile(temp, cache_);
+}
+
+bool ShrineData::load(File& data) {
+  auto effects = Effects::load(data);
+  if (!effects) return false;
+  effects->totals = totals_;
+  data_.set(effects);
+  return true;
+}
+
+HitCounts ShrineData::hitCounts() const {
+  // holding the current table keeps it from being added to the totals while
+  // we read them; a table replaced earlier that is still in use elsewhere is
+  // not counted until it is released
+  auto effects = data_.get();
+  HitCounts counts;
+  {
+    std::lock_guard<std::mutex> lock(totals_->lock);
+    counts = totals_->counts;
+  }
+  if (effects) effects->countHits(counts);
+  return counts;
+}
+
+bool ShrineData::loadTelemetry(std::string const& path) {
+  telemetry_ = path;
+  File file(path);
+  HitCounts counts;
+  if (!file || !counts.read(file)) return false;
+  std::lock_guard<std::mutex> lock(totals_->lock);
+  totals_->counts.add(counts);
+  return true;
+}
+
+bool ShrineData::saveTelemetry() const {
+  if (telemetry_.empty()) return false;
+  return hitCounts().save(telemetry_);
+}
+
+void ShrineData::refresh(std::function<void(bool)> const& callback) {
+  if (busy_.exchange(true)) return;
+  if (refresh_.joinable()) refresh_.join();
+  refresh_ = std::thread([this, callback]() {
+    bool result = update();
+    busy_ = false;
+    if (callback) callback(result);
+  });
+}
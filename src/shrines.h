@@ -0,0 +1,220 @@
+#pragma once
+
+#include "item.h"
+#include "json.h"
+#include "regexp.h"
+#include "snapshot.h"
+#include "telemetry.h"
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Old result shape: one list per effect holding its name, description and the
+// matched lines, and a last list starting with "Unknown" for unmatched lines.
+typedef std::vector<std::vector<std::string>> MatchData;
+
+class MatchResult;
+
+// Where update() downloads shrines.js from. The validators of the copy that
+// is loaded, if any, are sent along so the server can answer 304.
+class ShrineSource {
+public:
+  struct Response {
+    int status;   // 0 if there was no response
+    std::string etag;
+    std::string modified;
+    File body;    // only for 200
+    Response()
+      : status(0)
+    {}
+  };
+
+  virtual ~ShrineSource() {}
+  virtual Response fetch(std::string const& etag, std::string const& modified) = 0;
+
+  // WinHTTP on Windows; nullptr elsewhere, as there is no HTTP client there.
+  static std::unique_ptr<ShrineSource> http(std::string const& url);
+};
+
+class ShrineData {
+  struct HitTotals;
+public:
+  // Effect table and compiled matchers for one version of shrines.js.
+  // Never modified after load(), so it can be matched against from any number
+  // of threads while a newer one is being built.
+  class Effects {
+  public:
+    static std::shared_ptr<Effects> load(File& data);
+    // the same data, written by BinaryWriterVisitor
+    static std::shared_ptr<Effects> loadBinary(File& data);
+    // hands the hit counts to the totals it was loaded with
+    ~Effects();
+
+    int version() const {
+      return version_;
+    }
+    // Fills the result without touching its effects pointer.
+    void match(ItemTip const& tip, MatchResult& result) const;
+
+    StringView name(int index) const {
+      return table[index].name;
+    }
+    StringView description(int index) const {
+      return table[index].description;
+    }
+
+    // Adds the hits counted against this table.
+    void countHits(HitCounts& counts) const;
+
+  private:
+    friend class ShrineData;
+    Effects()
+      : version_(0)
+      , items(0)
+    {}
+    // from the root of a Tape or a Document
+    template<class V>
+    static std::shared_ptr<Effects> build(V const& effects);
+    int version_;
+    struct Matcher {
+      enum { ReqNone, ReqOther, ReqInclude, ReqExclude };
+      re::Prog prog;
+      int index;
+      int req;
+      // lowercase base type fragments for ReqInclude/ReqExclude
+      std::vector<std::string> types;
+      std::string pattern;
+      // lowercase ItemMod template the pattern is equal to, if it has no
+      // regex syntax of its own; empty if only the regex can tell
+      std::string templ;
+      size_t seq;
+      mutable std::atomic<uint64> hits;
+      Matcher(std::string const& regex, int i, std::string const& r);
+      bool check(StringView type) const;
+    };
+    std::list<Matcher> matchers;
+    // Matchers by template, sorted for binary search, and the rest. Both
+    // lists are in matcher order, so merging them visits matchers in the
+    // same order as the full list.
+    typedef std::vector<Matcher const*> MatcherList;
+    std::vector<std::pair<std::string, MatcherList>> templates;
+    MatcherList regexOnly;
+    MatcherList const* findTemplate(StringView templ) const;
+    // effect strings, indexed like the effects array
+    struct Effect {
+      std::string name;
+      std::string description;
+    };
+    std::vector<Effect> table;
+
+    // Hit counters are bumped with relaxed increments while matching, and
+    // only read when telemetry is queried or the table is released.
+    mutable std::atomic<uint64> items;
+    std::unique_ptr<std::atomic<uint64>[]> effectHits;  // indexed like table, plus Unknown last
+    std::shared_ptr<HitTotals> totals;
+  };
+
+  // If a cache path is given, the last good copy of shrines.js is loaded from
+  // it right away and later updates only download data that has changed.
+  // Updates come from source, or from the rivsoft.net server if it is null.
+  explicit ShrineData(std::string const& cache = "", std::unique_ptr<ShrineSource> source = nullptr);
+  ~ShrineData();
+
+  MatchResult match(ItemTip const& tip) const;
+  // Reuses the storage of a previous result.
+  void match(ItemTip const& tip, MatchResult& result) const;
+  int version() const;
+
+  std::shared_ptr<Effects const> effects() const {
+    return data_.get();
+  }
+
+  // Effect hits counted since the telemetry file was started: the loaded
+  // counts, those of previous effect tables and those of the current one.
+  HitCounts hitCounts() const;
+  // Starts counting on top of the counts saved at path, if any, and sets the
+  // file that saveTelemetry() writes to.
+  bool loadTelemetry(std::string const& path);
+  bool saveTelemetry() const;
+
+  // Downloads and publishes new data on the calling thread. If the server
+  // reports that the cached copy is still current, nothing is parsed.
+  // On failure the current data is kept.
+  bool update();
+  bool load(File& data);
+
+  // Same as update(), but runs on a background thread and reports the result
+  // through the callback (called on that thread). Does nothing if a refresh is
+  // already in progress.
+  void refresh(std::function<void(bool)> const& callback = nullptr);
+
+private:
+  struct HitTotals {
+    std::mutex lock;
+    HitCounts counts;
+  };
+  std::shared_ptr<HitTotals> totals_;
+  std::string telemetry_;
+
+  Snapshot<Effects> data_;
+  std::thread refresh_;
+  std::atomic<bool> busy_;
+
+  std::mutex update_;
+  std::unique_ptr<ShrineSource> source_;
+  std::string cache_;
+  std::string etag_;
+  std::string modified_;
+  bool loadCache();
+  void saveCache(File& data);
+};
+
+// Effects matched on one item. Groups refer to effects by index and to the
+// matched lines by view: the result keeps the effect table it was matched
+// against alive, but the ItemTip must outlive it.
+class MatchResult {
+public:
+  enum { Unknown = -1 };
+  struct Group {
+    int effect;     // index into the effect table, or Unknown
+    uint32 first;   // range of lines
+    uint32 count;
+  };
+
+  bool empty() const {
+    return groups_.empty();
+  }
+  std::vector<Group> const& groups() const {
+    return groups_;
+  }
+  StringView line(Group const& group, size_t index) const {
+    return lines_[group.first + index];
+  }
+  StringView name(Group const& group) const {
+    return group.effect == Unknown ? StringView("Unknown") : effects_->name(group.effect);
+  }
+  StringView description(Group const& group) const {
+    return group.effect == Unknown ? StringView() : effects_->description(group.effect);
+  }
+
+  // For code that still wants the old MatchData shape.
+  MatchData toMatchData() const;
+
+private:
+  friend class ShrineData;
+  friend class ShrineData::Effects;
+  std::shared_ptr<ShrineData::Effects const> effects_;
+  std::vector<Group> groups_;
+  std::vector<StringView> lines_;
+  struct Hit {
+    uint32 effect;  // Unknown lines sort last
+    uint32 order;
+    StringView line;
+    bool operator<(Hit const& rhs) const {
+      return effect != rhs.effect ? effect < rhs.effect : order < rhs.order;
+    }
+  };
+  std::vector<Hit> hits_;
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "types.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Current version of an immutable object that can be replaced while other
+// threads are reading it.
+// get() never blocks: the reader registers itself in the current epoch, copies
+// the shared pointer and leaves, so the object it got stays alive for as long
+// as the copy does. set() publishes a fully built object, flips the epoch and
+// waits for the readers of the previous epoch to drain before releasing the
+// old holder.
+template<class T>
+class Snapshot {
+public:
+  typedef std::shared_ptr<T const> Ptr;
+
+  Snapshot()
+    : current_(new Ptr())
+    , epoch_(0)
+  {
+    readers_[0] = 0;
+    readers_[1] = 0;
+  }
+  explicit Snapshot(Ptr const& ptr)
+    : Snapshot()
+  {
+    set(ptr);
+  }
+  ~Snapshot() {
+    delete current_.load();
+  }
+
+  Snapshot(Snapshot const&) = delete;
+  Snapshot& operator=(Snapshot const&) = delete;
+
+  Ptr get() const {
+    while (true) {
+      uint32 epoch = epoch_.load();
+      std::atomic<uint32>& readers = readers_[epoch & 1];
+      readers.fetch_add(1);
+      if (epoch_.load() == epoch) {
+        Ptr ptr = *current_.load();
+        readers.fetch_sub(1);
+        return ptr;
+      }
+      // a writer flipped the epoch between the two loads; it may not wait for us
+      readers.fetch_sub(1);
+    }
+  }
+
+  void set(Ptr const& ptr) {
+    std::lock_guard<std::mutex> lock(write_);
+    Ptr* old = current_.exchange(new Ptr(ptr));
+    uint32 epoch = epoch_.fetch_add(1);
+    while (readers_[epoch & 1].load()) {
+      std::this_thread::yield();
+    }
+    delete old;
+  }
+
+private:
+  std::atomic<Ptr*> current_;
+  std::atomic<uint32> epoch_;
+  mutable std::atomic<uint32> readers_[2];
+  std::mutex write_;
+};
@@ -0,0 +1,308 @@
+#include "tool.h"
+#include "shrines.h"
+#include "queue.h"
+#include "jsondoc.h"
+#include "jsonpath.h"
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <thread>
+
+namespace {
+
+enum { BatchSize = 64 };
+
+// A batch travels through every stage of the pipeline: the extractor fills
+// values, converters turn them into items, matchers into output text. Written
+// batches go back to the extractor, so their values and items keep their
+// storage.
+struct Batch {
+  uint64 seq;
+  uint64 first;
+  size_t size;
+  std::vector<json::Document> values;   // only the first size are in use
+  std::vector<std::string> stashes;
+  std::vector<ItemTip> items;
+  std::vector<char> parsed;
+  std::string output;
+};
+
+typedef ConcurrentQueue<std::unique_ptr<Batch>> BatchQueue;
+
+struct Stats {
+  std::atomic<uint64> parsed;
+  std::atomic<uint64> matched;
+  Stats()
+    : parsed(0)
+    , matched(0)
+  {}
+};
+
+// Streams a public stash API document and builds a json::Document for one
+// item at a time:
+//   {"stashes": [{"id": "...", "items": [{...}, ...]}, ...]}
+// Everything but the items and the stash ids is skipped by the parser, so
+// memory does not depend on the size of the input. Members of an object can
+// come in any order, so items that come before the id of their stash are
+// held until it is found, or until the stash ends without one.
+class StashExtractor : public json::Visitor {
+public:
+  // takes the item, and leaves a document to build the next one in
+  typedef std::function<void(json::Document&, std::string const&)> Sink;
+
+  explicit StashExtractor(Sink const& sink)
+    : sink_(sink)
+    , builder_(item_)
+    , depth_(0)
+    , stashes_(false)
+    , hasId_(false)
+    , held_(0)
+  {
+    json::Path id, item;
+    id.compile("$.stashes[*].id");
+    item.compile("$.stashes[*].items[*]");
+    paths_.add(id, [this](json::Value const& value) {
+      stash_ = value.getString().str();
+      hasId_ = true;
+      flush();
+      return true;
+    });
+    paths_.add(item, &builder_, [this]() {
+      if (hasId_) {
+        sink_(item_, stash_);
+      } else {
+        if (heldItems_.size() <= held_) heldItems_.emplace_back();
+        std::swap(heldItems_[held_++], item_);
+      }
+      builder_.reset();
+      return true;
+    });
+  }
+
+  bool parse(File& input) {
+    bool ok = json::parse(input, this);
+    // the items of a stash that was cut short
+    flush();
+    return ok;
+  }
+
+  bool skipValue() {
+    return paths_.skipValue();
+  }
+  bool onNull() {
+    return paths_.onNull();
+  }
+  bool onBoolean(bool val) {
+    return paths_.onBoolean(val);
+  }
+  bool onInteger(int val) {
+    return paths_.onInteger(val);
+  }
+  bool onNumber(double val) {
+    return paths_.onNumber(val);
+  }
+  bool onInteger64(sint64 val) {
+    return paths_.onInteger64(val);
+  }
+  bool onString(std::string const& val) {
+    return paths_.onString(val);
+  }
+  bool onOpenMap() {
+    if (++depth_ == 3 && stashes_) {
+      stash_.clear();
+      hasId_ = false;
+    }
+    return paths_.onOpenMap();
+  }
+  bool onMapKey(std::string const& key) {
+    if (depth_ == 1) stashes_ = (key == "stashes");
+    return paths_.onMapKey(key);
+  }
+  bool onCloseMap() {
+    bool res = paths_.onCloseMap();
+    if (depth_-- == 3 && stashes_) flush();
+    return res;
+  }
+  bool onOpenArray() {
+    ++depth_;
+    return paths_.onOpenArray();
+  }
+  bool onCloseArray() {
+    --depth_;
+    return paths_.onCloseArray();
+  }
+  bool onEnd() {
+    return paths_.onEnd();
+  }
+  void onError(uint32 line, uint32 col, std::string const& reason) {
+    paths_.onError(line, col, reason);
+  }
+
+private:
+  Sink sink_;
+  std::string stash_;
+  json::Document item_;
+  json::DocumentBuilder builder_;
+  json::PathVisitor paths_;
+  // depth of the current container; stashes are the objects at depth 3
+  // under the "stashes" member of the root
+  size_t depth_;
+  bool stashes_;
+  bool hasId_;
+  // items of the current stash that came before its id
+  std::vector<json::Document> heldItems_;
+  size_t held_;
+
+  void flush() {
+    for (size_t i = 0; i < held_; ++i) {
+      sink_(heldItems_[i], stash_);
+    }
+    held_ = 0;
+  }
+};
+
+void convert(BatchQueue& input, BatchQueue& output) {
+  std::unique_ptr<Batch> batch;
+  while (input.pop(batch)) {
+    batch->items.resize(batch->size);
+    batch->parsed.resize(batch->size);
+    for (size_t i = 0; i < batch->size; ++i) {
+      batch->parsed[i] = batch->items[i].parseStash(batch->values[i].root());
+    }
+    output.push(std::move(batch));
+  }
+}
+
+void match(ShrineData const& shrines, BatchQueue& input, BatchQueue& output, Stats& stats) {
+  std::unique_ptr<Batch> batch;
+  MatchResult data;
+  while (input.pop(batch)) {
+    MemoryFile out;
+    json::WriterVisitor writer(out);
+    uint64 parsed = 0, matched = 0;
+    for (size_t i = 0; i < batch->items.size(); ++i) {
+      writer.onOpenMap();
+      writer.onMapKey("item");
+      writer.onInteger64(static_cast<sint64>(batch->first + i));
+      if (!batch->stashes[i].empty()) {
+        writer.onMapKey("stash");
+        writer.onString(batch->stashes[i]);
+      }
+      if (batch->parsed[i]) {
+        shrines.match(batch->items[i], data);
+        ++parsed;
+        if (!data.empty()) ++matched;
+        writeMatch(writer, &batch->items[i], data);
+      } else {
+        writeMatch(writer, nullptr, MatchResult());
+      }
+      writer.onCloseMap();
+      writer.endLine();
+    }
+    writer.flush();
+    stats.parsed += parsed;
+    stats.matched += matched;
+    batch->output.assign(reinterpret_cast<char const*>(out.data()), out.csize());
+    output.push(std::move(batch));
+  }
+}
+
+// batches arrive in any order; the ones that are early wait for their turn
+void write(File& out, BatchQueue& input, BatchQueue& spare) {
+  std::map<uint64, std::unique_ptr<Batch>> waiting;
+  uint64 next = 0;
+  std::unique_ptr<Batch> batch;
+  while (input.pop(batch)) {
+    uint64 seq = batch->seq;
+    waiting[seq] = std::move(batch);
+    for (auto it = waiting.begin(); it != waiting.end() && it->first == next; it = waiting.erase(it), ++next) {
+      out.write(it->second->output.data(), it->second->output.size());
+      // dropped if the extractor has enough to go on
+      spare.tryPush(std::move(it->second));
+    }
+  }
+}
+
+}
+
+int runStash(Options const& opts) {
+  ShrineData shrines;
+  File effects(opts.get("effects"));
+  if (!effects || !shrines.load(effects)) {
+    fprintf(stderr, "failed to load effects from '%s'\n", opts.get("effects").c_str());
+    return 1;
+  }
+  if (opts.has("telemetry")) shrines.loadTelemetry(opts.get("telemetry"));
+  File input = openInput(opts.get("input", "-"));
+  if (!input) {
+    fprintf(stderr, "failed to open input '%s'\n", opts.get("input").c_str());
+    return 1;
+  }
+  File output = openOutput(opts.get("output", "-"));
+  if (!output) {
+    fprintf(stderr, "failed to open output '%s'\n", opts.get("output").c_str());
+    return 1;
+  }
+  int numThreads = std::max(opts.getInt("threads", defaultThreads()), 1);
+  int numConverters = std::max(numThreads / 4, 1);
+
+  // extract -> convert -> match -> write
+  double start = timeNow();
+  Stats stats;
+  BatchQueue values(numThreads * 2), items(numThreads * 2), results(numThreads * 4), spare(numThreads * 8);
+  std::vector<std::thread> converters, matchers;
+  for (int i = 0; i < numConverters; ++i) {
+    converters.emplace_back(convert, std::ref(values), std::ref(items));
+  }
+  for (int i = 0; i < numThreads; ++i) {
+    matchers.emplace_back(match, std::cref(shrines), std::ref(items), std::ref(results), std::ref(stats));
+  }
+  std::thread writer(write, std::ref(output), std::ref(results), std::ref(spare));
+
+  uint64 count = 0, batches = 0;
+  std::unique_ptr<Batch> batch;
+  auto submit = [&]() {
+    values.push(std::move(batch));
+  };
+  StashExtractor extractor([&](json::Document& item, std::string const& stash) {
+    if (!batch) {
+      if (spare.tryPop(batch)) {
+        batch->stashes.clear();
+      } else {
+        batch.reset(new Batch);
+      }
+      batch->seq = batches++;
+      batch->first = count;
+      batch->size = 0;
+    }
+    if (batch->values.size() <= batch->size) batch->values.emplace_back();
+    std::swap(batch->values[batch->size++], item);
+    batch->stashes.push_back(stash);
+    ++count;
+    if (batch->size >= BatchSize) submit();
+  });
+  bool ok = extractor.parse(input);
+  if (batch) submit();
+
+  values.close();
+  for (auto& thread : converters) {
+    thread.join();
+  }
+  items.close();
+  for (auto& thread : matchers) {
+    thread.join();
+  }
+  results.close();
+  writer.join();
+  if (opts.has("telemetry") && !shrines.saveTelemetry()) {
+    fprintf(stderr, "failed to save telemetry to '%s'\n", opts.get("telemetry").c_str());
+  }
+
+  double elapsed = std::max(timeNow() - start, 1e-6);
+  if (!ok) fprintf(stderr, "input is not valid JSON, stopped after %llu items\n", (unsigned long long) count);
+  fprintf(stderr, "%llu items (%llu parsed, %llu with effects) in %.3fs on %d+%d threads: %.0f items/s, %.1f MB/s\n",
+    (unsigned long long) count, (unsigned long long) stats.parsed.load(), (unsigned long long) stats.matched.load(),
+    elapsed, numConverters, numThreads, count / elapsed, std::max<double>(input.tell(), 0) / elapsed / 1048576.0);
+  return ok ? 0 : 1;
+}
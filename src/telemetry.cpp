@@ -0,0 +1,77 @@
+#include "telemetry.h"
+#include "jsonbin.h"
+
+void HitCounts::add(HitCounts const& rhs) {
+  items += rhs.items;
+  for (auto& kv : rhs.effects) {
+    effects[kv.first] += kv.second;
+  }
+  for (auto& kv : rhs.matchers) {
+    matchers[kv.first] += kv.second;
+  }
+}
+
+// {"items":N,"effects":{"name":N,...},"matchers":[["name","pattern",N],...]}
+// in binary JSON; files written as text by older versions are read as well.
+bool HitCounts::read(File& file) {
+  json::Value value;
+  uint64 start = file.tell();
+  if (!json::parseBinary(file, value)) {
+    file.seek(start);
+    if (!json::parse(file, value)) return false;
+  }
+  if (value.type() != json::Value::tObject) return false;
+  HitCounts counts;
+  counts.items = static_cast<uint64>(value["items"].getInteger64());
+  for (auto& kv : value["effects"].getMap()) {
+    counts.effects[kv.first.getString().str()] = static_cast<uint64>(kv.second.getInteger64());
+  }
+  json::Value const& matchers = value["matchers"];
+  for (size_t i = 0; i < matchers.length(); ++i) {
+    json::Value const& entry = matchers[i];
+    if (entry.type() != json::Value::tArray || entry.length() != 3) return false;
+    counts.matchers[MatcherKey(entry[0].getString().str(), entry[1].getString().str())] = static_cast<uint64>(entry[2].getInteger64());
+  }
+  *this = counts;
+  return true;
+}
+
+bool HitCounts::write(File& file) const {
+  json::BinaryWriterVisitor writer(file);
+  writer.onOpenMap();
+  writer.onMapKey("items");
+  writer.onInteger64(static_cast<sint64>(items));
+  writer.onMapKey("effects");
+  writer.onOpenMap();
+  for (auto& kv : effects) {
+    writer.onMapKey(kv.first);
+    writer.onInteger64(static_cast<sint64>(kv.second));
+  }
+  writer.onCloseMap();
+  writer.onMapKey("matchers");
+  writer.onOpenArray();
+  for (auto& kv : matchers) {
+    writer.onOpenArray();
+    writer.onString(kv.first.first);
+    writer.onString(kv.first.second);
+    writer.onInteger64(static_cast<sint64>(kv.second));
+    writer.onCloseArray();
+  }
+  writer.onCloseArray();
+  writer.onCloseMap();
+  return writer.onEnd();
+}
+
+bool HitCounts::save(std::string const& path) const {
+  std::string temp = path + ".tmp";
+  {
+    File file(temp, "wb");
+    if (!file) return false;
+    if (!write(file) || !file.sync()) {
+      file.release();
+      remove(temp.c_str());
+      return false;
+    }
+  }
+  return replaceFile(temp, path);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "file.h"
+#include <map>
+#include <string>
+
+// How often the shrine effects fired, keyed by name so that counts carry over
+// to newer versions of the effect table.
+struct HitCounts {
+  typedef std::pair<std::string, std::string> MatcherKey;  // effect name, pattern
+
+  uint64 items;                               // items matched
+  std::map<std::string, uint64> effects;      // items each effect was found on
+  std::map<MatcherKey, uint64> matchers;      // lines each pattern matched
+
+  HitCounts()
+    : items(0)
+  {}
+
+  void add(HitCounts const& rhs);
+
+  bool read(File& file);
+  bool write(File& file) const;
+  // Writes to a temporary file and syncs it to the disk before renaming it
+  // over the old one, so a crash or a full disk never leaves a partial file
+  // behind.
+  bool save(std::string const& path) const;
+};
@@ -0,0 +1,282 @@
+#include "tool.h"
+#include "jsonpath.h"
+#include "jsonsplit.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <thread>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+Options::Options(int argc, char** argv) {
+  for (int i = 0; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.size() > 2 && arg[0] == '-' && arg[1] == '-') {
+      size_t eq = arg.find('=');
+      if (eq == std::string::npos) {
+        values_[arg.substr(2)] = "";
+      } else {
+        values_[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+      }
+    } else {
+      args_.push_back(arg);
+    }
+  }
+}
+
+bool Options::has(char const* name) const {
+  return values_.find(name) != values_.end();
+}
+std::string Options::get(char const* name, char const* def) const {
+  auto it = values_.find(name);
+  return (it != values_.end() ? it->second : def);
+}
+int Options::getInt(char const* name, int def) const {
+  auto it = values_.find(name);
+  return (it != values_.end() && !it->second.empty() ? atoi(it->second.c_str()) : def);
+}
+
+File openInput(std::string const& path) {
+  if (path.empty() || path == "-") return File::stdfile(stdin);
+  return File(path, "rb");
+}
+File openOutput(std::string const& path) {
+  if (path.empty() || path == "-") return File::stdfile(stdout);
+  return File(path, "wb");
+}
+
+double timeNow() {
+  using namespace std::chrono;
+  return duration_cast<duration<double>>(steady_clock::now().time_since_epoch()).count();
+}
+
+int defaultThreads() {
+  int count = std::thread::hardware_concurrency();
+  return (count > 0 ? count : 1);
+}
+
+void writeMatch(json::WriterVisitor& writer, ItemTip const* tip, MatchResult const& data) {
+  if (!tip) {
+    writer.onMapKey("error");
+    writer.onString("not an item");
+    return;
+  }
+  writer.onMapKey("rarity");
+  writer.onString(tip->rarity);
+  writer.onMapKey("name");
+  writer.onString(tip->name);
+  writer.onMapKey("base");
+  writer.onString(tip->base);
+  writer.onMapKey("match");
+  writer.onOpenArray();
+  for (auto& group : data.groups()) {
+    writer.onOpenArray();
+    writer.onString(data.name(group));
+    if (group.effect != MatchResult::Unknown) writer.onString(data.description(group));
+    for (uint32 i = 0; i < group.count; ++i) {
+      writer.onString(data.line(group, i));
+    }
+    writer.onCloseArray();
+  }
+  writer.onCloseArray();
+}
+
+// Prints saved hit counts, most frequent first.
+static int runStats(Options const& opts) {
+  File file(opts.get("telemetry"));
+  HitCounts counts;
+  if (!file || !counts.read(file)) {
+    fprintf(stderr, "failed to read telemetry from '%s'\n", opts.get("telemetry").c_str());
+    return 1;
+  }
+  size_t top = std::max(opts.getInt("top", 20), 1);
+
+  std::vector<std::pair<uint64, std::string>> effects;
+  for (auto& kv : counts.effects) {
+    effects.emplace_back(kv.second, kv.first);
+  }
+  std::sort(effects.rbegin(), effects.rend());
+  printf("%llu items\n\neffects:\n", (unsigned long long) counts.items);
+  for (size_t i = 0; i < effects.size() && i < top; ++i) {
+    printf("%10llu  %s\n", (unsigned long long) effects[i].first, effects[i].second.c_str());
+  }
+
+  std::vector<std::pair<uint64, HitCounts::MatcherKey>> matchers;
+  for (auto& kv : counts.matchers) {
+    matchers.emplace_back(kv.second, kv.first);
+  }
+  std::sort(matchers.rbegin(), matchers.rend());
+  printf("\nmatchers:\n");
+  for (size_t i = 0; i < matchers.size() && i < top; ++i) {
+    printf("%10llu  %s: %s\n", (unsigned long long) matchers[i].first,
+      matchers[i].second.first.c_str(), matchers[i].second.second.c_str());
+  }
+  return 0;
+}
+
+// Writes every value matched by a path query as a JSON line. Paths that start
+// with [*] are matched in runs of the items of an array, parsed on several
+// threads (see json::parseArray).
+static int runSelect(Options const& opts) {
+  json::Path path;
+  if (!path.compile(opts.get("query"))) {
+    fprintf(stderr, "invalid query '%s'\n", opts.get("query").c_str());
+    return 1;
+  }
+  int numThreads = std::max(opts.getInt("threads", defaultThreads()), 1);
+  // runs are parsed in place, so the input is mapped
+  std::unique_ptr<FileMapping> mapping;
+  File input;
+  if (numThreads > 1 && path.anyItem() && opts.get("input", "-") != "-") {
+    mapping.reset(new FileMapping(opts.get("input")));
+    if (*mapping) {
+      input = File::memfile(mapping->data(), mapping->size());
+    } else {
+      mapping.reset();
+    }
+  }
+  if (!input) input = openInput(opts.get("input", "-"));
+  if (!input) {
+    fprintf(stderr, "failed to open input '%s'\n", opts.get("input").c_str());
+    return 1;
+  }
+  File output = openOutput(opts.get("output", "-"));
+  if (!output) {
+    fprintf(stderr, "failed to open output '%s'\n", opts.get("output").c_str());
+    return 1;
+  }
+
+  double start = timeNow();
+  uint64 count = 0;
+  bool ok;
+  if (mapping) {
+    // every run writes its matches to memory, and they are copied out in order
+    struct Run {
+      MemoryFile out;
+      json::WriterVisitor writer;
+      json::PathVisitor paths;
+      uint64 count;
+      Run()
+        : writer(out)
+        , count(0)
+      {}
+    };
+    std::deque<std::unique_ptr<Run>> runs;
+    ok = json::parseArray(input, numThreads, [&](size_t) -> json::Visitor* {
+      runs.emplace_back(new Run);
+      Run* run = runs.back().get();
+      run->paths.add(path, &run->writer, [run]() {
+        run->writer.endLine();
+        ++run->count;
+        return true;
+      });
+      return &run->paths;
+    }, [&](size_t) {
+      Run& run = *runs.front();
+      run.writer.flush();
+      output.write(run.out.data(), run.out.csize());
+      count += run.count;
+      runs.pop_front();
+      return true;
+    });
+  } else {
+    json::WriterVisitor writer(output);
+    json::PathVisitor paths;
+    paths.add(path, &writer, [&]() {
+      writer.endLine();
+      ++count;
+      return true;
+    });
+    ok = json::parse(input, &paths);
+    writer.flush();
+  }
+
+  double elapsed = std::max(timeNow() - start, 1e-6);
+  if (!ok) {
+    // parseArray does not say how far the runs got, so there is no rate to report
+    fprintf(stderr, "input is not valid JSON, stopped after %llu matches in %.3fs\n", (unsigned long long) count, elapsed);
+    return 1;
+  }
+  fprintf(stderr, "%llu matches in %.3fs: %.1f MB/s\n",
+    (unsigned long long) count, elapsed, std::max<double>(input.tell(), 0) / elapsed / 1048576.0);
+  return 0;
+}
+
+static void usage() {
+  fprintf(stderr,
+    "usage: ShrineTool <mode> [options] [--trace=trace.json]\n"
+    "\n"
+    "  batch --effects=shrines.js [--input=items.txt] [--output=out.ndjson] [--threads=N] [--telemetry=hits.json] [--binary]\n"
+    "      Matches concatenated clipboard item texts and writes one JSON line per item.\n"
+    "      With --binary the input is a file written by encode.\n"
+    "  serve --effects=shrines.js [--host=127.0.0.1] [--port=7411] [--threads=N] [--queue=1024] [--connections=256] [--telemetry=hits.json]\n"
+    "      Answers match requests over TCP. Requests and responses are framed by a 4-byte\n"
+    "      big-endian length; a request holds the item text and a response a JSON object.\n"
+    "      Requests on one connection may be pipelined and are answered in order.\n"
+    "      At most --connections clients are served at once; Ctrl+C or SIGTERM stops it.\n"
+    "  bench --effects=shrines.js [--input=items.txt] [--iterations=1]\n"
+    "      Replays item texts through utf16_to_utf8, parse, match and layout one at a time\n"
+    "      and prints latency percentiles and allocations per item for each stage.\n"
+    "  stash --effects=shrines.js [--input=stashes.json] [--output=out.ndjson] [--threads=N] [--telemetry=hits.json]\n"
+    "      Matches the items of a public stash API response, streaming it through a pipeline\n"
+    "      of extraction, conversion, matching and output stages. Writes one JSON line per item.\n"
+    "  encode [--input=items.txt] [--output=items.stip]\n"
+    "      Parses concatenated clipboard item texts and stores the items in a binary form\n"
+    "      that batch --binary reads without parsing them again.\n"
+    "  stats --telemetry=hits.json [--top=20]\n"
+    "      Prints the most frequent effects and patterns from saved hit counts.\n"
+    "  select --query=$.stashes[*].items[*].typeLine [--input=in.json] [--output=out.ndjson] [--threads=N]\n"
+    "      Writes every value a JSON path matches as a JSON line, skipping the rest of\n"
+    "      the input without decoding it. Steps are .name, ['name'], [n], .* and [*].\n"
+    "      Queries that start with $[*] on an array file are run on N threads.\n"
+    "  cachetest [--cache=cachetest.cache]\n"
+    "      Runs the shrines.js cache against a stand-in HTTP server on a loopback port:\n"
+    "      downloads, 304 revalidation and broken caches. Exits with 1 if a check fails.\n"
+    "\n"
+    "  --telemetry adds the effect hits of a run to the counts saved in that file.\n"
+    "  --trace=trace.json records timing spans of the hot paths and writes them in the\n"
+    "  Chrome trace event format when the mode finishes.\n");
+}
+
+int main(int argc, char** argv) {
+#ifdef _WIN32
+  _setmode(_fileno(stdin), _O_BINARY);
+  _setmode(_fileno(stdout), _O_BINARY);
+#endif
+  if (argc < 2) {
+    usage();
+    return 1;
+  }
+  std::string mode = argv[1];
+  Options opts(argc - 2, argv + 2);
+  if (opts.has("trace")) trace::enable(true);
+  int result = -1;
+  try {
+    if (mode == "batch") result = runBatch(opts);
+    if (mode == "serve") result = runServer(opts);
+    if (mode == "bench") result = runBench(opts);
+    if (mode == "stash") result = runStash(opts);
+    if (mode == "encode") result = runEncode(opts);
+    if (mode == "stats") result = runStats(opts);
+    if (mode == "select") result = runSelect(opts);
+    if (mode == "cachetest") result = runCacheTest(opts);
+  } catch (Exception& ex) {
+    fprintf(stderr, "%s\n", ex.what());
+    result = 1;
+  }
+  if (result < 0) {
+    usage();
+    return 1;
+  }
+  if (opts.has("trace")) {
+    File file(opts.get("trace"), "wb");
+    if (!file || !trace::dump(file)) {
+      fprintf(stderr, "failed to write trace to '%s'\n", opts.get("trace").c_str());
+    }
+  }
+  return result;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "common.h"
+#include "file.h"
+#include "json.h"
+#include "shrines.h"
+#include <string>
+#include <vector>
+
+// Command line options shared by the ShrineTool modes: "--name=value",
+// bare "--flag" switches and positional arguments.
+class Options {
+public:
+  Options(int argc, char** argv);
+
+  bool has(char const* name) const;
+  std::string get(char const* name, char const* def = "") const;
+  int getInt(char const* name, int def = 0) const;
+  std::vector<std::string> const& args() const {
+    return args_;
+  }
+
+private:
+  Dictionary values_;
+  std::vector<std::string> args_;
+};
+
+// Opens a file for reading or writing, with "-" meaning stdin or stdout.
+File openInput(std::string const& path);
+File openOutput(std::string const& path);
+
+double timeNow();
+int defaultThreads();
+
+// Writes the item summary and its match groups as keys of an open object,
+// or an "error" key if the item could not be parsed (tip is null).
+void writeMatch(json::WriterVisitor& writer, ItemTip const* tip, MatchResult const& data);
+
+int runBatch(Options const& opts);
+int runServer(Options const& opts);
+int runBench(Options const& opts);
+int runStash(Options const& opts);
+int runEncode(Options const& opts);
+int runCacheTest(Options const& opts);
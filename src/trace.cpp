@@ -0,0 +1,171 @@
+#include "trace.h"
+#include "file.h"
+#include "json.h"
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#ifdef _MSC_VER
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL __thread
+#endif
+
+namespace trace {
+
+std::atomic<bool> active(false);
+
+namespace {
+
+enum { BufferSize = 8192 };
+
+struct Event {
+  char const* name;
+  uint64 start;
+  uint64 end;
+};
+
+// Written only by the thread that owns it. When that thread exits the buffer
+// is handed to the next new thread, keeping its events until they are
+// overwritten, so threads that come and go do not keep adding buffers.
+struct Buffer {
+  uint32 tid;
+  bool owned;
+  std::atomic<uint64> head;
+  Event events[BufferSize];
+  Buffer(uint32 id)
+    : tid(id)
+    , owned(true)
+    , head(0)
+  {}
+};
+
+std::mutex buffersLock;
+std::vector<Buffer*> buffers;
+std::once_flag keyOnce;
+std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+TRACE_THREAD_LOCAL Buffer* local = nullptr;
+
+void releaseBuffer(void* ptr) {
+  if (!ptr) return;
+  std::lock_guard<std::mutex> lock(buffersLock);
+  static_cast<Buffer*>(ptr)->owned = false;
+}
+
+// thread exit notification, to release the buffer
+#ifdef _WIN32
+DWORD exitKey;
+void WINAPI onThreadExit(void* ptr) {
+  releaseBuffer(ptr);
+}
+void createKey() {
+  exitKey = FlsAlloc(onThreadExit);
+}
+void setKey(Buffer* buffer) {
+  FlsSetValue(exitKey, buffer);
+}
+#else
+pthread_key_t exitKey;
+void createKey() {
+  pthread_key_create(&exitKey, releaseBuffer);
+}
+void setKey(Buffer* buffer) {
+  pthread_setspecific(exitKey, buffer);
+}
+#endif
+
+Buffer* acquireBuffer() {
+  std::call_once(keyOnce, createKey);
+  Buffer* buffer = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(buffersLock);
+    for (Buffer* buf : buffers) {
+      if (!buf->owned) {
+        buf->owned = true;
+        buffer = buf;
+        break;
+      }
+    }
+    if (!buffer) {
+      buffer = new Buffer(static_cast<uint32>(buffers.size() + 1));
+      buffers.push_back(buffer);
+    }
+  }
+  setKey(buffer);
+  return buffer;
+}
+
+}
+
+void enable(bool on) {
+  active.store(on, std::memory_order_relaxed);
+}
+
+uint64 now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void record(char const* name, uint64 start, uint64 end) {
+  if (!local) local = acquireBuffer();
+  uint64 head = local->head.load(std::memory_order_relaxed);
+  Event& event = local->events[head % BufferSize];
+  event.name = name;
+  event.start = start;
+  event.end = end;
+  local->head.store(head + 1, std::memory_order_release);
+}
+
+bool dump(File& file) {
+  std::vector<Buffer*> list;
+  {
+    std::lock_guard<std::mutex> lock(buffersLock);
+    list = buffers;
+  }
+
+  json::WriterVisitor writer(file);
+  writer.onOpenMap();
+  writer.onMapKey("displayTimeUnit");
+  writer.onString("ns");
+  writer.onMapKey("traceEvents");
+  writer.onOpenArray();
+  std::vector<Event> events;
+  for (Buffer* buffer : list) {
+    uint64 head = buffer->head.load(std::memory_order_acquire);
+    uint64 first = (head > BufferSize ? head - BufferSize : 0);
+    events.clear();
+    for (uint64 i = first; i < head; ++i) {
+      events.push_back(buffer->events[i % BufferSize]);
+    }
+    // drop the events the owner may have overwritten while we were copying
+    uint64 after = buffer->head.load(std::memory_order_acquire);
+    size_t skip = static_cast<size_t>(after > first + BufferSize ? std::min<uint64>(after - first - BufferSize, events.size()) : 0);
+
+    for (size_t i = skip; i < events.size(); ++i) {
+      Event const& event = events[i];
+      writer.onOpenMap();
+      writer.onMapKey("name");
+      writer.onString(event.name);
+      writer.onMapKey("ph");
+      writer.onString("X");
+      writer.onMapKey("pid");
+      writer.onInteger(1);
+      writer.onMapKey("tid");
+      writer.onInteger(buffer->tid);
+      // microseconds
+      writer.onMapKey("ts");
+      writer.onNumber(event.start / 1000.0);
+      writer.onMapKey("dur");
+      writer.onNumber((event.end - event.start) / 1000.0);
+      writer.onCloseMap();
+    }
+  }
+  writer.onCloseArray();
+  writer.onCloseMap();
+  return true;
+}
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "types.h"
+#include <atomic>
+
+class File;
+
+// Scoped timing spans for the hot paths, kept in a ring buffer per thread and
+// dumped in the Chrome trace event format (chrome://tracing, Perfetto).
+// Tracing is off by default; a disabled span costs one load and one branch.
+namespace trace {
+
+  extern std::atomic<bool> active;
+
+  void enable(bool on);
+  inline bool enabled() {
+    return active.load(std::memory_order_relaxed);
+  }
+
+  uint64 now();
+  // name must be a string literal, or otherwise outlive the trace
+  void record(char const* name, uint64 start, uint64 end);
+
+  // Writes the recorded spans of all threads. Spans recorded while dumping
+  // may be missing from the output.
+  bool dump(File& file);
+
+  class Span {
+  public:
+    explicit Span(char const* name)
+      : name_(nullptr)
+      , start_(0)
+    {
+      if (enabled()) {
+        name_ = name;
+        start_ = now();
+      }
+    }
+    ~Span() {
+      if (name_) record(name_, start_, now());
+    }
+
+  private:
+    Span(Span const&) = delete;
+    Span& operator=(Span const&) = delete;
+    char const* name_;
+    uint64 start_;
+  };
+
+}
+
+#define TRACE_CONCAT2(a, b) a ## b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SPAN(name) trace::Span TRACE_CONCAT(traceSpan, __LINE__)(name)
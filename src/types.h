@@ -6,12 +6,21 @@ typedef char int8;
 typedef unsigned short uint16;
 typedef signed short sint16;
 typedef short int16;
+#ifdef _MSC_VER
 typedef unsigned long uint32;
 typedef signed long sint32;
 typedef long int32;
 typedef unsigned __int64 uint64;
 typedef signed __int64 sint64;
 typedef __int64 int64;
+#else
+typedef unsigned int uint32;
+typedef signed int sint32;
+typedef int int32;
+typedef unsigned long long uint64;
+typedef signed long long sint64;
+typedef long long int64;
+#endif
 
 typedef unsigned char* uint8_ptr;
 typedef signed char* sint8_ptr;
@@ -19,12 +28,12 @@ typedef char* int8_ptr;
 typedef unsigned short* uint16_ptr;
 typedef signed short* sint16_ptr;
 typedef short* int16_ptr;
-typedef unsigned long* uint32_ptr;
-typedef signed long* sint32_ptr;
-typedef long* int32_ptr;
-typedef unsigned __int64* uint64_ptr;
-typedef signed __int64* sint64_ptr;
-typedef __int64* int64_ptr;
+typedef uint32* uint32_ptr;
+typedef sint32* sint32_ptr;
+typedef int32* int32_ptr;
+typedef uint64* uint64_ptr;
+typedef sint64* sint64_ptr;
+typedef int64* int64_ptr;
 
 typedef unsigned char const* uint8_const_ptr;
 typedef signed char const* sint8_const_ptr;
@@ -32,12 +41,12 @@ typedef char const* int8_const_ptr;
 typedef unsigned short const* uint16_const_ptr;
 typedef signed short const* sint16_const_ptr;
 typedef short const* int16_const_ptr;
-typedef unsigned long const* uint32_const_ptr;
-typedef signed long const* sint32_const_ptr;
-typedef long const* int32_const_ptr;
-typedef unsigned __int64 const* uint64_const_ptr;
-typedef signed __int64 const* sint64_const_ptr;
-typedef __int64 const* int64_const_ptr;
+typedef uint32 const* uint32_const_ptr;
+typedef sint32 const* sint32_const_ptr;
+typedef int32 const* int32_const_ptr;
+typedef uint64 const* uint64_const_ptr;
+typedef sint64 const* sint64_const_ptr;
+typedef int64 const* int64_const_ptr;
 
 const uint8 max_uint8 = 0xFFU;
 const sint8 min_int8 = sint8(0x80);
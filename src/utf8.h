@@ -1,14 +1,17 @@
 #pragma once
 
 #include "types.h"
+#include <stdint.h>
 
 namespace utf8 {
 
-  extern uint32 tf_lower[256];
-  extern uint32 tf_upper[256];
+  // entries are either packed lowercase/uppercase sequences or pointers to the
+  // table for the next byte, hence pointer-sized
+  extern uintptr_t tf_lower[256];
+  extern uintptr_t tf_upper[256];
 
-  uint32 transform(uint8_const_ptr* ptr, uint32* table);
-  inline uint32 transform(uint8_const_ptr ptr, uint32* table) {
+  uint32 transform(uint8_const_ptr* ptr, uintptr_t* table);
+  inline uint32 transform(uint8_const_ptr ptr, uintptr_t* table) {
     return transform(&ptr, table);
   }
   uint8_const_ptr next(uint8_const_ptr ptr);